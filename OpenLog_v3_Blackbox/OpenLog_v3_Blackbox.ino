@@ -22,6 +22,8 @@
  
  During power up, you will see '12<'. '1' indicates the serial connection is established. '2' indicates
  the SD card has been successfully initialized. '<' indicates OpenLog is ready to receive serial characters.
+ Sending three ctrl-Z characters just after the '2' gets a '>' prompt instead, for downloading logs over the serial port
+ (see utils/src/log_download.c).
  
  Recording constant 115200bps datastreams are supported. Throw it everything you've got! To acheive this maximum record rate, please use the
  SD card formatter from : http://www.sdcard.org/consumers/formatter/. The fewer files on the card, the faster OpenLog is able to begin logging.
@@ -36,8 +38,8 @@
  LED Flashing errors @ 2Hz:
  No SD card - 3 blinks
  
- OpenLog regularly shuts down to conserve power. If after 0.5 seconds no characters are received, OpenLog will record any unsaved characters
- and go to sleep. OpenLog will automatically wake up and continue logging the instant a new character is received.
+ OpenLog regularly shuts down to conserve power. If after 0.5 seconds no characters are received, OpenLog will record any unsaved characters,
+ and after 3 seconds it goes to sleep. OpenLog will automatically wake up and continue logging the instant a new character is received.
  
  1.55mA idle
  15mA actively writing
@@ -57,7 +59,8 @@
 #include <SerialPort.h> //This is a new/beta library written by Bill Greiman. You rock Bill!
 #include <EEPROM.h>
 
-SerialPort<0, 800, 0> NewSerial;
+#define RX_BUFFER_SIZE 800
+SerialPort<0, RX_BUFFER_SIZE, 0> NewSerial;
 //This is a very important buffer declaration. This sets the <port #, rx size, tx size>. We set
 //the TX buffer to zero because we will be spending most of our time needing to buffer the incoming (RX) characters.
 //1100 fails on card init and causes FAT table corruption
@@ -65,16 +68,71 @@ SerialPort<0, 800, 0> NewSerial;
 //900 works on light and is able to create config file
 
 #include <avr/sleep.h> //Needed for sleep_mode
+#include <util/crc16.h> //Needed for the framed log CRCs
 #include <avr/power.h> //Needed for powering down perihperals such as the ADC/TWI and Timers
 
 //Debug turns on (1) or off (0) a bunch of verbose debug statements. Normally use (0)
 //#define DEBUG  1
 #define DEBUG  0
 
+//Report the number of bytes logged (and any RX errors) over TX each time we go idle, so host tools like
+//blackbox_bench --search can measure data loss without pulling the card. Set to (0) to keep TX silent.
+#define LOGGED_REPORT 1
+#define LOGGED_REPORT_PREFIX "Logged:"
+
+//LOG_ROTATE, LOG_INDEX and LOG_VERIFY are off until a build with them on has been checked with avr-size and freeRam()
+//against the 32,256 bytes of flash and 2KB of RAM. utils/Makefile turns them on for the host build and its tests.
+
+//Start a new log file each time the flight controller starts a new Blackbox session (each arm), instead of putting
+//every session since power up in the same file. Set to (1) to turn on.
+#ifndef LOG_ROTATE
+#define LOG_ROTATE 0
+#endif
+
+//Write a LOGnnnnn.IDX alongside each log, recording where each Blackbox session header begins and a seek point every
+//LOG_INDEX_INTERVAL bytes or so, so host tools can start decoding part way through a long log. The index is only
+//written when the log is synced, so entries that don't fit in RAM until then are dropped: the interval is wide enough
+//for LOG_INDEX_BUFFER_ENTRIES to last the 5 seconds between syncs at 1000000 baud. Set to (1) to turn on.
+#ifndef LOG_INDEX
+#define LOG_INDEX 0
+#endif
+#define LOG_INDEX_INTERVAL 65536UL //Minimum bytes of log between seek points
+#define LOG_INDEX_BUFFER_ENTRIES 8 //Entries kept in RAM until the next sync
+
+//Keep a checksum of the log as we write it, and once the flight controller has gone quiet read what we've written since
+//the last check back from the card and compare, so a card that silently loses or mangles data shows up in the logged
+//report. Set to (1) to turn on.
+#ifndef LOG_VERIFY
+#define LOG_VERIFY 0
+#endif
+
+//Once the flight controller has gone quiet, erase the clusters of deleted logs as they're freed, then spend up to
+//ERASE_QUIET_BUDGET_MSEC erasing free space that still holds old data (from before, or freed mid-flight), so a card
+//being reused season after season keeps writing at the speed it did when new. Nothing is erased while data might be
+//arriving. Set to (0) to turn off.
+//The flight controller can start up again mid-erase, so each erase command is capped at the blocks a card taking
+//ERASE_BLOCK_USEC a block gets through while the RX buffer fills at the current baud rate: a few hundred at 115200,
+//a few dozen at 1000000.
+#define ERASE_FREED 1
+#define ERASE_QUIET_BUDGET_MSEC 1000
+#define ERASE_STEP_CLUSTERS 64 //FAT entries looked at between checks of the time budget and the RX buffer
+#define ERASE_BLOCK_USEC 250
+
+//Which of the features the config file can turn on are built in. A feature that's left out takes no flash or RAM, and
+//its setting is kept in the config file but ignored. Set to (0) to leave one out:
+#define LOG_COMPRESSION 1 //Compressed logs, see COMPRESS_MAGIC
+#define LOG_FRAMING 1 //Framed logs, see FRAME_BLOCK_SIZE
+#define LOG_TIMESTAMPS 1 //Timestamp records, see TIMESTAMP_ESCAPE
+#define AUTO_BAUD 1 //Measuring the baud rate, see AUTO_BAUD_MIN
+#define LOG_RECYCLE 1 //Deleting the oldest logs as the card fills, see RECYCLE_RESERVE_SHIFT
+#define COMMAND_MODE 1 //The command mode for downloading logs, see COMMAND_ESCAPE
+
 #define CFG_FILENAME "config.txt" //This is the name of the file that contains the unit settings
 
-#define MAX_CFG "1000000\0" // baud 
-#define CFG_LENGTH (strlen(MAX_CFG) + 1) //Length of text found in config file. strlen ignores \0 so we have to add it back 
+#define MAX_CFG "1000000,1,1,1,1,1" // baud,compress,frame,stamp,auto,recycle
+#define CFG_SETTINGS 6
+#define CFG_FIELD_LENGTH 7 //Longest setting in MAX_CFG, the baud rate
+#define CFG_LENGTH sizeof(MAX_CFG) //Length of text found in config file, with room for the \0
 
 //Internal EEPROM locations for the user settings
 #define LOCATION_FILE_NUMBER_LSB	0x03
@@ -82,11 +140,112 @@ SerialPort<0, 800, 0> NewSerial;
 #define LOCATION_BAUD_SETTING_HIGH	0x09
 #define LOCATION_BAUD_SETTING_MID	0x0A
 #define LOCATION_BAUD_SETTING_LOW	0x0B
+#define LOCATION_COMPRESSION	0x10
+#define LOCATION_FRAMING	0x11
+#define LOCATION_TIMESTAMPS	0x12
+#define LOCATION_AUTO_BAUD	0x13
+#define LOCATION_RECYCLE	0x14
+#define LOCATION_ERASE_CURSOR	0x15 //4 bytes, LSB first: the cluster the free space erase pass carries on from
 
 #define BAUD_MIN  300
 #define BAUD_MAX  1000000
 #define BAUD_DEFAULT 115200
 
+//With auto-baud on, the rate is measured from the first byte of the log, which for Blackbox is always the 'H' of
+//"H Product:Blackbox". 'H' is 0x48, so sent LSB first it is a start bit and three zeros (four bit times low), a one, two
+//zeros, a one, a zero then the stop bit. Timer1 counts CPU cycles, so its 16 bits cover the whole byte down to about
+//2400 baud; AUTO_BAUD_MIN leaves some margin. Faster than 1Mbaud we can't poll RXD quickly enough.
+#define AUTO_BAUD_MIN 4800
+#define AUTO_BAUD_MAX 1000000
+#define AUTO_BAUD_MIN_LOW_CYCLES (4 * F_CPU / AUTO_BAUD_MAX * 7 / 8) //Four bit times, less some polling slop
+#define AUTO_BAUD_MAX_LOW_CYCLES (4 * F_CPU / AUTO_BAUD_MIN)
+#define AUTO_BAUD_CHECK_BYTES 16 //Bytes that must arrive without framing errors before we trust the rate
+#define AUTO_BAUD_CHECK_MSEC 250 //Or if the flight controller goes quiet, how long to wait for them
+#define AUTO_BAUD_SNAP_PERCENT 3 //Record the standard rate if the measured one is this close to it
+
+#if AUTO_BAUD
+//The rates Cleanflight offers for the Blackbox port that the USART can receive
+const uint32_t standardBauds[] PROGMEM = {9600, 19200, 38400, 57600, 115200, 230400, 250000, 500000, 1000000};
+#endif
+
+//Compressed logs start with this magic, then the data with runs of 4 or more of the same byte replaced by
+//COMPRESS_ESCAPE tokens. Tokens never span a 512 byte block, so each block of the file can be decoded on its own
+//(utils/src/log_decompress.c is the decoder):
+//  COMPRESS_ESCAPE, 0            a COMPRESS_ESCAPE byte in the data
+//  COMPRESS_ESCAPE, 1-254, byte  the byte repeats (count + 3) times
+//  COMPRESS_ESCAPE, 255          nothing more in this block (as is a COMPRESS_ESCAPE that ends a block)
+//  anything else                 itself
+#define COMPRESS_MAGIC "BBZ1"
+#define COMPRESS_MAGIC_LENGTH 4
+#define COMPRESS_BLOCK_SIZE 512
+#define COMPRESS_ESCAPE 0x1B
+#define COMPRESS_MIN_REPEAT 4
+#define COMPRESS_MAX_REPEAT (254 + COMPRESS_MIN_REPEAT - 1)
+#define COMPRESS_END_OF_BLOCK 0xFF
+
+//Framed logs are a series of 512 byte blocks, each holding up to FRAME_PAYLOAD_SIZE bytes of data followed by zero
+//padding and this trailer (all little-endian):
+//  'B', 'F'               magic
+//  uint16_t               number of bytes of data in this block
+//  uint32_t               block sequence number, from zero at the start of each file
+//  uint32_t               millis() when the block was finished
+//  uint16_t               CRC-16/CCITT (reflected, as _crc_ccitt_update) of the data then the trailer up to here
+//The trailer goes at the end because we can only append to the log, so the block has to be filled before we know what
+//it says. The block being written when the power goes has no trailer. utils/src/log_unframe.c strips the framing.
+#define FRAME_BLOCK_SIZE 512
+#define FRAME_TRAILER_SIZE 14
+#define FRAME_PAYLOAD_SIZE (FRAME_BLOCK_SIZE - FRAME_TRAILER_SIZE)
+#define FRAME_MAGIC_0 'B'
+#define FRAME_MAGIC_1 'F'
+
+//With timestamps on, a record is added to the data (before it is compressed or framed) each time we've read another
+//TIMESTAMP_INTERVAL bytes, and on the first read after waking from sleep:
+//  TIMESTAMP_ESCAPE, 'T', 'W' or 'R' ('W' after waking, micros() doesn't count the time asleep, 'R' after recovering
+//                    from a failed write, with zero bytes read)
+//  uint32_t    micros() just after the read (little-endian)
+//  byte        number of bytes read
+//  uint16_t    bytes still waiting in the RX buffer (little-endian)
+//TIMESTAMP_ESCAPE bytes in the data are recorded as TIMESTAMP_ESCAPE, 0. utils/src/log_timestamps.c strips the records
+//and profiles them.
+#define TIMESTAMP_ESCAPE 0x10
+#define TIMESTAMP_RECORD_SIZE 9
+#define TIMESTAMP_INTERVAL 512
+
+//With recycling on, the oldest logs are deleted once the flight controller has gone quiet to keep 1/2^RECYCLE_RESERVE_SHIFT
+//of the card free for the next flight. The oldest log is found once at boot, after that we work forwards from it.
+#define RECYCLE_RESERVE_SHIFT 3
+
+//A deleted log's clusters are freed a few at a time (see SdBaseFile::removeDeferred), so deleting a big one doesn't hold
+//up the incoming data. While logging we free up to FREE_CHAIN_BUDGET clusters per read, as long as fewer than
+//FREE_CHAIN_MAX_BACKLOG bytes are waiting in the RX buffer, without erasing them (see ERASE_FREED). While idle we free
+//FREE_CHAIN_IDLE_BUDGET at a time until data arrives.
+#define FREE_CHAIN_BUDGET 64
+#define FREE_CHAIN_MAX_BACKLOG 128
+#define FREE_CHAIN_IDLE_BUDGET 1024
+
+//When a write to the log fails (most likely a flaky contact dropping the card off the bus), the card is initialised
+//again up to RECOVERY_ATTEMPTS times, RECOVERY_RETRY_MSEC apart, and the log reopened where the card says it ends. The
+//block being written when it failed is given up on, since we can't tell whether it made it. Then this marker goes in the
+//log (or with timestamps on, a TIMESTAMP_ESCAPE, 'R' record) so the gap can be found.
+#define RECOVERY_ATTEMPTS 5
+#define RECOVERY_RETRY_MSEC 100
+const char recoveryMarker[] PROGMEM = "\nOpenLog: card write failed, log resumed\n";
+
+//Sending COMMAND_ESCAPE_COUNT COMMAND_ESCAPE characters (ctrl-Z, as the original OpenLog used) within
+//COMMAND_WINDOW_MSEC of the "12" boot message puts the logger in command mode instead of logging, which prompts with '>'
+//where logging would send '<'. With auto-baud on the window opens once the rate has been measured, so the host sends an
+//'H' first. Commands are a line each, and each reply ends with a new '>' prompt:
+//  ls                    a "name size" line for each file
+//  read <name> [start]   "OK <bytes>", then the file's bytes from start on, then the CRC-16 of those bytes (little-endian,
+//                        the same CRC as the framed logs use). Errors are "ERR <reason>" instead
+//  exit                  start logging
+//Files are streamed a run of consecutive clusters at a time with multi-block reads, so the UART sets the pace.
+//utils/src/log_download.c is the client.
+#define COMMAND_ESCAPE 0x1A
+#define COMMAND_ESCAPE_COUNT 3
+#define COMMAND_WINDOW_MSEC 500
+#define COMMAND_LINE_LENGTH 32
+
 //STAT1 is a general LED and indicates serial traffic
 #define STAT1  5 //On PORTD
 #define STAT1_PORT  PORTD
@@ -111,6 +270,80 @@ SdVolume volume;
 SdFile currentDirectory;
 
 long setting_uart_speed; //This is the baud rate that the system runs at. Can be 300 to 1,000,000
+byte setting_compression; //1 to compress logs, 0 to record the data as it arrives
+
+byte setting_framing; //1 to write logs in checksummed blocks (which takes precedence over compression)
+
+byte setting_timestamps; //1 to record when the data was received
+
+byte setting_auto_baud; //1 to measure the baud rate from the incoming data instead of using setting_uart_speed
+#if AUTO_BAUD
+boolean autoBaudUnsaved = false; //A new rate has been detected but not recorded to EEPROM and the config file yet
+#endif
+
+byte setting_recycle; //1 to delete the oldest logs as the card fills, rather than lose the end of the flight
+
+#if LOG_RECYCLE
+int32_t freeClusters; //Counted at power on, then kept up to date as the log grows and old logs are deleted
+int32_t recycleThreshold; //Free clusters to keep in hand
+uint16_t recycleCursor; //Number of the oldest log that might be left to delete
+uint32_t logClustersCharged = 0; //Clusters of the current log that have been taken off freeClusters
+#endif
+
+#if ERASE_FREED
+uint32_t eraseCursor; //The cluster the free space erase pass carries on from, saved to EEPROM once each quiet period
+#endif
+
+#if LOG_COMPRESSION
+byte compressRunByte; //The compressor holds back the run at the end of the data until it knows how long it is
+uint16_t compressRunLength = 0;
+#endif
+
+#if LOG_FRAMING
+uint16_t framePayloadLength = 0; //Data in the current block of a framed log so far
+uint16_t frameCRC = 0xFFFF;
+uint32_t frameSequence = 0;
+#endif
+
+#if LOG_ROTATE || LOG_INDEX
+//Every Blackbox session begins with this header line
+const char sessionIntro[] PROGMEM = "H Product:Blackbox";
+#define SESSION_INTRO_LENGTH (sizeof(sessionIntro) - 1)
+
+byte sessionIntroMatched = 0; //How many bytes at the end of the data received so far match the start of sessionIntro
+byte sessionIntroHeld = 0; //How many of those matching bytes have been held back from the card
+#endif
+
+#if LOG_ROTATE
+SdFile nextLogFile; //Empty log opened ahead of time while idle, so switching to it doesn't hold up the incoming data
+uint16_t nextLogNumber; //The number in nextLogFile's name
+boolean logHasData = false; //Data has been recorded in the current log, not just timestamps
+#endif
+
+#if LOG_VERIFY
+//Fletcher-style sums of the log from logSumStart on, as we wrote it
+uint32_t logSumStart = 0;
+uint16_t logSum1 = 0;
+uint16_t logSum2 = 0;
+
+//The range of the log being read back, the sums it was written with and the sums of what we've read so far
+uint32_t verifyPos = 0;
+uint32_t verifyEnd = 0;
+uint16_t verifyExpected1, verifyExpected2;
+uint16_t verifySum1, verifySum2;
+#endif
+uint16_t verifyFailures = 0; //Ranges of the log that didn't read back as written since the last logged report
+
+#if LOG_INDEX
+//Each index entry is a little-endian (file offset, millis()) pair, 64 entries to a 512 byte block. Entries for session
+//headers point at the 'H' that starts one. Seek points are just the first 'I' (0x49) byte past the interval: we don't
+//decode frames, and in binary frame data that byte is usually not the start of an I frame, so a reader has to search
+//forward from a seek point for a frame that decodes.
+SdFile indexFile;
+uint32_t indexEntries[LOG_INDEX_BUFFER_ENTRIES][2];
+byte indexEntryCount = 0;
+uint32_t indexNextFrameOffset = 0; //Don't add another seek point before this offset in the log
+#endif
 
 //Passes back the available amount of free RAM
 int freeRam() {
@@ -199,10 +432,48 @@ void setup(void) {
     printRam(); //Print the available RAM
     
     read_config_file();
+
+#if LOG_RECYCLE
+    if (setting_recycle) {
+        //This reads the whole FAT, but only once: from here on we keep count ourselves
+        freeClusters = volume.freeClusterCount();
+        recycleThreshold = volume.clusterCount() >> RECYCLE_RESERVE_SHIFT;
+
+        if (freeClusters < 0)
+            setting_recycle = 0; //Don't go deleting logs on the strength of a FAT we can't read
+        else
+            find_oldest_log();
+    }
+#endif
+
+#if ERASE_FREED
+    volume.setEraseFreed(true); //Just reads the card's erase group size, the erasing waits until we're quiet
+
+    eraseCursor = 0;
+    for (byte i = 0; i < 4; i++)
+        eraseCursor |= (uint32_t) EEPROM.read(LOCATION_ERASE_CURSOR + i) << (i * 8);
+#endif
 }
 
 void loop(void) {
-    append_file(newlog());
+    byte replay[1];
+    byte replayLength = 0;
+
+#if AUTO_BAUD
+    //The 'H' the rate is measured from would be taken for the end of the command window, so measure it first. A host
+    //that wants command mode with auto-baud on sends an 'H' ahead of the escape.
+    if (setting_auto_baud)
+        replayLength = detect_baud(replay);
+#endif
+
+#if COMMAND_MODE
+    if (command_mode_requested()) {
+        command_shell();
+        replayLength = 0; //That 'H' was the host's, not the start of a log
+    }
+#endif
+
+    append_file(newlog(), replay, replayLength);
     
     while(1); //We should never get this far
 }
@@ -284,13 +555,13 @@ char* newlog(void) {
 //Modifying this loop may negatively affect how well the device can record at high baud rates.
 //Appends a stream of serial data to a given file
 //Assumes the currentDirectory variable has been set before entering the routine
-void append_file(char* file_name) {
+void append_file(char* file_name, const byte *replay, byte replayLength) {
     SdFile workingFile;
 
     // O_CREAT - create the file if it does not exist
     // O_APPEND - seek to the end of the file prior to each write
-    // O_WRITE - open for write
-    if (!workingFile.open(&currentDirectory, file_name, O_CREAT | O_APPEND | O_WRITE))
+    // O_RDWR - open for read and write, verify_log() reads the log back through this handle
+    if (!workingFile.open(&currentDirectory, file_name, O_CREAT | O_APPEND | O_RDWR))
         systemError(ERROR_FILE_OPEN);
 
     if (workingFile.fileSize() == 0) {
@@ -299,24 +570,56 @@ void append_file(char* file_name) {
         workingFile.sync();
     }
 
+#if LOG_VERIFY
+    restart_verify(&workingFile);
+#endif
+
     NewSerial.print(F("<")); //give a different prompt to indicate no echoing
     digitalWrite(statled1, HIGH); //Turn on indicator LED
 
     const byte LOCAL_BUFF_SIZE = 128; //This is the 2nd buffer. It pulls from the larger NewSerial buffer as quickly as possible.
     byte localBuffer[LOCAL_BUFF_SIZE];
 
-    const uint16_t MAX_IDLE_TIME_MSEC = 500; //The number of milliseconds before unit goes to sleep
+    const uint16_t MAX_IDLE_TIME_MSEC = 500; //The number of milliseconds without data before we sync the card
+    const uint16_t QUIET_TIME_MSEC = 3000; //The number of milliseconds without data before unit goes to sleep
     const uint16_t MAX_TIME_BEFORE_SYNC_MSEC = 5000;
     uint32_t lastSyncTime = millis(); //Keeps track of the last time the file was synced
+    uint32_t lastReceiveTime = millis(); //And the last time anything arrived
+    uint32_t bytesLogged = 0; //Bytes recorded to the card since the last logged report
+#if LOG_TIMESTAMPS
+    uint16_t bytesSinceTimestamp = TIMESTAMP_INTERVAL; //Start with a timestamp
+    boolean woken = false;
+#endif
 
     printRam(); //Print the available RAM
 
+    byte n = replayLength; //The bytes the rate was measured from go in the log first
+    memcpy(localBuffer, replay, n);
+
     //Start recording incoming characters
     while (1) { //Infinite loop
 
-        byte n = NewSerial.read(localBuffer, sizeof(localBuffer)); //Read characters from global buffer into the local buffer
+        n += NewSerial.read(localBuffer + n, sizeof(localBuffer) - n); //Read characters from global buffer into the local buffer
         if (n > 0) {
-            workingFile.write(localBuffer, n); //Record the buffer to the card
+            lastReceiveTime = millis();
+
+#if LOG_TIMESTAMPS
+            if (setting_timestamps) {
+                bytesSinceTimestamp += n;
+
+                if (bytesSinceTimestamp >= TIMESTAMP_INTERVAL || woken) {
+                    write_timestamp(&workingFile, woken ? 'W' : 'T', n);
+                    bytesSinceTimestamp = 0;
+                    woken = false;
+                }
+            }
+#endif
+
+#if LOG_ROTATE || LOG_INDEX
+            bytesLogged += log_session_data(&workingFile, localBuffer, n); //Record the buffer to the card
+#else
+            bytesLogged += write_log(&workingFile, localBuffer, n); //Record the buffer to the card
+#endif
 
             STAT1_PORT ^= (1 << STAT1); //Toggle the STAT1 LED each time we record the buffer
 
@@ -324,28 +627,1141 @@ void append_file(char* file_name) {
             if ((millis() - lastSyncTime) > MAX_TIME_BEFORE_SYNC_MSEC) {
                 //This is here to make sure a log is recorded in the instance
                 //where the user is throwing non-stop data at the unit from power on to forever
-                workingFile.sync(); //Sync the card
+#if LOG_INDEX
+                flush_index(&workingFile);
+#endif
+                sync_log(&workingFile, false); //Sync the card
                 lastSyncTime = millis();
             }
+
+            //Free some more of the last file deleted if the RX buffer can stand the wait
+            if (volume.freeChainPending() && NewSerial.available() < FREE_CHAIN_MAX_BACKLOG)
+                free_deleted_clusters(FREE_CHAIN_BUDGET, false); //No time to wait for erases mid-flight
         }
         //No characters recevied?
-        else if ((millis() - lastSyncTime) > MAX_IDLE_TIME_MSEC) { //If we haven't received any characters for a while, go to sleep
-            workingFile.sync(); //Sync the card before we go to sleep
+        else if ((millis() - lastSyncTime) > MAX_IDLE_TIME_MSEC) { //If we haven't received any characters for a while, sync the card
+            //Mid-flight the RX buffer runs dry for a moment all the time, so this has to stay cheap until nothing has
+            //arrived for QUIET_TIME_MSEC (the flight controller has disarmed). Only then do we pad out the frame, get the
+            //next log ready and go to sleep
+            boolean quiet = (millis() - lastReceiveTime) > QUIET_TIME_MSEC;
+
+#if LOG_INDEX
+            flush_index(&workingFile);
+#endif
+            sync_log(&workingFile, quiet); //Sync the card
+
+#if SD_TRACE_SIZE
+            if (quiet)
+                dump_sd_trace(); //Save the last card commands of the flight, before we add our own
+#endif
 
-            STAT1_PORT &= ~(1 << STAT1); //Turn off stat LED to save power
+#if LOG_VERIFY
+            if (quiet)
+                verify_log(&workingFile, localBuffer, sizeof(localBuffer)); //Check what we've synced reached the card
+#endif
 
-            power_timer0_disable(); //Shut down peripherals we don't need
-            power_spi_disable();
-            sleep_mode(); //Stop everything and go to sleep. Wake up if serial character received
+#if LOGGED_REPORT
+            if (bytesLogged > 0 || NewSerial.getRxError() || verifyFailures > 0) {
+                report_logged(bytesLogged);
+                bytesLogged = 0;
+            }
+#endif
 
-            power_spi_enable(); //After wake up, power up peripherals
-            power_timer0_enable();
+            if (quiet) {
+#if ERASE_FREED
+                volume.setEraseMaxBlocks(RX_BUFFER_SIZE * 10UL * (1000000UL / ERASE_BLOCK_USEC) / setting_uart_speed);
+#endif
+
+#if LOG_RECYCLE
+                //Finish freeing the last file deleted, then make room for the next flight a log at a time, for as long
+                //as nothing arrives
+                while (!NewSerial.available()) {
+                    if (volume.freeChainPending())
+                        free_deleted_clusters(FREE_CHAIN_IDLE_BUDGET, true);
+                    else if (!setting_recycle || freeClusters >= recycleThreshold || !recycle_oldest_log(&workingFile))
+                        break;
+                }
+#else
+                //Finish freeing the last file deleted (an old config file) for as long as nothing arrives
+                while (volume.freeChainPending() && !NewSerial.available())
+                    free_deleted_clusters(FREE_CHAIN_IDLE_BUDGET, true);
+#endif
+                workingFile.sync(); //Write the FAT blocks we just freed clusters in back to the card
+
+#if ERASE_FREED
+                erase_free_space(ERASE_QUIET_BUDGET_MSEC);
+#endif
+
+#if LOG_ROTATE
+                //Get the file for the next session ready while there's nothing else to do
+                if (!nextLogFile.isOpen())
+                    open_next_log(&workingFile);
+#endif
+
+#if AUTO_BAUD
+                if (autoBaudUnsaved)
+                    save_detected_baud();
+#endif
+
+#if ERASE_FREED
+                save_erase_cursor(); //Once for the whole quiet period, not after every erase
+#endif
+
+                STAT1_PORT &= ~(1 << STAT1); //Turn off stat LED to save power
+
+                power_timer0_disable(); //Shut down peripherals we don't need
+                power_spi_disable();
+                sleep_mode(); //Stop everything and go to sleep. Wake up if serial character received
+
+                power_spi_enable(); //After wake up, power up peripherals
+                power_timer0_enable();
+
+#if LOG_TIMESTAMPS
+                woken = true;
+#endif
+            }
 
             lastSyncTime = millis(); //Reset the last sync time to now
         }
+
+        //A failed write leaves the file unusable, everything after it would be lost without a word
+        if (workingFile.getWriteError() && recover_log(&workingFile)) {
+#if LOG_TIMESTAMPS
+            if (setting_timestamps) {
+                write_timestamp(&workingFile, 'R', 0);
+                bytesSinceTimestamp = 0;
+            } else
+#endif
+            {
+                byte marker[sizeof(recoveryMarker) - 1];
+
+                memcpy_P(marker, recoveryMarker, sizeof(marker));
+                write_log(&workingFile, marker, sizeof(marker));
+            }
+        }
+
+        n = 0;
+    }
+}
+
+//Initialises the card again after a write to the log failed and reopens the log. The data the card has is kept: up to
+//where the log was last synced, and as far past that as the blocks we'd written before the failure and the clusters
+//linked to the log on the card go. The incoming data waits in the RX buffer meanwhile. Returns false if the card
+//still can't be written to, in which case we'll try again after the next failed write.
+//A log deleted with removeDeferred() carries on being freed where it had got to. Clusters it freed in a FAT block that
+//hadn't been written back when the card failed stay allocated on the card as a lost chain (and on our books as free).
+boolean recover_log(SdFile *file) {
+    char name[13] = "";
+    uint32_t failedAt = file->curPosition();
+    uint32_t freeCursor = volume.freeChainCursor(); //volume.init() forgets the chain
+    //The 512 byte block in the cache when the write failed and the one being written out to make room for it might
+    //both be lost
+    uint32_t keep = failedAt < 2 * 512 ? 0 : (failedAt & ~511UL) - 512;
+
+    for (byte attempt = 0; attempt < RECOVERY_ATTEMPTS; attempt++) {
+        if (attempt > 0)
+            delay(RECOVERY_RETRY_MSEC);
+
+        if (!card.init(SPI_FULL_SPEED) || !volume.init(&card))
+            continue;
+        volume.freeChainResume(freeCursor);
+
+        //The handle's directory entry is still good, so we can read the log's name from the card again
+        if (!name[0] && !file->getFilename(name))
+            continue;
+
+        *file = SdFile(); //Don't let close() write the state we lost to the card
+        if (!file->open(&currentDirectory, name, O_APPEND | O_RDWR) || !file->extend(keep))
+            continue;
+
+#if LOG_INDEX
+        indexFile = SdFile(); //flush_index() reopens it where the card says it ends
+#endif
+#if LOG_VERIFY
+        restart_verify(file); //What we hadn't checked yet is gone
+#endif
+        //Whatever the encoders were holding went with the lost blocks. The frame sequence number carries on, so
+        //log_unframe shows the gap
+#if LOG_COMPRESSION
+        compressRunLength = 0;
+#endif
+#if LOG_FRAMING
+        framePayloadLength = 0;
+        frameCRC = 0xFFFF;
+#endif
+
+        return true;
+    }
+
+    return false;
+}
+
+#if AUTO_BAUD
+//Waits for the first byte of the log and sets the USART to the baud rate it was sent at, timing its bits on RXD with
+//Timer1. Only the 'H' that starts a Blackbox log (see AUTO_BAUD_MIN) is accepted, anything else is ignored until one
+//arrives. Returns the number of bytes put in the buffer: the USART never saw them, so they go in the log first.
+byte detect_baud(byte *buffer) {
+    byte receiverOn = UCSR0B | _BV(RXEN0);
+    byte receiverOff = UCSR0B & ~_BV(RXEN0);
+    uint16_t start, lowCycles, byteCycles;
+
+    power_timer1_enable();
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10); //Count CPU cycles
+
+    while (1) {
+        UCSR0B = receiverOff; //RXD is ours until we know the rate
+        UCSR0A = _BV(U2X0);
+        NewSerial.flushRx();
+        NewSerial.clearRxError();
+
+        //An interrupt would throw the timing off, so from the start bit to the stop bit we do nothing but watch RXD.
+        //Every edge is polled for, timed or not, so the receiver can be turned on the moment the stop bit begins.
+        //Interrupts stay on while we wait for the start bit (which might be a long time coming), one that lands on
+        //the start bit itself spoils the timing and the checks below throw it out
+        while (!(PIND & _BV(PIND0))); //Let any byte in progress finish
+        while (1) { //Start bit
+            cli();
+            if (!(PIND & _BV(PIND0)))
+                break;
+            sei();
+        }
+        start = TCNT1;
+        while (!(PIND & _BV(PIND0))); //Bits 0-2
+        lowCycles = TCNT1 - start;
+        while (PIND & _BV(PIND0)); //Bit 3
+        UBRR0 = (lowCycles - 16) >> 5; //Rounded as SerialPort::begin() does with U2X: (F_CPU / 4 / baud - 1) / 2
+        while (!(PIND & _BV(PIND0))); //Bits 4-5
+        while (PIND & _BV(PIND0)); //Bit 6
+        while (!(PIND & _BV(PIND0))); //Bit 7
+        UCSR0B = receiverOn; //Stop bit, the USART takes it from here
+        byteCycles = TCNT1 - start;
+        sei();
+
+        //The stop bit should have started nine bit times in, give or take the polling slop (which is most of a bit at
+        //1Mbaud). 'h', 'X' and '(' have the same edges, but they give the same rate too, so all we'd get wrong is the
+        //one byte we replay
+        if (lowCycles < AUTO_BAUD_MIN_LOW_CYCLES || lowCycles > AUTO_BAUD_MAX_LOW_CYCLES
+                || labs((long) byteCycles * 4 - (long) lowCycles * 9) > lowCycles * 3 / 4)
+            continue;
+
+        //Mid-stream, the edges of some other bytes can pass for an 'H' at the wrong rate, which the USART will soon
+        //find out
+        uint32_t checkStart = millis();
+        while (NewSerial.available() < AUTO_BAUD_CHECK_BYTES && millis() - checkStart < AUTO_BAUD_CHECK_MSEC);
+
+        if (!(NewSerial.getRxError() & SP_FRAMING_ERROR))
+            break;
+    }
+
+    TCCR1B = 0;
+    power_timer1_disable();
+
+    //Record the standard rate rather than our measurement of it, when there's one close enough
+    long baud = 9UL * F_CPU / byteCycles;
+    for (byte i = 0; i < sizeof(standardBauds) / sizeof(standardBauds[0]); i++) {
+        long standard = pgm_read_dword(&standardBauds[i]);
+
+        if (labs(baud - standard) * 100 <= standard * AUTO_BAUD_SNAP_PERCENT) {
+            baud = standard;
+            break;
+        }
+    }
+
+    if (baud != setting_uart_speed) {
+        setting_uart_speed = baud;
+        autoBaudUnsaved = true; //Writing it now would hold up the log, wait until the flight is over
+    }
+
+    buffer[0] = 'H';
+    return 1;
+}
+
+//Records the rate detect_baud() found to EEPROM and the config file, so it's used from power on next time
+void save_detected_baud(void) {
+    writeBaud(setting_uart_speed);
+    record_config_file();
+    autoBaudUnsaved = false;
+}
+#endif
+
+//Writes data to the log, escaping it if timestamps are on. Returns the number of bytes of data that made it to the card.
+uint16_t write_log(SdFile *file, const byte *buffer, byte n) {
+    if (n == 0)
+        return 0;
+
+#if LOG_ROTATE
+    logHasData = true;
+#endif
+
+#if LOG_TIMESTAMPS
+    if (!setting_timestamps)
+#endif
+        return write_encoded(file, buffer, n);
+
+#if LOG_TIMESTAMPS
+    const byte escape[2] = {TIMESTAMP_ESCAPE, 0};
+    byte start = 0;
+
+    for (byte i = 0; i < n; i++) {
+        if (buffer[i] == TIMESTAMP_ESCAPE) {
+            if (write_encoded(file, buffer + start, i - start) != i - start
+                    || write_encoded(file, escape, sizeof(escape)) != sizeof(escape))
+                return 0;
+
+            start = i + 1;
+        }
+    }
+
+    if (write_encoded(file, buffer + start, n - start) != n - start)
+        return 0;
+
+    return n;
+#endif
+}
+
+#if LOG_TIMESTAMPS
+//Records the time we read a buffer of data and how far behind we are
+void write_timestamp(SdFile *file, byte type, byte n) {
+    uint32_t now = micros();
+    uint16_t backlog = NewSerial.available();
+    byte record[TIMESTAMP_RECORD_SIZE];
+
+    record[0] = TIMESTAMP_ESCAPE;
+    record[1] = type;
+    for (byte i = 0; i < 4; i++)
+        record[2 + i] = now >> (i * 8);
+    record[6] = n;
+    record[7] = backlog;
+    record[8] = backlog >> 8;
+
+    write_encoded(file, record, sizeof(record));
+}
+#endif
+
+//Writes to the card in the log's format: framed, compressed or just as it is
+uint16_t write_encoded(SdFile *file, const byte *buffer, byte n) {
+    if (n == 0)
+        return 0;
+
+#if LOG_FRAMING
+    if (setting_framing)
+        return write_framed(file, buffer, n) ? n : 0;
+#endif
+
+#if LOG_COMPRESSION
+    if (setting_compression)
+        return write_compressed(file, buffer, n) ? n : 0;
+#endif
+
+    return write_card(file, buffer, n) ? n : 0;
+}
+
+//Writes to the log itself, adding the data to the checksum verify_log() compares the card with
+boolean write_card(SdFile *file, const byte *buffer, uint16_t n) {
+#if LOG_VERIFY
+    for (uint16_t i = 0; i < n; i++) {
+        logSum1 += buffer[i];
+        logSum2 += logSum1;
+    }
+#endif
+
+    return file->write(buffer, n) == n;
+}
+
+#if LOG_COMPRESSION
+//Run-length encodes data onto the end of a compressed log. Literals are written straight from the buffer we're given,
+//so the only state we need is the run that the data ends with, which might carry on in the next buffer.
+boolean write_compressed(SdFile *file, const byte *buffer, byte n) {
+    byte i = 0;
+
+    if (file->fileSize() == 0) {
+        byte magic[COMPRESS_MAGIC_LENGTH];
+
+        memcpy_P(magic, PSTR(COMPRESS_MAGIC), COMPRESS_MAGIC_LENGTH);
+        if (!write_card(file, magic, COMPRESS_MAGIC_LENGTH))
+            return false;
+    }
+
+    //Carry on with the run from last time
+    while (compressRunLength > 0 && i < n && buffer[i] == compressRunByte && compressRunLength < COMPRESS_MAX_REPEAT) {
+        compressRunLength++;
+        i++;
+    }
+
+    if (i == n && compressRunLength < COMPRESS_MAX_REPEAT)
+        return true;
+
+    if (!flush_compressed(file))
+        return false;
+
+    byte literalStart = i;
+
+    while (i < n) {
+        byte run = 1;
+
+        while (i + run < n && buffer[i + run] == buffer[i] && run < COMPRESS_MAX_REPEAT)
+            run++;
+
+        if (i + run == n) {
+            //This run might continue in the next buffer
+            if (!write_compressed_literals(file, buffer + literalStart, i - literalStart))
+                return false;
+
+            compressRunByte = buffer[i];
+            compressRunLength = run;
+
+            return true;
+        }
+
+        if (run >= COMPRESS_MIN_REPEAT) {
+            if (!write_compressed_literals(file, buffer + literalStart, i - literalStart)
+                    || !write_compressed_run(file, buffer[i], run))
+                return false;
+
+            literalStart = i + run;
+        }
+
+        i += run;
+    }
+
+    return true;
+}
+
+//Writes out the run the compressor is holding back. Must be called before syncing or closing a compressed log.
+boolean flush_compressed(SdFile *file) {
+    uint16_t length = compressRunLength;
+
+    compressRunLength = 0;
+
+    if (length >= COMPRESS_MIN_REPEAT)
+        return write_compressed_run(file, compressRunByte, length);
+
+    //Too short to be worth a token
+    byte literals[COMPRESS_MIN_REPEAT - 1];
+
+    memset(literals, compressRunByte, length);
+
+    return write_compressed_literals(file, literals, length);
+}
+
+boolean write_compressed_run(SdFile *file, byte value, uint16_t length) {
+    byte token[3] = {COMPRESS_ESCAPE, (byte) (length - COMPRESS_MIN_REPEAT + 1), value};
+
+    return write_compressed_token(file, token, sizeof(token));
+}
+
+//Writes literal data, escaping any bytes that look like the start of a token
+boolean write_compressed_literals(SdFile *file, const byte *buffer, byte n) {
+    byte start = 0;
+
+    for (byte i = 0; i < n; i++) {
+        if (buffer[i] == COMPRESS_ESCAPE) {
+            byte token[2] = {COMPRESS_ESCAPE, 0};
+
+            if (!write_card(file, buffer + start, i - start) || !write_compressed_token(file, token, sizeof(token)))
+                return false;
+
+            start = i + 1;
+        }
+    }
+
+    return write_card(file, buffer + start, n - start);
+}
+
+//Writes a token, moving on to the next block first if it won't fit in this one
+boolean write_compressed_token(SdFile *file, const byte *token, byte length) {
+    uint16_t room = COMPRESS_BLOCK_SIZE - file->fileSize() % COMPRESS_BLOCK_SIZE;
+
+    if (room < length) {
+        byte end[2] = {COMPRESS_ESCAPE, COMPRESS_END_OF_BLOCK};
+
+        if (!write_card(file, end, room))
+            return false;
     }
+
+    return write_card(file, token, length);
+}
+#endif
+
+#if LOG_FRAMING
+//Writes data into the blocks of a framed log, finishing each block as it fills
+boolean write_framed(SdFile *file, const byte *buffer, byte n) {
+    while (n > 0) {
+        uint16_t room = FRAME_PAYLOAD_SIZE - framePayloadLength;
+        byte count = n < room ? n : room;
+
+        if (!write_card(file, buffer, count))
+            return false;
+
+        for (byte i = 0; i < count; i++)
+            frameCRC = _crc_ccitt_update(frameCRC, buffer[i]);
+
+        framePayloadLength += count;
+        buffer += count;
+        n -= count;
+
+        if (framePayloadLength == FRAME_PAYLOAD_SIZE && !end_frame(file))
+            return false;
+    }
+
+    return true;
+}
+
+//Pads out the current block of a framed log and writes its trailer
+boolean end_frame(SdFile *file) {
+    byte trailer[FRAME_TRAILER_SIZE];
+    uint32_t now = millis();
+
+    if (framePayloadLength == 0)
+        return true; //Nothing to finish
+
+    memset(trailer, 0, sizeof(trailer));
+    for (uint16_t padding = FRAME_PAYLOAD_SIZE - framePayloadLength; padding > 0; ) {
+        byte count = padding < sizeof(trailer) ? padding : sizeof(trailer);
+
+        if (!write_card(file, trailer, count))
+            return false;
+        padding -= count;
+    }
+
+    trailer[0] = FRAME_MAGIC_0;
+    trailer[1] = FRAME_MAGIC_1;
+    trailer[2] = framePayloadLength;
+    trailer[3] = framePayloadLength >> 8;
+    for (byte i = 0; i < 4; i++) {
+        trailer[4 + i] = frameSequence >> (i * 8);
+        trailer[8 + i] = now >> (i * 8);
+    }
+    for (byte i = 0; i < FRAME_TRAILER_SIZE - 2; i++)
+        frameCRC = _crc_ccitt_update(frameCRC, trailer[i]);
+    trailer[12] = frameCRC;
+    trailer[13] = frameCRC >> 8;
+
+    frameSequence++;
+    framePayloadLength = 0;
+    frameCRC = 0xFFFF;
+
+    return write_card(file, trailer, sizeof(trailer));
+}
+#endif
+
+//Writes out anything the compressor is holding back, then syncs the log to the card. Ending the frame pads out the
+//current block of a framed log, so we only do that once the flight controller has gone quiet, or when closing the log.
+void sync_log(SdFile *file, boolean endFrame) {
+#if LOG_COMPRESSION
+    if (setting_compression)
+        flush_compressed(file);
+#endif
+#if LOG_FRAMING
+    if (setting_framing && endFrame)
+        end_frame(file);
+#else
+    (void) endFrame;
+#endif
+
+    file->sync();
+
+#if LOG_RECYCLE
+    if (setting_recycle)
+        charge_log_clusters(file);
+#endif
+}
+
+#if SD_TRACE_SIZE
+//Writes the SdFat trace of the last card commands and cache traffic to TRACE.BIN, replacing the last one, and starts
+//the trace again. Only called once the flight controller has gone quiet, so the file isn't rewritten mid-flight and the
+//trace ends with the flight's last writes. Build with SD_TRACE_SIZE set in SdFatConfig.h to get it (each entry costs 13
+//bytes of RAM, so only a few dozen fit alongside the RX buffer), fetch it with "read TRACE.BIN" and decode it with
+//utils/sd_trace.
+void dump_sd_trace(void) {
+    SdFile traceFile;
+
+    if (traceFile.open(&currentDirectory, "TRACE.BIN", O_CREAT | O_WRITE | O_TRUNC)) {
+        sdTraceDump(&traceFile);
+        traceFile.close();
+    }
+    sdTraceClear();
+}
+#endif
+
+#if LOG_VERIFY
+//Starts the checksum again from the end of the log, dropping any check still under way
+void restart_verify(SdFile *file) {
+    logSumStart = file->fileSize();
+    logSum1 = 0;
+    logSum2 = 0;
+    verifyPos = verifyEnd = 0;
 }
 
+//Reads back what has been written to the log since the last check and compares it with the checksum we kept as we
+//wrote it. The log must be synced first, and opened for reading too: the read goes through the log's own handle, which
+//is left at the end of the log again with the card's multi-block read stopped. Stops as soon as anything arrives in the RX buffer, and carries on from there the
+//next time we're quiet. A range that doesn't match, or can't be read, is counted in verifyFailures.
+void verify_log(SdFile *file, byte *buffer, byte size) {
+    if (verifyPos == verifyEnd) {
+        if (file->fileSize() == logSumStart)
+            return; //Nothing new
+
+        //Check everything up to here, and start summing afresh for the next check
+        verifyPos = logSumStart;
+        verifyEnd = file->fileSize();
+        verifyExpected1 = logSum1;
+        verifyExpected2 = logSum2;
+        verifySum1 = 0;
+        verifySum2 = 0;
+        logSumStart = verifyEnd;
+        logSum1 = 0;
+        logSum2 = 0;
+    }
+
+    if (NewSerial.available())
+        return;
+
+    //The end of the log is still in the cache, drop it so we read what the card really has
+    if (!volume.cacheClear())
+        return;
+
+    if (!file->seekSet(verifyPos))
+        return;
+
+    while (verifyPos < verifyEnd && !NewSerial.available()) {
+        byte count = verifyEnd - verifyPos < size ? verifyEnd - verifyPos : size;
+
+        if (file->read(buffer, count) != count) {
+            verifyFailures++;
+            verifyPos = verifyEnd;
+            break;
+        }
+
+        for (byte i = 0; i < count; i++) {
+            verifySum1 += buffer[i];
+            verifySum2 += verifySum1;
+        }
+        verifyPos += count;
+
+        if (verifyPos == verifyEnd && (verifySum1 != verifyExpected1 || verifySum2 != verifyExpected2))
+            verifyFailures++;
+    }
+
+    file->seekEnd(); //Carry on appending where we left off
+    volume.cacheStreamStop(); //seekEnd() leaves the read-ahead going if the read finished at the end of the log
+}
+#endif
+
+#if LOG_ROTATE || LOG_INDEX
+//Records a buffer of received data to the log, switching to a new log file where a Blackbox session header begins.
+//The start of a header might arrive at the end of one buffer and the rest in the next, so any partial match at the end
+//of the buffer is held back until we know which file it belongs in. The held bytes are just the start of sessionIntro,
+//so we don't need RAM to keep them.
+//Returns the number of bytes that reached the card.
+uint16_t log_session_data(SdFile *file, byte *buffer, byte n) {
+    uint16_t written = 0;
+    byte start = 0; //The first byte of the buffer that hasn't been recorded yet
+
+    for (byte i = 0; i < n; i++) {
+        if (buffer[i] == pgm_read_byte(&sessionIntro[sessionIntroMatched])) {
+            if (++sessionIntroMatched == SESSION_INTRO_LENGTH) {
+                byte introStart = i + 1 - (SESSION_INTRO_LENGTH - sessionIntroHeld); //Where the header starts in this buffer
+
+                written += write_log(file, buffer + start, introStart - start); //The end of the previous session
+#if LOG_ROTATE
+                start_new_log(file);
+#endif
+#if LOG_INDEX
+                add_index_entry(file->fileSize());
+#endif
+                written += write_held_intro(file);
+
+                start = introStart;
+                sessionIntroMatched = 0;
+            }
+        } else if (sessionIntroMatched > 0) {
+            //Not a header after all, so the bytes we held back belong in this file
+            written += write_held_intro(file);
+
+            //sessionIntro only has one 'H', so this can only be the start of a new match
+            sessionIntroMatched = buffer[i] == pgm_read_byte(&sessionIntro[0]) ? 1 : 0;
+        }
+
+#if LOG_INDEX
+        //Nothing is held back here, since sessionIntro doesn't contain an 'I'. The last place in the buffer is kept for
+        //a session header
+        if (buffer[i] == 'I' && indexEntryCount < LOG_INDEX_BUFFER_ENTRIES - 1
+                && file->fileSize() + (i - start) >= indexNextFrameOffset) {
+            if (setting_compression || setting_framing || setting_timestamps) {
+                //We can only tell where the byte lands in an encoded log by writing what comes before it
+                written += write_log(file, buffer + start, i - start);
+#if LOG_COMPRESSION
+                flush_compressed(file);
+#endif
+                start = i;
+            }
+
+            uint32_t offset = file->fileSize() + (i - start);
+
+            add_index_entry(offset);
+            indexNextFrameOffset = offset + LOG_INDEX_INTERVAL;
+        }
+#endif
+    }
+
+    //Hold back a partial match at the end of the buffer
+    byte pending = sessionIntroMatched - sessionIntroHeld;
+
+    written += write_log(file, buffer + start, n - pending - start);
+    sessionIntroHeld = sessionIntroMatched;
+
+    return written;
+}
+
+//Records the start of sessionIntro that was held back from the card
+uint16_t write_held_intro(SdFile *file) {
+    byte intro[SESSION_INTRO_LENGTH];
+    byte held = sessionIntroHeld;
+
+    sessionIntroHeld = 0;
+    memcpy_P(intro, sessionIntro, held);
+
+    return write_log(file, intro, held);
+}
+#endif
+
+#if LOG_ROTATE
+
+//Closes the current log and carries on in the file opened for the next session
+void start_new_log(SdFile *file) {
+    //A header before any data is the session this file was opened for. The timestamp the data starts with might be
+    //ahead of it, and that belongs with the session too.
+    if (!logHasData)
+        return;
+
+#if LOG_INDEX
+    flush_index(file);
+    indexFile.close();
+    indexNextFrameOffset = 0;
+#endif
+
+    sync_log(file, true);
+
+    //If we haven't been idle since the last session started we have to open the next file now. The RX buffer
+    //soaks up the incoming data while we search the directory.
+    if (!nextLogFile.isOpen())
+        open_next_log(file);
+
+    file->close();
+
+#if LOG_FRAMING
+    frameSequence = 0;
+#endif
+
+    *file = nextLogFile;
+    nextLogFile = SdFile(); //The log is in file's hands now
+
+    //Only now is the file taken, so move the file number in EEPROM past it. Just the LSB changes, usually, and the
+    //EEPROM finishes a single write in the background, so this doesn't hold up the incoming data.
+    uint16_t file_number = nextLogNumber + 1;
+    if (EEPROM.read(LOCATION_FILE_NUMBER_LSB) != (byte)(file_number & 0x00FF))
+        EEPROM.write(LOCATION_FILE_NUMBER_LSB, (byte)(file_number & 0x00FF));
+    if (EEPROM.read(LOCATION_FILE_NUMBER_MSB) != (byte)((file_number & 0xFF00) >> 8))
+        EEPROM.write(LOCATION_FILE_NUMBER_MSB, (byte)((file_number & 0xFF00) >> 8));
+#if LOG_RECYCLE
+    logClustersCharged = 0;
+#endif
+    logHasData = false;
+#if LOG_VERIFY
+    restart_verify(file); //The end of the last log goes unchecked, we can't stop to read it back now
+#endif
+}
+
+//Opens an empty log file ready for the next session, searching from the file number in EEPROM as newlog() does but
+//passing over the current log, which may still be empty itself (newlog() gave it to us because it was). EEPROM isn't
+//touched until start_new_log() switches to the file, so if power is removed before another session starts, newlog()
+//reuses the empty file on the next boot.
+void open_next_log(SdFile *current) {
+    char current_name[13];
+    char name[13];
+
+    if (!current->getFilename(current_name))
+        current_name[0] = '\0';
+
+    nextLogNumber = EEPROM.read(LOCATION_FILE_NUMBER_MSB);
+    nextLogNumber = (nextLogNumber << 8) | EEPROM.read(LOCATION_FILE_NUMBER_LSB);
+
+    while (1) {
+        sprintf_P(name, PSTR("LOG%05u.TXT"), nextLogNumber);
+
+        if (strcmp(name, current_name) != 0) {
+            if (nextLogFile.open(&currentDirectory, name, O_CREAT | O_EXCL | O_APPEND | O_RDWR))
+                break;
+
+            //An empty file left by a session that never started is as good as a new one
+            if (nextLogFile.open(&currentDirectory, name, O_APPEND | O_RDWR)) {
+                if (nextLogFile.fileSize() == 0)
+                    break;
+                nextLogFile.close();
+            }
+        }
+
+        nextLogNumber++; //Wrapping to zero if we overflow, as newlog() does
+    }
+
+    //Allocate the first cluster now, as append_file() does
+    nextLogFile.rewind();
+    nextLogFile.sync();
+}
+#endif
+
+#if LOG_INDEX
+//Records the offset of a session header or seek point for the log's index. Writing the index would take the log's block
+//out of the cache, so it waits for the next sync: if the buffer is full by then the entry is dropped.
+void add_index_entry(uint32_t offset) {
+    if (indexEntryCount == LOG_INDEX_BUFFER_ENTRIES)
+        return;
+
+    indexEntries[indexEntryCount][0] = offset;
+    indexEntries[indexEntryCount][1] = millis();
+    indexEntryCount++;
+}
+
+//Appends the buffered index entries to the index for the given log, opening it if needed. Called on the sync path so
+//the index is never far behind the log it describes.
+void flush_index(SdFile *file) {
+    if (indexEntryCount == 0)
+        return;
+
+    if (!indexFile.isOpen()) {
+        char index_file_name[13];
+
+        //The index is named after the log, LOGnnnnn.TXT -> LOGnnnnn.IDX
+        if (!file->getFilename(index_file_name)) {
+            indexEntryCount = 0;
+            return;
+        }
+        strcpy_P(strchr(index_file_name, '.') + 1, PSTR("IDX"));
+
+        if (!indexFile.open(&currentDirectory, index_file_name, O_CREAT | O_APPEND | O_WRITE)) {
+            indexEntryCount = 0; //Carry on logging without an index
+            return;
+        }
+    }
+
+    indexFile.write(indexEntries, indexEntryCount * sizeof(indexEntries[0]));
+    indexFile.sync();
+    indexEntryCount = 0;
+}
+#endif
+
+#if LOG_RECYCLE
+//Takes any clusters the log has grown into since we last looked off our count of free space
+void charge_log_clusters(SdFile *file) {
+    byte clusterShift = volume.clusterSizeShift() + 9;
+    uint32_t clusters = (file->fileSize() + (1UL << clusterShift) - 1) >> clusterShift;
+
+    if (clusters > logClustersCharged) {
+        freeClusters -= clusters - logClustersCharged;
+        logClustersCharged = clusters;
+    }
+}
+
+//Gets the number of a log from its file name, or returns false if it isn't one of ours (LOGnnnnn.TXT). The name is
+//either "LOGnnnnn.TXT" or, straight from the directory entry, "LOGnnnnnTXT"
+boolean log_number(const char *name, uint16_t *number) {
+    if (strncmp_P(name, PSTR("LOG"), 3) != 0)
+        return false;
+
+    *number = 0;
+    for (byte i = 3; i < 8; i++) {
+        if (name[i] < '0' || name[i] > '9')
+            return false;
+        *number = *number * 10 + (name[i] - '0');
+    }
+
+    return strncmp_P(name + (name[8] == '.' ? 9 : 8), PSTR("TXT"), 3) == 0;
+}
+
+#endif
+
+//Frees up to budget more clusters of the last file deleted with removeDeferred(), erasing them if erase is set and
+//ERASE_FREED turned erasing on. SdFat never frees them behind our back (a write that needs them fails instead), so
+//this is the one place they go back on our count of free clusters.
+void free_deleted_clusters(uint32_t budget, boolean erase) {
+    int32_t freed = volume.freeChainStep(budget, erase);
+
+#if LOG_RECYCLE
+    if (freed > 0)
+        freeClusters += freed;
+#else
+    (void) freed;
+#endif
+}
+
+#if ERASE_FREED
+//Erases runs of free clusters a step at a time, for up to budgetMsec or until data arrives, carrying on from
+//eraseCursor. Quiet period after quiet period, across power cycles (see save_erase_cursor), the pass works its way
+//round the whole card.
+void erase_free_space(uint16_t budgetMsec) {
+    uint32_t start = millis();
+
+    while (millis() - start < budgetMsec && !NewSerial.available()) {
+        if (volume.eraseFreeStep(&eraseCursor, ERASE_STEP_CLUSTERS) < 0)
+            break;
+    }
+}
+
+//Records where the erase pass got to in EEPROM, writing only the bytes that changed
+void save_erase_cursor(void) {
+    for (byte i = 0; i < 4; i++) {
+        if (EEPROM.read(LOCATION_ERASE_CURSOR + i) != (byte) (eraseCursor >> (i * 8)))
+            EEPROM.write(LOCATION_ERASE_CURSOR + i, (byte) (eraseCursor >> (i * 8)));
+    }
+}
+#endif
+
+#if LOG_RECYCLE
+//Points recycleCursor at the oldest log on the card. Logs are numbered in the order they were created, wrapping at 65535,
+//so the oldest is the furthest behind the file number in EEPROM (where the log for this power up will be). This reads
+//the whole directory, so it's only done at boot.
+void find_oldest_log(void) {
+    uint16_t next, number, oldestAge = 0;
+    dir_t entry;
+
+    next = EEPROM.read(LOCATION_FILE_NUMBER_MSB);
+    next = (next << 8) | EEPROM.read(LOCATION_FILE_NUMBER_LSB);
+    recycleCursor = next;
+
+    currentDirectory.rewind();
+    while (currentDirectory.readDir(&entry) > 0) {
+        if (log_number((const char *) entry.name, &number) && (uint16_t) (next - number) > oldestAge) {
+            oldestAge = next - number;
+            recycleCursor = number;
+        }
+    }
+}
+
+//Deletes the oldest log to make room on the card, taking its index first so an index is never left without its log.
+//Each call deletes one file or steps past one number that has no log, returns false once there's nothing older than
+//the current log left. The file's clusters are only freed, and counted as free, by later calls to
+//free_deleted_clusters().
+boolean recycle_oldest_log(SdFile *file) {
+    char name[13];
+    uint16_t current;
+    SdFile oldLog;
+
+    if (!file->getFilename(name) || !log_number(name, &current) || recycleCursor == current)
+        return false;
+
+#if LOG_INDEX
+    sprintf_P(name, PSTR("LOG%05u.IDX"), recycleCursor);
+    if (oldLog.open(&currentDirectory, name, O_WRITE))
+        return oldLog.removeDeferred();
+#endif
+
+    sprintf_P(name, PSTR("LOG%05u.TXT"), recycleCursor);
+    if (oldLog.open(&currentDirectory, name, O_WRITE) && !oldLog.removeDeferred())
+        return false;
+
+    recycleCursor++;
+    return true;
+}
+#endif
+
+//Tells the host how many bytes reached the card since the last report, along with the SerialPort
+//RX error bits (SP_RX_BUF_OVERRUN etc.) seen in that time and how many ranges of the log failed to read back as
+//written. The format is "Logged:<bytes>,<error bits>,<verify failures>"
+void report_logged(uint32_t bytesLogged) {
+    NewSerial.print(F(LOGGED_REPORT_PREFIX));
+    NewSerial.print(bytesLogged);
+    NewSerial.print(',');
+    NewSerial.print(NewSerial.getRxError());
+    NewSerial.print(',');
+    NewSerial.println(verifyFailures);
+    NewSerial.clearRxError();
+    verifyFailures = 0;
+}
+
+#if COMMAND_MODE
+//Waits up to COMMAND_WINDOW_MSEC after boot for the command mode escape. Anything else that arrives is left in the RX
+//buffer for the log.
+boolean command_mode_requested(void) {
+    uint32_t start = millis();
+    byte escapes = 0;
+
+    while (millis() - start < COMMAND_WINDOW_MSEC) {
+        int c = NewSerial.peek();
+
+        if (c == -1)
+            continue;
+        if (c != COMMAND_ESCAPE)
+            return false; //The flight controller got in first
+
+        NewSerial.read();
+        if (++escapes == COMMAND_ESCAPE_COUNT)
+            return true;
+    }
+
+    return false;
+}
+
+//Runs commands from the host until it tells us to start logging
+void command_shell(void) {
+    char line[COMMAND_LINE_LENGTH];
+
+    while (1) {
+        NewSerial.write('>');
+
+        byte length = 0;
+        while (1) {
+            int c = NewSerial.read();
+
+            if (c == -1)
+                continue;
+            if (c == '\r' || c == '\n')
+                break;
+            if (length < sizeof(line) - 1)
+                line[length++] = c;
+        }
+        line[length] = '\0';
+
+        if (strcmp_P(line, PSTR("ls")) == 0)
+            command_list();
+        else if (strncmp_P(line, PSTR("read "), 5) == 0)
+            command_read(line + 5);
+        else if (strcmp_P(line, PSTR("exit")) == 0)
+            return;
+        else if (length > 0)
+            NewSerial.println(F("ERR unknown command"));
+    }
+}
+
+//Lists the files in the root directory
+void command_list(void) {
+    dir_t entry;
+    char name[13];
+
+    currentDirectory.rewind();
+    while (currentDirectory.readDir(&entry) > 0) {
+        if (!DIR_IS_FILE(&entry))
+            continue;
+
+        SdBaseFile::dirName(entry, name);
+        NewSerial.print(name);
+        NewSerial.print(' ');
+        NewSerial.println(entry.fileSize);
+    }
+}
+
+//Sends a file to the host: "read <name> [start]"
+void command_read(char *args) {
+    SdFile file;
+    char *start = strchr(args, ' ');
+    uint32_t offset = 0;
+
+    if (start) {
+        *start++ = '\0';
+        offset = strtoul(start, NULL, 10);
+    }
+
+    if (!file.open(&currentDirectory, args, O_READ) || !file.isFile()) {
+        NewSerial.println(F("ERR no such file"));
+        return;
+    }
+    if (offset > file.fileSize()) {
+        NewSerial.println(F("ERR start is past the end of the file"));
+        return;
+    }
+
+    NewSerial.print(F("OK "));
+    NewSerial.println(file.fileSize() - offset);
+
+    uint16_t crc = stream_file(&file, offset);
+
+    NewSerial.write((byte) crc);
+    NewSerial.write((byte) (crc >> 8));
+    NewSerial.println();
+}
+
+//Sends the file from offset on and returns the CRC of what was sent. The file is read straight from the card with one
+//multi-block read (CMD18) for each run of consecutive clusters in its chain, into the volume's cache block so we need
+//no more RAM. If the card fails us part way the rest is sent as zeros, with a CRC that won't match.
+uint16_t stream_file(SdFile *file, uint32_t offset) {
+    uint32_t remaining = file->fileSize() - offset;
+    uint32_t cluster = file->firstCluster();
+    byte blocksPerCluster = volume.blocksPerCluster();
+    byte clusterShift = volume.clusterSizeShift();
+    uint16_t crc = 0xFFFF;
+    boolean failed = false;
+
+    //Skip the clusters before offset
+    for (uint32_t skip = offset >> (clusterShift + 9); skip > 0 && remaining > 0; skip--) {
+        if (!volume.dbgFat(cluster, &cluster)) {
+            failed = true;
+            break;
+        }
+    }
+
+    byte blockOffset = (offset >> 9) & (blocksPerCluster - 1);
+    uint16_t byteOffset = offset & 511;
+
+    while (remaining > 0 && !failed) {
+        //Follow the chain for as long as the next cluster is the one after this on the card, or we have enough
+        uint32_t blocksNeeded = (remaining + byteOffset + 511) >> 9;
+        uint32_t runBlocks = blocksPerCluster - blockOffset;
+        uint32_t last = cluster, next = 0;
+
+        while (runBlocks < blocksNeeded) {
+            if (!volume.dbgFat(last, &next) || next != last + 1)
+                break;
+            last = next;
+            runBlocks += blocksPerCluster;
+        }
+        if (runBlocks > blocksNeeded)
+            runBlocks = blocksNeeded;
+
+        //The FAT lookups are done with the cache, now it can hold data
+        cache_t *buffer = volume.cacheClear();
+
+        if (!buffer || cluster < 2 || cluster > volume.clusterCount() + 1
+                || !card.readStart(volume.dataStartBlock() + ((cluster - 2) << clusterShift) + blockOffset)) {
+            failed = true;
+            break;
+        }
+
+        for (; runBlocks > 0; runBlocks--) {
+            if (!card.readData(buffer->data)) {
+                failed = true;
+                break;
+            }
+
+            uint16_t count = 512 - byteOffset;
+            if (count > remaining)
+                count = remaining;
+
+            for (uint16_t i = 0; i < count; i++)
+                crc = _crc_ccitt_update(crc, buffer->data[byteOffset + i]);
+            NewSerial.write(buffer->data + byteOffset, count);
+
+            remaining -= count;
+            byteOffset = 0;
+        }
+
+        if (!card.readStop())
+            failed = true;
+
+        cluster = next;
+        blockOffset = 0;
+    }
+
+    if (failed) {
+        for (; remaining > 0; remaining--)
+            NewSerial.write((byte) 0);
+        crc = ~crc;
+    }
+
+    return crc;
+}
+#endif
+
 //The following are system functions needed for basic operation
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
@@ -380,6 +1796,36 @@ void read_system_settings(void) {
         setting_uart_speed = BAUD_DEFAULT; //Reset if there is no speed stored
         writeBaud(setting_uart_speed); //Record to EEPROM
     }
+
+    setting_compression = EEPROM.read(LOCATION_COMPRESSION);
+    if (setting_compression > 1) {
+        setting_compression = 0; //Compression is off unless asked for
+        EEPROM.write(LOCATION_COMPRESSION, setting_compression);
+    }
+
+    setting_framing = EEPROM.read(LOCATION_FRAMING);
+    if (setting_framing > 1) {
+        setting_framing = 0; //Framing is off unless asked for
+        EEPROM.write(LOCATION_FRAMING, setting_framing);
+    }
+
+    setting_timestamps = EEPROM.read(LOCATION_TIMESTAMPS);
+    if (setting_timestamps > 1) {
+        setting_timestamps = 0; //Timestamps are off unless asked for
+        EEPROM.write(LOCATION_TIMESTAMPS, setting_timestamps);
+    }
+
+    setting_auto_baud = EEPROM.read(LOCATION_AUTO_BAUD);
+    if (setting_auto_baud > 1) {
+        setting_auto_baud = 0; //The baud rate is fixed unless asked for
+        EEPROM.write(LOCATION_AUTO_BAUD, setting_auto_baud);
+    }
+
+    setting_recycle = EEPROM.read(LOCATION_RECYCLE);
+    if (setting_recycle > 1) {
+        setting_recycle = 0; //Old logs are kept unless asked for
+        EEPROM.write(LOCATION_RECYCLE, setting_recycle);
+    }
 }
 
 void read_config_file(void) {
@@ -388,7 +1834,7 @@ void read_config_file(void) {
     if (!rootDirectory.openRoot(&volume))
         systemError(ERROR_ROOT_INIT); // open the root directory
 
-    char configFileName[strlen(CFG_FILENAME)]; //Limited to 8.3
+    char configFileName[strlen(CFG_FILENAME) + 1]; //Limited to 8.3
     strcpy_P(configFileName, PSTR(CFG_FILENAME)); //This is the name of the config file. 'config.sys' is probably a bad idea.
 
     //Check to see if we have a config file
@@ -412,8 +1858,8 @@ void read_config_file(void) {
 
     //Read up to 20 characters from the file. There may be a better way of doing this...
     char c;
-    int len;
-    byte settings_string[CFG_LENGTH]; //"115200\0" = 115200 bps
+    byte len;
+    byte settings_string[CFG_LENGTH]; //"115200,0,0,0,0,0" = 115200 bps, no compression, framing, timestamps, auto-baud or recycling
     for (len = 0; len < CFG_LENGTH; len++) {
         if ((c = configFile.read()) < 0)
             break; //We've reached the end of the file
@@ -436,20 +1882,30 @@ void read_config_file(void) {
 
     //Default the system settings in case things go horribly wrong
     long new_system_baud = BAUD_DEFAULT;
+    byte new_system_compression = 0;
+    byte new_system_framing = 0;
+    byte new_system_timestamps = 0;
+    byte new_system_auto_baud = 0;
+    byte new_system_recycle = 0;
 
     //Parse the settings out
     byte i = 0, j = 0, setting_number = 0;
-    char new_setting[8]; //Max length of a setting is 6, the bps setting = '115200' plus '\0'
+    char new_setting[CFG_FIELD_LENGTH + 1];
     byte new_setting_int = 0;
 
     for (i = 0; i < len; i++) {
-        //Pick out one setting from the line of text
-        for (j = 0; settings_string[i] != ',' && i < len && j < 6;) {
-            new_setting[j] = settings_string[i];
-            i++;
-            j++;
+        //Pick out one setting from the line of text, up to the next ','. One that's too long to be valid is read as empty
+        //(so it takes its default) rather than split, which would shift every setting after it along by one
+        boolean overlong = false;
+        for (j = 0; i < len && settings_string[i] != ','; i++) {
+            if (j < CFG_FIELD_LENGTH)
+                new_setting[j++] = settings_string[i];
+            else
+                overlong = true;
         }
 
+        if (overlong)
+            j = 0;
         new_setting[j] = '\0'; //Terminate the string for array compare
         new_setting_int = atoi(new_setting); //Convert string to int
 
@@ -461,6 +1917,36 @@ void read_config_file(void) {
                 if (new_system_baud < BAUD_MIN || new_system_baud > BAUD_MAX)
                     new_system_baud = BAUD_DEFAULT;
             break;
+            case 1: //Compression
+                new_system_compression = new_setting_int;
+
+                if (new_system_compression > 1)
+                    new_system_compression = 0;
+            break;
+            case 2: //Framing
+                new_system_framing = new_setting_int;
+
+                if (new_system_framing > 1)
+                    new_system_framing = 0;
+            break;
+            case 3: //Timestamps
+                new_system_timestamps = new_setting_int;
+
+                if (new_system_timestamps > 1)
+                    new_system_timestamps = 0;
+            break;
+            case 4: //Auto-baud
+                new_system_auto_baud = new_setting_int;
+
+                if (new_system_auto_baud > 1)
+                    new_system_auto_baud = 0;
+            break;
+            case 5: //Recycle old logs
+                new_system_recycle = new_setting_int;
+
+                if (new_system_recycle > 1)
+                    new_system_recycle = 0;
+            break;
             default:
                 //We're done!
             break;
@@ -472,6 +1958,15 @@ void read_config_file(void) {
     //We now have the settings loaded into the global variables. Now check if they're different from EEPROM settings
     boolean recordNewSettings = false;
 
+    //Config files from older firmware don't have all the settings, rewrite them so the new ones can be found
+    byte settings_found = 1;
+    for (i = 0; i < len && settings_string[i] != '\r' && settings_string[i] != '\n'; i++)
+        if (settings_string[i] == ',')
+            settings_found++;
+
+    if (settings_found < CFG_SETTINGS)
+        recordNewSettings = true;
+
     if (new_system_baud != setting_uart_speed) {
         //If the baud rate from the file is different from the current setting,
         //Then update the setting to the file setting
@@ -483,6 +1978,41 @@ void read_config_file(void) {
         recordNewSettings = true;
     }
 
+    if (new_system_compression != setting_compression) {
+        EEPROM.write(LOCATION_COMPRESSION, new_system_compression);
+        setting_compression = new_system_compression;
+
+        recordNewSettings = true;
+    }
+
+    if (new_system_framing != setting_framing) {
+        EEPROM.write(LOCATION_FRAMING, new_system_framing);
+        setting_framing = new_system_framing;
+
+        recordNewSettings = true;
+    }
+
+    if (new_system_timestamps != setting_timestamps) {
+        EEPROM.write(LOCATION_TIMESTAMPS, new_system_timestamps);
+        setting_timestamps = new_system_timestamps;
+
+        recordNewSettings = true;
+    }
+
+    if (new_system_auto_baud != setting_auto_baud) {
+        EEPROM.write(LOCATION_AUTO_BAUD, new_system_auto_baud);
+        setting_auto_baud = new_system_auto_baud;
+
+        recordNewSettings = true;
+    }
+
+    if (new_system_recycle != setting_recycle) {
+        EEPROM.write(LOCATION_RECYCLE, new_system_recycle);
+        setting_recycle = new_system_recycle;
+
+        recordNewSettings = true;
+    }
+
     //We don't want to constantly record a new config file on each power on. Only record when there is a change.
     if (recordNewSettings == true)
         record_config_file(); //If we corrected some values because the config file was corrupt, then overwrite any corruption
@@ -505,12 +2035,16 @@ void record_config_file(void) {
     if (!rootDirectory.openRoot(&volume))
         systemError(ERROR_ROOT_INIT); // open the root directory
 
-    char configFileName[strlen(CFG_FILENAME)];
+    char configFileName[strlen(CFG_FILENAME) + 1];
     strcpy_P(configFileName, PSTR(CFG_FILENAME)); //This is the name of the config file. 'config.sys' is probably a bad idea.
 
-    //If there is currently a config file, trash it
+    //If there is currently a config file, trash it. Its cluster is freed the next time we're idle, but only one deleted
+    //file can wait to be freed, so finish off the last one now (we aren't logging)
     if (myFile.open(&rootDirectory, configFileName, O_WRITE)) {
-        if (!myFile.remove()) {
+        if (volume.freeChainPending())
+            free_deleted_clusters(0xFFFFFFFF, true);
+
+        if (!myFile.removeDeferred()) {
             NewSerial.println(F("Remove config failed"));
             myFile.close(); //Close this file
             rootDirectory.close(); //Close this file structure instance
@@ -530,23 +2064,27 @@ void record_config_file(void) {
     }
     //Config was successfully created, now record current system settings to the config file
 
-    char settings_string[CFG_LENGTH]; //"115200,103,214,0,1,1\0" = 115200 bps, escape char of ASCII(103), 214 times, new log mode, verbose on, echo on.
+    char settings_string[sizeof(MAX_CFG)]; //"115200,0,0,0,0,0" = 115200 bps, no compression, framing, timestamps, auto-baud or recycling
 
-    //Before we read the EEPROM values, they've already been tested and defaulted in the read_system_settings function
+    //Before we read the EEPROM values, they've already been tested and defaulted in the read_system_settings function.
+    //Keeping to the ranges MAX_CFG allows for (the other settings are all 0 or 1) lets the compiler see the line fits
     long current_system_baud = readBaud();
+    current_system_baud = constrain(current_system_baud, BAUD_MIN, BAUD_MAX);
 
     //Convert system settings to visible ASCII characters
-    sprintf_P(settings_string, PSTR("%ld\0"), current_system_baud);
+    snprintf_P(settings_string, sizeof(settings_string), PSTR("%ld,%c,%c,%c,%c,%c"), current_system_baud,
+        '0' + setting_compression, '0' + setting_framing, '0' + setting_timestamps, '0' + setting_auto_baud,
+        '0' + setting_recycle);
+    byte settings_length = strlen(settings_string);
 
     //Record current system settings to the config file
-    if (myFile.write(settings_string, strlen(settings_string))
-            != strlen(settings_string))
+    if (myFile.write(settings_string, settings_length) != settings_length)
         NewSerial.println(F("error writing to file"));
 
     myFile.println(); //Add a break between lines
 
     //Add a decoder line to the file
-#define HELP_STR "baud\0"
+#define HELP_STR "baud,compress,frame,stamp,auto,recycle\0"
     char helperString[strlen(HELP_STR) + 1]; //strlen is preprocessed but returns one less because it ignores the \0
     strcpy_P(helperString, PSTR(HELP_STR));
     myFile.write(helperString); //Add this string to the file
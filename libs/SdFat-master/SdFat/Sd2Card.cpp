@@ -19,12 +19,10 @@
  */
 #include <Sd2Card.h>
 #include <SdSpi.h>
+#include <SdTrace.h>
 #if !USE_SOFTWARE_SPI && ENABLE_SPI_TRANSACTION
 #include <SPI.h>
 #endif  // !USE_SOFTWARE_SPI && defined(SPI_HAS_TRANSACTION)
-// debug trace macro
-#define SD_TRACE(m, b)
-// #define SD_TRACE(m, b) Serial.print(m);Serial.println(b);
 //------------------------------------------------------------------------------
 SdSpi Sd2Card::m_spi;
 //==============================================================================
@@ -305,6 +303,7 @@ void Sd2Card::chipSelectLow() {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::erase(uint32_t firstBlock, uint32_t lastBlock) {
+  SD_TRACE(SD_TRACE_ERASE, firstBlock);
   csd_t csd;
   if (!readCSD(&csd)) goto fail;
   // check for single block erase
@@ -375,7 +374,7 @@ bool Sd2Card::isBusy() {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readBlock(uint32_t blockNumber, uint8_t* dst) {
-  SD_TRACE("RB", blockNumber);
+  SD_TRACE(SD_TRACE_READ_BLOCK, blockNumber);
   // use address if not SDHC card
   if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD17, blockNumber)) {
@@ -397,6 +396,7 @@ bool Sd2Card::readBlock(uint32_t blockNumber, uint8_t* dst) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readData(uint8_t *dst) {
+  SD_TRACE(SD_TRACE_READ_DATA, 0);
   chipSelectLow();
   return readData(dst, 512);
 }
@@ -490,7 +490,7 @@ bool Sd2Card::readRegister(uint8_t cmd, void* buf) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readStart(uint32_t blockNumber) {
-  SD_TRACE("RS", blockNumber);
+  SD_TRACE(SD_TRACE_READ_START, blockNumber);
   if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD18, blockNumber)) {
     error(SD_CARD_ERROR_CMD18);
@@ -510,6 +510,7 @@ bool Sd2Card::readStart(uint32_t blockNumber) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readStop() {
+  SD_TRACE(SD_TRACE_READ_STOP, 0);
   if (cardCommand(CMD12, 0)) {
     error(SD_CARD_ERROR_CMD12);
     goto fail;
@@ -544,7 +545,7 @@ bool Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
-  SD_TRACE("WB", blockNumber);
+  SD_TRACE(SD_TRACE_WRITE_BLOCK, blockNumber);
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD24, blockNumber)) {
@@ -581,6 +582,7 @@ bool Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeData(const uint8_t* src) {
+  SD_TRACE(SD_TRACE_WRITE_DATA, 0);
   chipSelectLow();
   // wait for previous write to finish
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
@@ -630,7 +632,7 @@ bool Sd2Card::writeData(uint8_t token, const uint8_t* src) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
-  SD_TRACE("WS", blockNumber);
+  SD_TRACE(SD_TRACE_WRITE_START, blockNumber);
   // send pre-erase count
   if (cardAcmd(ACMD23, eraseCount)) {
     error(SD_CARD_ERROR_ACMD23);
@@ -656,6 +658,7 @@ bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::writeStop() {
+  SD_TRACE(SD_TRACE_WRITE_STOP, 0);
   chipSelectLow();
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
   m_spi.send(STOP_TRAN_TOKEN);
@@ -101,10 +101,59 @@ dir_t* SdBaseFile::cacheDirEntry(uint8_t action) {
  */
 bool SdBaseFile::close() {
   bool rtn = sync();
+  // end the multi-block read this file's reads may have left open
+  if ((m_flags & F_READ_AHEAD) && !m_vol->cacheStreamStop()) rtn = false;
+  m_flags &= ~(F_APPEND_CACHED | F_READ_AHEAD);
   m_type = FAT_FILE_TYPE_CLOSED;
   return rtn;
 }
 //------------------------------------------------------------------------------
+// find the cluster at index in the file, given that m_curCluster is the one
+// before it.  The extent cache is used if it knows the cluster.
+bool SdBaseFile::clusterAfter(uint32_t index, uint32_t* next) {
+#if FILE_EXTENT_CACHE_SIZE
+  FatExtent_t* extent = extentFind(index);
+  if (extent) {
+    *next = extent->cluster + index - extent->fileCluster;
+    return true;
+  }
+#endif  // FILE_EXTENT_CACHE_SIZE
+  if (!m_vol->fatGet(m_curCluster, next)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  extentAdd(index, *next);
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+#if FILE_EXTENT_CACHE_SIZE
+// return how many of the clusters after the one at index in the file follow
+// it on the volume, counting no more than max.  Reads ahead in the FAT if
+// the run is the last one the extent cache knows.
+uint32_t SdBaseFile::contiguousClusters(uint32_t index, uint32_t max) {
+  uint32_t n;
+  FatExtent_t* extent = extentFind(index);
+  if (!extent) return 0;
+  n = extent->fileCluster + extent->count - 1 - index;
+  while (n < max && extent == &m_extent[m_extentCount - 1]) {
+    uint32_t last = extent->cluster + extent->count - 1;
+    uint32_t next;
+    if (!m_vol->fatGet(last, &next)) break;
+    if (next != last + 1) {
+      // end of the run, remember where the next one starts
+      extentAdd(extent->fileCluster + extent->count, next);
+      break;
+    }
+    extent->count++;
+    n++;
+  }
+  return n < max ? n : max;
+}
+#endif  // FILE_EXTENT_CACHE_SIZE
+//------------------------------------------------------------------------------
 /** Check for contiguous file and return its raw block range.
  *
  * \param[out] bgnBlock the first block address for the file.
@@ -254,6 +303,105 @@ bool SdBaseFile::exists(const char* name) {
   return file.open(this, name, O_READ);
 }
 //------------------------------------------------------------------------------
+/** Grow a file, without writing to it, into clusters already in its chain.
+ *
+ * Used to take back data that reached the card after the file was last
+ * synced, e.g. when reopening a file after a write error.  The file stops
+ * growing at the end of its cluster chain, so it never takes in clusters
+ * that were not linked to it on the card.
+ *
+ * \param[in] length The size to grow the file to.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the file is not open for write,
+ * is a directory, or an I/O error occurred.
+ */
+bool SdBaseFile::extend(uint32_t length) {
+  uint32_t cluster;
+  uint32_t next;
+  uint32_t end;
+  uint8_t shift;
+  // error if not a normal file or read-only
+  if (!isFile() || !(m_flags & O_WRITE)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (length <= m_fileSize || m_firstCluster == 0) return true;
+
+  shift = m_vol->clusterSizeShift() + 9;
+  // find the cluster holding the last byte of the file
+  if (m_fileSize == 0) {
+    cluster = m_firstCluster;
+    end = 1UL << shift;
+  } else {
+    if (!seekSet(m_fileSize)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    cluster = m_curCluster;
+    end = (((m_fileSize - 1) >> shift) + 1) << shift;
+  }
+  // follow the chain until it covers length or ends
+  while (end < length) {
+    if (!m_vol->fatGet(cluster, &next)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (m_vol->isEOC(next)) break;
+    cluster = next;
+    end += 1UL << shift;
+  }
+  m_fileSize = end < length ? end : length;
+
+  // need to update directory entry
+  m_flags |= F_FILE_DIR_DIRTY;
+
+  return sync();
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+#if FILE_EXTENT_CACHE_SIZE
+// record that the file's cluster at index is cluster.  Only the runs from
+// the start of the file on are kept, so the cache never has gaps.
+void SdBaseFile::extentAdd(uint32_t index, uint32_t cluster) {
+  FatExtent_t* last;
+  // extentFind() starts the cache off with the first cluster
+  if (cluster < 2 || m_vol->isEOC(cluster) || !extentFind(0)) return;
+  last = &m_extent[m_extentCount - 1];
+  if (index != last->fileCluster + last->count) return;
+  if (cluster == last->cluster + last->count) {
+    last->count++;
+  } else if (m_extentCount < FILE_EXTENT_CACHE_SIZE) {
+    last++;
+    last->fileCluster = index;
+    last->cluster = cluster;
+    last->count = 1;
+    m_extentCount++;
+  }
+}
+//------------------------------------------------------------------------------
+// return the cached run holding the file's cluster at index, or null
+FatExtent_t* SdBaseFile::extentFind(uint32_t index) {
+  if (m_extentCount == 0) {
+    // the first cluster is always known
+    if (m_firstCluster < 2) return 0;
+    m_extent[0].fileCluster = 0;
+    m_extent[0].cluster = m_firstCluster;
+    m_extent[0].count = 1;
+    m_extentCount = 1;
+  }
+  for (uint8_t i = 0; i < m_extentCount; i++) {
+    if (index < m_extent[i].fileCluster + m_extent[i].count) {
+      return &m_extent[i];
+    }
+  }
+  return 0;
+}
+#endif  // FILE_EXTENT_CACHE_SIZE
+//------------------------------------------------------------------------------
 /**
  * Get a string from a file.
  *
@@ -708,8 +856,11 @@ bool SdBaseFile::open(SdBaseFile* dirFile,
 
     // set timestamps
     if (m_dateTime) {
-      // call user date/time function
-      m_dateTime(&p->creationDate, &p->creationTime);
+      // call user date/time function, the entry's fields may be unaligned
+      uint16_t date, time;
+      m_dateTime(&date, &time);
+      p->creationDate = date;
+      p->creationTime = time;
     } else {
       // use default date/time
       p->creationDate = FAT_DEFAULT_DATE;
@@ -825,6 +976,7 @@ bool SdBaseFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // set to start of file
   m_curCluster = 0;
   m_curPosition = 0;
+  extentClear();
   if ((oflag & O_TRUNC) && !truncate(0)) {
     DBG_FAIL_MACRO;
     goto fail;
@@ -1010,6 +1162,7 @@ bool SdBaseFile::openRoot(SdVolume* vol) {
   // set to start of file
   m_curCluster = 0;
   m_curPosition = 0;
+  extentClear();
 
   // root has no directory entry
   m_dirBlock = 0;
@@ -1088,7 +1241,8 @@ int SdBaseFile::read(void* buf, size_t nbyte) {
           m_curCluster = m_firstCluster;
         } else {
           // get next cluster from FAT
-          if (!m_vol->fatGet(m_curCluster, &m_curCluster)) {
+          if (!clusterAfter(m_curPosition >> (m_vol->clusterSizeShift() + 9),
+                            &m_curCluster)) {
             DBG_FAIL_MACRO;
             goto fail;
           }
@@ -1102,7 +1256,8 @@ int SdBaseFile::read(void* buf, size_t nbyte) {
       n = 512 - offset;
       if (n > toRead) n = toRead;
       // read block to cache and copy data to caller
-      pc = m_vol->cacheFetch(block, SdVolume::CACHE_FOR_READ);
+      pc = m_flags & F_READ_AHEAD ? m_vol->cacheFetchStream(block, false)
+        : m_vol->cacheFetch(block, SdVolume::CACHE_FOR_READ);
       if (!pc) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -1112,43 +1267,49 @@ int SdBaseFile::read(void* buf, size_t nbyte) {
     } else if (!USE_MULTI_BLOCK_SD_IO || toRead < 1024) {
       // read single block
       n = 512;
-      if (!m_vol->readBlock(block, dst)) {
+      if (m_flags & F_READ_AHEAD ? !m_vol->streamRead(block, dst)
+        : !m_vol->readBlock(block, dst)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
     } else {
-      uint8_t nb = toRead >> 9;
+      uint8_t nb = toRead < 0X20000 ? toRead >> 9 : 0XFF;
       if (m_type != FAT_FILE_TYPE_ROOT_FIXED) {
-        uint8_t mb = m_vol->blocksPerCluster() - blockOfCluster;
+        uint32_t mb = m_vol->blocksPerCluster() - blockOfCluster;
+        if (mb < nb) {
+          // carry on into clusters that follow this one on the volume
+          uint8_t shift = m_vol->clusterSizeShift();
+          mb += contiguousClusters(m_curPosition >> (shift + 9),
+                  (nb - mb + m_vol->blocksPerCluster() - 1) >> shift) << shift;
+        }
         if (mb < nb) nb = mb;
       }
       n = 512*nb;
-      if (m_vol->cacheBlockNumber() <= block
-        && block < (m_vol->cacheBlockNumber() + nb)) {
+      if (block <= m_vol->cacheBlockNumber()
+        && m_vol->cacheBlockNumber() < (block + nb)) {
         // flush cache if a block is in the cache
         if (!m_vol->cacheSync()) {
           DBG_FAIL_MACRO;
           goto fail;
         }
       }
-      if (!m_vol->sdCard()->readStart(block)) {
-        DBG_FAIL_MACRO;
-        goto fail;
-      }
+      // the read is left open in case the next read carries on from here
       for (uint8_t b = 0; b < nb; b++) {
-        if (!m_vol->sdCard()->readData(dst + b*512)) {
+        if (!m_vol->streamRead(block + b, dst + b*512)) {
           DBG_FAIL_MACRO;
           goto fail;
         }
       }
-      if (!m_vol->sdCard()->readStop()) {
-        DBG_FAIL_MACRO;
-        goto fail;
+      if (m_type != FAT_FILE_TYPE_ROOT_FIXED) {
+        // the cluster holding the last block read
+        m_curCluster += (blockOfCluster + nb - 1) >> m_vol->clusterSizeShift();
       }
     }
     dst += n;
     m_curPosition += n;
     toRead -= n;
+    // reads that run on into the next block stream it
+    if ((m_curPosition & 0X1FF) == 0) m_flags |= F_READ_AHEAD;
   }
   return nbyte;
 
@@ -1240,6 +1401,7 @@ bool SdBaseFile::remove() {
   d->name[0] = DIR_NAME_DELETED;
 
   // set this file closed
+  m_flags &= ~F_APPEND_CACHED;
   m_type = FAT_FILE_TYPE_CLOSED;
 
   // write entry to SD
@@ -1250,6 +1412,50 @@ bool SdBaseFile::remove() {
   return false;
 }
 //------------------------------------------------------------------------------
+/** Remove a file without waiting for its clusters to be freed.
+ *
+ * The directory entry is deleted at once and the file's cluster chain is
+ * handed to SdVolume::freeChainStep(), so a large file can be freed a few
+ * clusters at a time while other files are written.  Only one chain waits
+ * at a time: finish the last one with SdVolume::freeChainStep() first.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ * Reasons for failure include the file read-only, is a directory,
+ * another chain still waiting to be freed, or an I/O error occurred.
+ */
+bool SdBaseFile::removeDeferred() {
+  dir_t* d;
+  uint32_t firstCluster = m_firstCluster;
+  // error if not a normal file, read-only or another chain is waiting
+  if (!isFile() || !(m_flags & O_WRITE) || m_vol->freeChainPending()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // cache directory entry
+  d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
+  if (!d) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // mark entry deleted
+  d->name[0] = DIR_NAME_DELETED;
+
+  // set this file closed
+  m_flags &= ~F_APPEND_CACHED;
+  m_type = FAT_FILE_TYPE_CLOSED;
+
+  // the entry must be gone from the SD before its clusters can be reused
+  if (!m_vol->cacheSync()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return firstCluster == 0 || m_vol->freeChainLater(firstCluster);
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 /** Remove a file.
  *
  * The directory entry and all data for the file are deleted.
@@ -1537,11 +1743,20 @@ SdBaseFile::SdBaseFile(const char* path, uint8_t oflag) {
 bool SdBaseFile::seekSet(uint32_t pos) {
   uint32_t nCur;
   uint32_t nNew;
+  m_flags &= ~F_APPEND_CACHED;
   // error if file not open or seek past end of file
   if (!isOpen() || pos > m_fileSize) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+  // a seek ends sequential reading and the multi-block read it left open
+  if ((m_flags & F_READ_AHEAD) && pos != m_curPosition) {
+    m_flags &= ~F_READ_AHEAD;
+    if (!m_vol->cacheStreamStop()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
   if (m_type == FAT_FILE_TYPE_ROOT_FIXED) {
     m_curPosition = pos;
     goto done;
@@ -1559,12 +1774,23 @@ bool SdBaseFile::seekSet(uint32_t pos) {
   if (nNew < nCur || m_curPosition == 0) {
     // must follow chain from first cluster
     m_curCluster = m_firstCluster;
-  } else {
-    // advance from curPosition
-    nNew -= nCur;
+    nCur = 0;
+  }
+#if FILE_EXTENT_CACHE_SIZE
+  if (extentFind(0)) {
+    // skip ahead as far as the extent cache knows the chain
+    FatExtent_t* last = &m_extent[m_extentCount - 1];
+    uint32_t known = last->fileCluster + last->count - 1;
+    if (known > nNew) known = nNew;
+    if (known > nCur) {
+      FatExtent_t* extent = extentFind(known);
+      m_curCluster = extent->cluster + known - extent->fileCluster;
+      nCur = known;
+    }
   }
-  while (nNew--) {
-    if (!m_vol->fatGet(m_curCluster, &m_curCluster)) {
+#endif  // FILE_EXTENT_CACHE_SIZE
+  while (nCur < nNew) {
+    if (!clusterAfter(++nCur, &m_curCluster)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -1602,6 +1828,7 @@ bool SdBaseFile::setDirSize() {
 }
 //------------------------------------------------------------------------------
 void SdBaseFile::setpos(FatPos_t* pos) {
+  m_flags &= ~(F_APPEND_CACHED | F_READ_AHEAD);
   m_curPosition = pos->position;
   m_curCluster = pos->cluster;
 }
@@ -1636,8 +1863,12 @@ bool SdBaseFile::sync() {
 
     // set modify time if user supplied a callback date/time function
     if (m_dateTime) {
-      m_dateTime(&d->lastWriteDate, &d->lastWriteTime);
-      d->lastAccessDate = d->lastWriteDate;
+      // the entry's fields may be unaligned
+      uint16_t date, time;
+      m_dateTime(&date, &time);
+      d->lastWriteDate = date;
+      d->lastWriteTime = time;
+      d->lastAccessDate = date;
     }
     // clear directory dirty
     m_flags &= ~F_FILE_DIR_DIRTY;
@@ -1818,6 +2049,7 @@ bool SdBaseFile::truncate(uint32_t length) {
       goto fail;
     }
     m_firstCluster = 0;
+    extentClear();
   } else {
     uint32_t toFree;
     if (!m_vol->fatGet(m_curCluster, &toFree)) {
@@ -1835,6 +2067,7 @@ bool SdBaseFile::truncate(uint32_t length) {
         DBG_FAIL_MACRO;
         goto fail;
       }
+      extentClear();
     }
   }
   m_fileSize = length;
@@ -1876,6 +2109,19 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
   // number of bytes left to write  -  must be before goto statements
   size_t nToWrite = nbyte;
   size_t n;
+  // Appending to the block the last write left in the cache, without filling
+  // it.  The file is at its end, so there's no seek, cluster or block to find.
+  if ((m_flags & F_APPEND_CACHED) && m_vol->m_cacheAppendFile == this
+    && m_vol->cacheBlockNumber() == m_vol->m_cacheAppendBlock
+    && nbyte < 512 - (m_curPosition & 0X1FF)) {
+    memcpy(m_vol->cacheAddress()->data + (m_curPosition & 0X1FF), src, nbyte);
+    m_vol->cacheDirty();
+    m_curPosition += nbyte;
+    m_fileSize = m_curPosition;
+    m_flags |= F_FILE_DIR_DIRTY;
+    return nbyte;
+  }
+  m_flags &= ~(F_APPEND_CACHED | F_READ_AHEAD);
   // error if not a normal file or is read-only
   if (!isFile() || !(m_flags & O_WRITE)) {
     DBG_FAIL_MACRO;
@@ -1900,7 +2146,8 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
       // start of new cluster
       if (m_curCluster != 0) {
         uint32_t next;
-        if (!m_vol->fatGet(m_curCluster, &next)) {
+        if (!clusterAfter(m_curPosition >> (m_vol->clusterSizeShift() + 9),
+                          &next)) {
           DBG_FAIL_MACRO;
           goto fail;
         }
@@ -1910,6 +2157,8 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
             DBG_FAIL_MACRO;
             goto fail;
           }
+          extentAdd(m_curPosition >> (m_vol->clusterSizeShift() + 9),
+                    m_curCluster);
         } else {
           m_curCluster = next;
         }
@@ -1958,6 +2207,11 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
           DBG_FAIL_MACRO;
           goto fail;
         }
+      } else if (m_curPosition + n >= m_fileSize && !(m_flags & O_SYNC)) {
+        // the end of the file is in the cache, more appends can go there
+        m_vol->m_cacheAppendFile = this;
+        m_vol->m_cacheAppendBlock = block;
+        m_flags |= F_APPEND_CACHED;
       }
 
     } else if (!USE_MULTI_BLOCK_SD_IO || nToWrite < 1024) {
@@ -1972,12 +2226,19 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
       }
     } else {
       // use multiple block write command
-      uint8_t maxBlocks = m_vol->blocksPerCluster() - blockOfCluster;
-      uint8_t nBlock = nToWrite >> 9;
+      uint32_t maxBlocks = m_vol->blocksPerCluster() - blockOfCluster;
+      uint8_t nBlock = nToWrite < 0X20000 ? nToWrite >> 9 : 0XFF;
+      if (nBlock > maxBlocks) {
+        // carry on into allocated clusters that follow this one on the volume
+        uint8_t shift = m_vol->clusterSizeShift();
+        maxBlocks += contiguousClusters(m_curPosition >> (shift + 9),
+          (nBlock - maxBlocks + m_vol->blocksPerCluster() - 1) >> shift) << shift;
+      }
       if (nBlock > maxBlocks) nBlock = maxBlocks;
 
       n = 512*nBlock;
-      if (!m_vol->sdCard()->writeStart(block, nBlock)) {
+      if (!m_vol->cacheStreamStop()
+        || !m_vol->sdCard()->writeStart(block, nBlock)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
@@ -1995,6 +2256,8 @@ int SdBaseFile::write(const void* buf, size_t nbyte) {
         DBG_FAIL_MACRO;
         goto fail;
       }
+      // the cluster holding the last block written
+      m_curCluster += (blockOfCluster + nBlock - 1) >> m_vol->clusterSizeShift();
     }
     m_curPosition += n;
     src += n;
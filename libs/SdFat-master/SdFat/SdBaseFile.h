@@ -64,6 +64,19 @@ struct FatPos_t {
   uint32_t cluster;
   FatPos_t() : position(0), cluster(0) {}
 };
+//------------------------------------------------------------------------------
+/**
+ * \struct FatExtent_t
+ * \brief A run of consecutive clusters in a file, see FILE_EXTENT_CACHE_SIZE
+ */
+struct FatExtent_t {
+  /** index in the file of the run's first cluster */
+  uint32_t fileCluster;
+  /** the run's first cluster on the volume */
+  uint32_t cluster;
+  /** number of clusters in the run */
+  uint32_t count;
+};
 
 // values for m_type
 /** This file has not been opened. */
@@ -161,6 +174,7 @@ class SdBaseFile {
   bool dirEntry(dir_t* dir);
   static void dirName(const dir_t& dir, char* name);
   bool exists(const char* name);
+  bool extend(uint32_t length);
   int16_t fgets(char* str, int16_t num, char* delim = 0);
   /** \return The total number of bytes in a file or directory. */
   uint32_t fileSize() const {return m_fileSize;}
@@ -211,6 +225,7 @@ class SdBaseFile {
   int8_t readDir(dir_t* dir);
   static bool remove(SdBaseFile* dirFile, const char* path);
   bool remove();
+  bool removeDeferred();
   /** Set the file's current position to zero. */
   void rewind() {seekSet(0);}
   bool rename(SdBaseFile* dirFile, const char* newPath);
@@ -256,6 +271,17 @@ class SdBaseFile {
   bool addCluster();
   cache_t* addDirCluster();
   dir_t* cacheDirEntry(uint8_t action);
+  bool clusterAfter(uint32_t index, uint32_t* next);
+#if FILE_EXTENT_CACHE_SIZE
+  uint32_t contiguousClusters(uint32_t index, uint32_t max);
+  void extentAdd(uint32_t index, uint32_t cluster);
+  void extentClear() {m_extentCount = 0;}
+  FatExtent_t* extentFind(uint32_t index);
+#else  // FILE_EXTENT_CACHE_SIZE
+  uint32_t contiguousClusters(uint32_t, uint32_t) {return 0;}
+  void extentAdd(uint32_t, uint32_t) {}
+  void extentClear() {}
+#endif  // FILE_EXTENT_CACHE_SIZE
   int8_t lsPrintNext(Print *pr, uint8_t flags, uint8_t indent);
   static bool make83Name(const char* str, uint8_t* name, const char** ptr);
   bool mkdir(SdBaseFile* parent, const uint8_t dname[11]);
@@ -268,6 +294,10 @@ class SdBaseFile {
   // bits defined in m_flags
   // should be 0X0F
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
+  // reads have run sequentially into a block, so stream the next, see read()
+  static uint8_t const F_READ_AHEAD = 0X20;
+  // appends may go straight into the block in the cache, see write()
+  static uint8_t const F_APPEND_CACHED = 0X40;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
@@ -285,5 +315,10 @@ class SdBaseFile {
   uint32_t  m_dirBlock;      // block for this files directory entry
   uint32_t  m_fileSize;      // file size in bytes
   uint32_t  m_firstCluster;  // first cluster of file
+#if FILE_EXTENT_CACHE_SIZE
+  // runs of the chain from the first cluster on, filled in as they're found
+  FatExtent_t m_extent[FILE_EXTENT_CACHE_SIZE];
+  uint8_t   m_extentCount;
+#endif  // FILE_EXTENT_CACHE_SIZE
 };
 #endif  // SdBaseFile_h
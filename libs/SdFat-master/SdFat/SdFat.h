@@ -36,6 +36,7 @@
 #endif  // ARDUINO < 100
 //------------------------------------------------------------------------------
 #include <SdFile.h>
+#include <SdTrace.h>
 #include <SdStream.h>
 #include <StdioStream.h>
 #include <ArduinoStream.h>
@@ -82,6 +82,18 @@
  */
 #define FAT12_SUPPORT 0
 //------------------------------------------------------------------------------
+/**
+ * Set SD_TRACE_SIZE nonzero to record the last SD_TRACE_SIZE card commands
+ * and block cache misses and write backs in a ring in RAM, with their start
+ * and end micros(), for sdTraceDump() to write out.  See SdTrace.h.
+ *
+ * Each entry costs 13 bytes of SRAM.  With SD_TRACE_SIZE zero the trace
+ * hooks compile to nothing.
+ */
+#ifndef SD_TRACE_SIZE
+#define SD_TRACE_SIZE 0
+#endif  // SD_TRACE_SIZE
+//------------------------------------------------------------------------------
 /**
  * Set ENABLE_SPI_TRANSACTION nonzero to enable the SPI transaction feature
  * of the standard Arduino SPI library.  You must include SPI.h in your
@@ -202,4 +214,32 @@ const uint8_t SPI_SCK_INIT_DIVISOR = 128;
 #else  // RAMEND
 #define USE_MULTI_BLOCK_SD_IO 1
 #endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set FILE_EXTENT_CACHE_SIZE to the number of runs of consecutive clusters
+ * each open file remembers from its FAT chain.  Seeks then find their
+ * cluster without walking the FAT, and multi-block reads and writes carry
+ * on across cluster boundaries for as long as the run lasts.
+ *
+ * Each run costs 12 bytes of SRAM per file, more than an ATmega328 can
+ * spare, so the cache is compiled out on boards with RAMEND < 3000.  The
+ * OpenLog is one of them: its logs get none of this.  utils/Makefile's
+ * logger target builds the host tools that way too.
+ */
+#if defined(RAMEND) && RAMEND < 3000
+#define FILE_EXTENT_CACHE_SIZE 0
+#else  // RAMEND
+#define FILE_EXTENT_CACHE_SIZE 8
+#endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set SD_ERASE_MAX_BLOCKS to the most blocks SdVolume erases with one card
+ * erase command when setEraseFreed() is on, until setEraseMaxBlocks() says
+ * otherwise.  Longer runs of free clusters are erased a piece at a time, so
+ * no one command keeps the card busy for long.  Pieces are rounded down to
+ * whole erase groups, and are never less than one group.
+ */
+#ifndef SD_ERASE_MAX_BLOCKS
+#define SD_ERASE_MAX_BLOCKS 128
+#endif  // SD_ERASE_MAX_BLOCKS
 #endif  // SdFatConfig_h
@@ -0,0 +1,87 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2012 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <SdTrace.h>
+#if SD_TRACE_SIZE
+//------------------------------------------------------------------------------
+struct sdTraceEntry_t {
+  uint8_t op;
+  uint32_t block;
+  uint32_t start;
+  uint32_t end;
+};
+static sdTraceEntry_t traceRing[SD_TRACE_SIZE];
+static uint16_t traceNext;   // entry to write next
+static uint16_t traceCount;  // entries in the ring
+static bool tracePaused;     // don't trace sdTraceDump() writing to a file
+//------------------------------------------------------------------------------
+/** Empty the trace ring. */
+void sdTraceClear() {
+  traceNext = 0;
+  traceCount = 0;
+}
+//------------------------------------------------------------------------------
+// little-endian, whatever the host
+static void dumpU32(Print* pr, uint32_t v) {
+  uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16),
+                  (uint8_t)(v >> 24)};
+  pr->write(b, 4);
+}
+//------------------------------------------------------------------------------
+/** Write the trace ring out in the format described in SdTrace.h.
+ *
+ * Tracing is paused meanwhile, so \a pr may be a file on the card.
+ *
+ * \param[in] pr Print stream to write the trace to.
+ */
+void sdTraceDump(Print* pr) {
+  uint8_t header[7] = {'S', 'D', 'T', 'R', 1, (uint8_t)traceCount,
+                       (uint8_t)(traceCount >> 8)};
+  uint16_t i = (traceNext + SD_TRACE_SIZE - traceCount) % SD_TRACE_SIZE;
+
+  tracePaused = true;
+  pr->write(header, sizeof(header));
+  for (uint16_t n = 0; n < traceCount; n++) {
+    pr->write(traceRing[i].op);
+    dumpU32(pr, traceRing[i].block);
+    dumpU32(pr, traceRing[i].start);
+    dumpU32(pr, traceRing[i].end);
+    if (++i == SD_TRACE_SIZE) i = 0;
+  }
+  tracePaused = false;
+}
+//------------------------------------------------------------------------------
+/** Add an operation that has just finished to the trace ring, overwriting
+ * the oldest entry if it is full.  Called by SdTraceScope.
+ *
+ * \param[in] op One of the SD_TRACE_ operations.
+ * \param[in] block Block number the operation was on.
+ * \param[in] start micros() when the operation started.
+ */
+void sdTraceRecord(uint8_t op, uint32_t block, uint32_t start) {
+  if (tracePaused) return;
+  sdTraceEntry_t* pe = &traceRing[traceNext];
+  pe->op = op;
+  pe->block = block;
+  pe->start = start;
+  pe->end = micros();
+  if (++traceNext == SD_TRACE_SIZE) traceNext = 0;
+  if (traceCount < SD_TRACE_SIZE) traceCount++;
+}
+#endif  // SD_TRACE_SIZE
@@ -0,0 +1,105 @@
+/* Arduino SdFat Library
+ * Copyright (C) 2012 by William Greiman
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef SdTrace_h
+#define SdTrace_h
+/**
+ * \file
+ * \brief Binary trace of card commands and block cache traffic
+ *
+ * With SD_TRACE_SIZE nonzero, Sd2Card records each command and SdVolume
+ * each block cache miss and write back in a ring of the last SD_TRACE_SIZE
+ * operations.  sdTraceDump() writes the ring out, oldest first, as:
+ *
+ *   "SDTR"      magic
+ *   uint8_t     format version, 1
+ *   uint16_t    number of entries
+ *
+ * then for each entry:
+ *
+ *   uint8_t     operation, one of the SD_TRACE_ values below
+ *   uint32_t    block number, or 0 for SD_TRACE_READ_DATA and
+ *               SD_TRACE_WRITE_DATA, which carry on from the last start
+ *   uint32_t    micros() when the operation started
+ *   uint32_t    micros() when it finished
+ *
+ * all little-endian.  Operations nest: a cache miss contains the read that
+ * fills the cache, so entries are in order of finishing.  utils/src/sd_trace.c
+ * decodes the dump.
+ */
+#include <Arduino.h>
+#include <SdFatConfig.h>
+//------------------------------------------------------------------------------
+// card commands
+/** CMD17 single block read */
+uint8_t const SD_TRACE_READ_BLOCK = 0X01;
+/** CMD18 start of a multi-block read */
+uint8_t const SD_TRACE_READ_START = 0X02;
+/** one block of a multi-block read */
+uint8_t const SD_TRACE_READ_DATA = 0X03;
+/** CMD12 end of a multi-block read */
+uint8_t const SD_TRACE_READ_STOP = 0X04;
+/** CMD24 single block write */
+uint8_t const SD_TRACE_WRITE_BLOCK = 0X05;
+/** CMD25 start of a multi-block write */
+uint8_t const SD_TRACE_WRITE_START = 0X06;
+/** one block of a multi-block write */
+uint8_t const SD_TRACE_WRITE_DATA = 0X07;
+/** stop token ending a multi-block write */
+uint8_t const SD_TRACE_WRITE_STOP = 0X08;
+/** CMD32, CMD33 and CMD38 erase, from the block given */
+uint8_t const SD_TRACE_ERASE = 0X09;
+// block cache
+/** data or directory block read into the cache */
+uint8_t const SD_TRACE_CACHE_READ_DATA = 0X10;
+/** FAT block read into the cache */
+uint8_t const SD_TRACE_CACHE_READ_FAT = 0X11;
+/** dirty data or directory block written back */
+uint8_t const SD_TRACE_CACHE_WRITE_DATA = 0X12;
+/** dirty FAT block written back, to every FAT */
+uint8_t const SD_TRACE_CACHE_WRITE_FAT = 0X13;
+//------------------------------------------------------------------------------
+#if SD_TRACE_SIZE
+void sdTraceClear();
+void sdTraceDump(Print* pr);
+void sdTraceRecord(uint8_t op, uint32_t block, uint32_t start);
+/**
+ * \class SdTraceScope
+ * \brief Records an operation from its construction to its destruction.
+ */
+class SdTraceScope {
+ public:
+  /** Start timing an operation
+   * \param[in] op One of the SD_TRACE_ operations.
+   * \param[in] block Block number the operation is on.
+   */
+  SdTraceScope(uint8_t op, uint32_t block)
+    : m_op(op), m_block(block), m_start(micros()) {}
+  ~SdTraceScope() {sdTraceRecord(m_op, m_block, m_start);}
+ private:
+  uint8_t m_op;
+  uint32_t m_block;
+  uint32_t m_start;
+};
+/** Record the enclosing block as a traced operation */
+#define SD_TRACE(op, block) SdTraceScope sdTraceScope(op, block)
+#else  // SD_TRACE_SIZE
+#define SD_TRACE(op, block)
+#endif  // SD_TRACE_SIZE
+#endif  // SdTrace_h
@@ -32,8 +32,86 @@ uint32_t SdVolume::m_cacheFatBlockNumber;  // current Fat block number
 uint8_t  SdVolume::m_cacheFatStatus;       // status of cache Fatblock
 #endif  // USE_SEPARATE_FAT_CACHE
 Sd2Card* SdVolume::m_sdCard;            // pointer to SD card object
+SdBaseFile* SdVolume::m_cacheAppendFile;  // file appending to the cached block
+uint32_t SdVolume::m_cacheAppendBlock;    // block that file is appending to
+bool     SdVolume::m_streaming;           // a multi-block read is open
+uint32_t SdVolume::m_streamBlock;         // block after the last one streamed
 #endif  // USE_MULTIPLE_CARDS
+//==============================================================================
+// FAT block scan kernels.  These work through a whole cached FAT16 or FAT32
+// block so fatGet()'s bounds checks and cache lookup are paid once per block
+// rather than once per entry.
 //------------------------------------------------------------------------------
+// Count the free entries among the first n of a FAT block.  The loops are
+// simple enough for the host compiler to turn into vector compares.
+static uint16_t fatBlockCountFree(const cache_t* pc, uint8_t fatType,
+                                  uint16_t n) {
+  uint16_t free = 0;
+  if (fatType == 16) {
+    for (uint16_t i = 0; i < n; i++) {
+      if (pc->fat16[i] == 0) free++;
+    }
+  } else {
+    for (uint16_t i = 0; i < n; i++) {
+      if ((pc->fat32[i] & FAT32MASK) == 0) free++;
+    }
+  }
+  return free;
+}
+//------------------------------------------------------------------------------
+#ifndef __AVR__
+// Lanes of w that are zero, as the high bit of each lane, where low masks all
+// but the high bit of every lane.  There are no carries between lanes.
+static inline uint64_t fatZeroLanes(uint64_t w, uint64_t low) {
+  return ~(((w & low) + low) | w) & ~low;
+}
+#endif  // __AVR__
+//------------------------------------------------------------------------------
+// Index of the first entry from index up to end of a FAT block that isn't
+// free, or with free false that is free.  Returns end if there isn't one.
+// AVR has no wide registers to gain from so it just walks a pointer.
+// Elsewhere four FAT16 or two FAT32 entries are tested at a time.
+static uint16_t fatBlockSkip(const cache_t* pc, uint8_t fatType,
+                             uint16_t index, uint16_t end, bool free) {
+#ifndef __AVR__
+  const uint64_t LOW16 = 0X7FFF7FFF7FFF7FFFULL;
+  const uint64_t LOW32 = 0X7FFFFFFF7FFFFFFFULL;
+  uint64_t w;
+  // stop at the word with the change in it and leave it to the loops below
+  if (fatType == 16) {
+    for (; index + 4 <= end; index += 4) {
+      memcpy(&w, &pc->fat16[index], sizeof(w));
+      if (free ? w != 0 : fatZeroLanes(w, LOW16) != 0) break;
+    }
+  } else {
+    for (; index + 2 <= end; index += 2) {
+      memcpy(&w, &pc->fat32[index], sizeof(w));
+      w &= 0X0FFFFFFF0FFFFFFFULL;
+      if (free ? w != 0 : fatZeroLanes(w, LOW32) != 0) break;
+    }
+  }
+#endif  // __AVR__
+  if (fatType == 16) {
+    const uint16_t* p = &pc->fat16[index];
+    const uint16_t* pEnd = &pc->fat16[end];
+    if (free) {
+      while (p < pEnd && *p == 0) p++;
+    } else {
+      while (p < pEnd && *p != 0) p++;
+    }
+    return p - pc->fat16;
+  } else {
+    const uint32_t* p = &pc->fat32[index];
+    const uint32_t* pEnd = &pc->fat32[end];
+    if (free) {
+      while (p < pEnd && (*p & FAT32MASK) == 0) p++;
+    } else {
+      while (p < pEnd && (*p & FAT32MASK) != 0) p++;
+    }
+    return p - pc->fat32;
+  }
+}
+//==============================================================================
 // find a contiguous group of clusters
 bool SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // start of group
@@ -63,10 +141,16 @@ bool SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // end of group
   endCluster = bgnCluster;
 
-  // search the FAT for free clusters
-  for (uint32_t n = 0;; n++, endCluster++) {
+  // search the FAT for free clusters, a run of entries at a time
+  for (uint32_t n = 0;;) {
     // can't find space checked all clusters
     if (n >= m_clusterCount) {
+      if (!cacheStreamStop()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // space in a chain still waiting for freeChainStep() is left for the
+      // caller to free when it has time
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -74,22 +158,42 @@ bool SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
     if (endCluster > fatEnd) {
       bgnCluster = endCluster = 2;
     }
-    uint32_t f;
-    if (!fatGet(endCluster, &f)) {
+    // don't scan past the end of the FAT or any cluster twice
+    uint32_t max = fatEnd + 1 - endCluster;
+    if (max > m_clusterCount - n) max = m_clusterCount - n;
+
+    int16_t run = fatScan(endCluster, max, true);
+    if (run < 0) {
       DBG_FAIL_MACRO;
       goto fail;
     }
+    if ((endCluster - bgnCluster + run) >= count) {
+      // done - found space
+      endCluster = bgnCluster + count - 1;
+      break;
+    }
+    endCluster += run;
+    n += run;
+    if (n >= m_clusterCount || endCluster > fatEnd) continue;
 
-    if (f != 0) {
+    run = fatScan(endCluster, max - run, false);
+    if (run < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (run) {
       // don't update search start if unallocated clusters before endCluster.
       if (bgnCluster != endCluster) setStart = false;
-      // cluster in use try next cluster as bgnCluster
-      bgnCluster = endCluster + 1;
-    } else if ((endCluster - bgnCluster + 1) == count) {
-      // done - found space
-      break;
+      // clusters in use try the one after them as bgnCluster
+      endCluster += run;
+      n += run;
+      bgnCluster = endCluster;
     }
   }
+  if (!cacheStreamStop()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
   // remember possible next free cluster
   if (setStart) m_allocSearchStart = endCluster + 1;
 
@@ -118,6 +222,7 @@ bool SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   return true;
 
  fail:
+  cacheStreamStop();
   return false;
 }
 //==============================================================================
@@ -135,7 +240,9 @@ cache_t* SdVolume::cacheFetchData(uint32_t blockNumber, uint8_t options) {
       goto fail;
     }
     if (!(options & CACHE_OPTION_NO_READ)) {
-      if (!m_sdCard->readBlock(blockNumber, m_cacheBuffer.data)) {
+      SD_TRACE(SD_TRACE_CACHE_READ_DATA, blockNumber);
+      if (!cacheStreamStop()
+        || !m_sdCard->readBlock(blockNumber, m_cacheBuffer.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
@@ -157,7 +264,9 @@ cache_t* SdVolume::cacheFetchFat(uint32_t blockNumber, uint8_t options) {
       goto fail;
     }
     if (!(options & CACHE_OPTION_NO_READ)) {
-      if (!m_sdCard->readBlock(blockNumber, m_cacheFatBuffer.data)) {
+      SD_TRACE(SD_TRACE_CACHE_READ_FAT, blockNumber);
+      if (!cacheStreamStop()
+        || !m_sdCard->readBlock(blockNumber, m_cacheFatBuffer.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
@@ -178,7 +287,9 @@ bool SdVolume::cacheSync() {
 //------------------------------------------------------------------------------
 bool SdVolume::cacheWriteData() {
   if (m_cacheStatus & CACHE_STATUS_DIRTY) {
-    if (!m_sdCard->writeBlock(m_cacheBlockNumber, m_cacheBuffer.data)) {
+    SD_TRACE(SD_TRACE_CACHE_WRITE_DATA, m_cacheBlockNumber);
+    if (!cacheStreamStop()
+      || !m_sdCard->writeBlock(m_cacheBlockNumber, m_cacheBuffer.data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -192,7 +303,9 @@ bool SdVolume::cacheWriteData() {
 //------------------------------------------------------------------------------
 bool SdVolume::cacheWriteFat() {
   if (m_cacheFatStatus & CACHE_STATUS_DIRTY) {
-    if (!m_sdCard->writeBlock(m_cacheFatBlockNumber, m_cacheFatBuffer.data)) {
+    SD_TRACE(SD_TRACE_CACHE_WRITE_FAT, m_cacheFatBlockNumber);
+    if (!cacheStreamStop()
+      || !m_sdCard->writeBlock(m_cacheFatBlockNumber, m_cacheFatBuffer.data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -220,7 +333,10 @@ cache_t* SdVolume::cacheFetch(uint32_t blockNumber, uint8_t options) {
       goto fail;
     }
     if (!(options & CACHE_OPTION_NO_READ)) {
-      if (!m_sdCard->readBlock(blockNumber, m_cacheBuffer.data)) {
+      SD_TRACE(options & CACHE_STATUS_FAT_BLOCK ? SD_TRACE_CACHE_READ_FAT
+               : SD_TRACE_CACHE_READ_DATA, blockNumber);
+      if (!cacheStreamStop()
+        || !m_sdCard->readBlock(blockNumber, m_cacheBuffer.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
@@ -241,7 +357,10 @@ cache_t* SdVolume::cacheFetchFat(uint32_t blockNumber, uint8_t options) {
 //------------------------------------------------------------------------------
 bool SdVolume::cacheSync() {
   if (m_cacheStatus & CACHE_STATUS_DIRTY) {
-    if (!m_sdCard->writeBlock(m_cacheBlockNumber, m_cacheBuffer.data)) {
+    SD_TRACE(m_cacheStatus & CACHE_STATUS_FAT_BLOCK ? SD_TRACE_CACHE_WRITE_FAT
+             : SD_TRACE_CACHE_WRITE_DATA, m_cacheBlockNumber);
+    if (!cacheStreamStop()
+      || !m_sdCard->writeBlock(m_cacheBlockNumber, m_cacheBuffer.data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -270,6 +389,92 @@ void SdVolume::cacheInvalidate() {
     m_cacheBlockNumber = 0XFFFFFFFF;
     m_cacheStatus = 0;
 }
+//------------------------------------------------------------------------------
+// Fetch a block for a sequential read into the data cache, or the FAT cache
+// if fat is true.  Blocks that aren't already in the cache are delivered by
+// streamRead(), so a scan or a file read that keeps asking for the next
+// block costs one multi-block read instead of a read command for each block,
+// and one that only wants a single block costs a single-block read.
+cache_t* SdVolume::cacheFetchStream(uint32_t blockNumber, bool fat) {
+#if USE_SEPARATE_FAT_CACHE
+  cache_t* pc = fat ? &m_cacheFatBuffer : &m_cacheBuffer;
+  uint32_t* pcBlockNumber = fat ? &m_cacheFatBlockNumber : &m_cacheBlockNumber;
+  uint8_t* pcStatus = fat ? &m_cacheFatStatus : &m_cacheStatus;
+#else  // USE_SEPARATE_FAT_CACHE
+  cache_t* pc = &m_cacheBuffer;
+  uint32_t* pcBlockNumber = &m_cacheBlockNumber;
+  uint8_t* pcStatus = &m_cacheStatus;
+#endif  // USE_SEPARATE_FAT_CACHE
+  if (*pcBlockNumber == blockNumber) return pc;
+  // the stream overwrites the cache, write it back first
+#if USE_SEPARATE_FAT_CACHE
+  if (!(fat ? cacheWriteFat() : cacheWriteData())) {
+#else  // USE_SEPARATE_FAT_CACHE
+  if (!cacheSync()) {
+#endif  // USE_SEPARATE_FAT_CACHE
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  *pcBlockNumber = 0XFFFFFFFF;
+  {
+    SD_TRACE(fat ? SD_TRACE_CACHE_READ_FAT : SD_TRACE_CACHE_READ_DATA,
+             blockNumber);
+    if (!streamRead(blockNumber, pc->data)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  *pcBlockNumber = blockNumber;
+  // flag a FAT block as cacheFetchFat() would, so a write back mirrors it
+  *pcStatus = fat ? CACHE_STATUS_FAT_BLOCK : 0;
+  return pc;
+
+ fail:
+  return 0;
+}
+//------------------------------------------------------------------------------
+// End the multi-block read left open by streamRead().  Everything else that
+// sends the card a command calls this first, so the next streamRead() is
+// taken as the start of a new sequence.
+bool SdVolume::cacheStreamStop() {
+  m_streamBlock = 0XFFFFFFFF;
+  if (!m_streaming) return true;
+  m_streaming = false;
+  return m_sdCard->readStop();
+}
+//------------------------------------------------------------------------------
+// Read a block with a multi-block read that is left open after it, and carry
+// on with the open read if it's already at this block.  A block that doesn't
+// follow the one streamRead() last read, with no other command in between,
+// is read on its own, so the multi-block read only starts once a second
+// block in a row is wanted.
+bool SdVolume::streamRead(uint32_t blockNumber, uint8_t* dst) {
+  if (m_streamBlock != blockNumber) {
+    if (!cacheStreamStop() || !m_sdCard->readBlock(blockNumber, dst)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    m_streamBlock = blockNumber + 1;
+    return true;
+  }
+  if (!m_streaming) {
+    if (!m_sdCard->readStart(blockNumber)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    m_streaming = true;
+  }
+  m_streamBlock = 0XFFFFFFFF;
+  if (!m_sdCard->readData(dst)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_streamBlock = blockNumber + 1;
+  return true;
+
+ fail:
+  return false;
+}
 //==============================================================================
 //------------------------------------------------------------------------------
 uint32_t SdVolume::clusterStartBlock(uint32_t cluster) const {
@@ -333,6 +538,51 @@ bool SdVolume::fatGet(uint32_t cluster, uint32_t* value) {
   return false;
 }
 //------------------------------------------------------------------------------
+// Count the entries from cluster on that are free, or with free false in use,
+// stopping after max entries or at the end of cluster's FAT block.  Blocks
+// are fetched as part of a sequential scan, see cacheFetchStream().
+// Returns -1 for an error.
+int16_t SdVolume::fatScan(uint32_t cluster, uint32_t max, bool free) {
+  cache_t* pc;
+  uint16_t index;
+  uint16_t end;
+  // error if reserved cluster of beyond FAT
+  if (cluster < 2  || cluster > (m_clusterCount + 1)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (FAT12_SUPPORT && m_fatType == 12) {
+    // FAT12 entries can straddle blocks, take them one at a time
+    uint32_t f;
+    if (!cacheStreamStop() || !fatGet(cluster, &f)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    return (f == 0) == free;
+  }
+  if (m_fatType == 16) {
+    pc = cacheFetchStream(m_fatStartBlock + (cluster >> 8), true);
+    index = cluster & 0XFF;
+    end = 256;
+  } else if (m_fatType == 32) {
+    pc = cacheFetchStream(m_fatStartBlock + (cluster >> 7), true);
+    index = cluster & 0X7F;
+    end = 128;
+  } else {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!pc) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (max < (uint32_t)(end - index)) end = index + max;
+  return fatBlockSkip(pc, m_fatType, index, end, free) - index;
+
+ fail:
+  return -1;
+}
+//------------------------------------------------------------------------------
 // Store a FAT entry
 bool SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba;
@@ -400,7 +650,120 @@ bool SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   return false;
 }
 //------------------------------------------------------------------------------
-// free a cluster chain
+// Erase the blocks of clusters first to last, as much of them as fills whole
+// erase groups of the card, with at most m_eraseMaxBlocks in each erase
+// command.  If the card won't erase, stop erasing freed clusters rather than
+// fail every time.
+bool SdVolume::eraseClusters(uint32_t first, uint32_t last) {
+  uint16_t max;
+  uint32_t bgn = clusterStartBlock(first);
+  uint32_t end = clusterStartBlock(last) + m_blocksPerCluster;
+  bgn = (bgn + m_eraseMask) & ~(uint32_t)m_eraseMask;
+  end &= ~(uint32_t)m_eraseMask;
+  if (bgn >= end) return true;
+  // the cached block would be written back over the erased ones
+  if (m_cacheBlockNumber >= bgn && m_cacheBlockNumber < end) {
+    cacheInvalidate();
+  }
+  if (!cacheStreamStop()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // whole erase groups in each piece
+  if (m_eraseMaxBlocks > m_eraseMask) {
+    max = m_eraseMaxBlocks & ~(uint16_t)m_eraseMask;
+  } else {
+    max = m_eraseMask + 1;
+  }
+  while (bgn < end) {
+    uint32_t n = end - bgn;
+    if (n > max) n = max;
+    if (!m_sdCard->erase(bgn, bgn + n - 1)) {
+      m_eraseFreed = false;
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    bgn += n;
+  }
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+/** Erase runs of free clusters a step at a time, so free space that still
+ * holds the data of files deleted before setEraseFreed() was turned on, or
+ * by another device, stops slowing down writes to the card.
+ *
+ * \param[in,out] cluster Cluster to start from.  Set to where the next
+ * step should carry on, which wraps back to the start of the FAT.
+ * \param[in] maxClusters Largest number of FAT entries to look at.
+ *
+ * \return Count of free clusters passed over for success or -1 if an
+ * error occurs or setEraseFreed() is off.
+ */
+int32_t SdVolume::eraseFreeStep(uint32_t* cluster, uint32_t maxClusters) {
+  int32_t erased = 0;
+  uint32_t runStart = 0;
+  uint32_t fatEnd = m_clusterCount + 1;
+
+  if (!m_eraseFreed) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  while (maxClusters) {
+    if (*cluster < 2 || *cluster > fatEnd) {
+      if (runStart && !eraseClusters(runStart, fatEnd)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      runStart = 0;
+      *cluster = 2;
+    }
+    uint32_t max = fatEnd + 1 - *cluster;
+    if (max > maxClusters) max = maxClusters;
+
+    int16_t run = fatScan(*cluster, max, true);
+    if (run < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (run) {
+      // free run may carry on in the next FAT block
+      if (!runStart) runStart = *cluster;
+      erased += run;
+    } else {
+      if (runStart && !eraseClusters(runStart, *cluster - 1)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      runStart = 0;
+      run = fatScan(*cluster, max, false);
+      if (run < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+    *cluster += run;
+    maxClusters -= run;
+  }
+  if (runStart && !eraseClusters(runStart, *cluster - 1)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!cacheStreamStop()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return erased;
+
+ fail:
+  cacheStreamStop();
+  return -1;
+}
+//------------------------------------------------------------------------------
+// free a cluster chain, leaving erasing to the steps of freeChainStep() and
+// eraseFreeStep() the caller can fit around its other work
 bool SdVolume::freeChain(uint32_t cluster) {
   uint32_t next;
 
@@ -424,6 +787,64 @@ bool SdVolume::freeChain(uint32_t cluster) {
   return false;
 }
 //------------------------------------------------------------------------------
+// hand a cluster chain to freeChainStep(), fail if a chain is already there
+bool SdVolume::freeChainLater(uint32_t cluster) {
+  if (m_freeCursor) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_freeCursor = cluster;
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+/** Free part of the cluster chain left by SdBaseFile::removeDeferred().
+ *
+ * The chain is freed from its first cluster on, so if power is lost
+ * part way through, what remains is a lost chain rather than damage to
+ * any file.  The FAT block cache is not written back to the card until
+ * it is next needed or the cache is synced.
+ *
+ * \param[in] maxClusters Largest number of clusters to free in this call.
+ * \param[in] erase Set false to leave the clusters unerased even if
+ * setEraseFreed() is on, when the step can't wait for the card to erase.
+ *
+ * \return Count of clusters freed for success or -1 if an error occurs.
+ * Call freeChainPending() to find out if there is more to do.
+ */
+int32_t SdVolume::freeChainStep(uint32_t maxClusters, bool erase) {
+  int32_t freed = 0;
+  uint32_t next;
+  uint32_t runStart = m_freeCursor;
+
+  while (m_freeCursor && maxClusters--) {
+    if (!fatGet(m_freeCursor, &next)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (!fatPut(m_freeCursor, 0)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (m_freeCursor < m_allocSearchStart) m_allocSearchStart = m_freeCursor;
+    freed++;
+    // erase each contiguous run, and the part of one this step ends in
+    if (erase && m_eraseFreed && (next != m_freeCursor + 1 || !maxClusters)) {
+      eraseClusters(runStart, m_freeCursor);
+      runStart = next;
+    }
+    m_freeCursor = isEOC(next) ? 0 : next;
+  }
+  return freed;
+
+ fail:
+  // don't keep failing on the same cluster
+  m_freeCursor = 0;
+  return -1;
+}
+//------------------------------------------------------------------------------
 /** Volume free space in clusters.
  *
  * \return Count of free clusters for success or -1 if an error occurs.
@@ -446,24 +867,20 @@ int32_t SdVolume::freeClusterCount() {
   } else if (m_fatType == 16 || m_fatType == 32) {
     lba = m_fatStartBlock;
     while (todo) {
-      cache_t* pc = cacheFetchFat(lba++, CACHE_FOR_READ);
+      cache_t* pc = cacheFetchStream(lba++, true);
       if (!pc) {
         DBG_FAIL_MACRO;
         goto fail;
       }
       n = m_fatType == 16 ? 256 : 128;
       if (todo < n) n = todo;
-      if (m_fatType == 16) {
-        for (uint16_t i = 0; i < n; i++) {
-          if (pc->fat16[i] == 0) free++;
-        }
-      } else {
-        for (uint16_t i = 0; i < n; i++) {
-          if (pc->fat32[i] == 0) free++;
-        }
-      }
+      free += fatBlockCountFree(pc, m_fatType, n);
       todo -= n;
     }
+    if (!cacheStreamStop()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
   } else {
     // invalid FAT type
     DBG_FAIL_MACRO;
@@ -472,6 +889,7 @@ int32_t SdVolume::freeClusterCount() {
   return free;
 
  fail:
+  cacheStreamStop();
   return -1;
 }
 //------------------------------------------------------------------------------
@@ -498,6 +916,9 @@ bool SdVolume::init(Sd2Card* dev, uint8_t part) {
   m_sdCard = dev;
   m_fatType = 0;
   m_allocSearchStart = 2;
+  m_freeCursor = 0;
+  m_streaming = false;
+  m_streamBlock = 0XFFFFFFFF;
   m_cacheStatus = 0;  // cacheSync() will write block if true
   m_cacheBlockNumber = 0XFFFFFFFF;
 #if USE_SEPARATE_FAT_CACHE
@@ -593,3 +1014,49 @@ bool SdVolume::init(Sd2Card* dev, uint8_t part) {
  fail:
   return false;
 }
+//------------------------------------------------------------------------------
+/** Erase clusters on the card as freeChainStep() frees them, and let
+ * eraseFreeStep() erase free space, so the card's controller knows their
+ * data is stale and doesn't have to keep copying it about.
+ * Cards that fall back to garbage collection once every block has been
+ * written then keep writing close to the speed they did when new.
+ *
+ * Only whole erase groups are erased, a block at a time if the card has
+ * eraseSingleBlockEnable(), so a little of each run may be left as it was.
+ * Call again after init() with a different card.
+ *
+ * \param[in] enable True to erase freed clusters, false to stop.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned if the card's erase group size
+ * can't be read or isn't a power of two blocks, in which case nothing
+ * is erased.
+ */
+bool SdVolume::setEraseFreed(bool enable) {
+  csd_t csd;
+  m_eraseFreed = false;
+  if (!enable) return true;
+  if (!cacheStreamStop()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (m_sdCard->eraseSingleBlockEnable()) {
+    m_eraseMask = 0;
+  } else if (m_sdCard->readCSD(&csd)) {
+    m_eraseMask = (csd.v1.sector_size_high << 1) | csd.v1.sector_size_low;
+    // eraseClusters() rounds with a mask, so the group must be a power of two
+    if (m_eraseMask & (m_eraseMask + 1)) {
+      m_eraseMask = 0;
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  } else {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_eraseFreed = true;
+  return true;
+
+ fail:
+  return false;
+}
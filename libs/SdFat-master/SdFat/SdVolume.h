@@ -26,6 +26,7 @@
 #include <SdFatConfig.h>
 #include <Sd2Card.h>
 #include <utility/FatStructs.h>
+class SdBaseFile;
 //==============================================================================
 // SdVolume class
 /**
@@ -57,16 +58,26 @@ union cache_t {
 class SdVolume {
  public:
   /** Create an instance of SdVolume */
-  SdVolume() : m_fatType(0) {}
+  SdVolume() : m_fatType(0), m_freeCursor(0), m_eraseFreed(false),
+    m_eraseMask(0), m_eraseMaxBlocks(SD_ERASE_MAX_BLOCKS) {}
   /** Clear the cache and returns a pointer to the cache.  Used by the WaveRP
    * recorder to do raw write to the SD card.  Not for normal apps.
    * \return A pointer to the cache buffer or zero if an error occurs.
    */
   cache_t* cacheClear() {
-    if (!cacheSync()) return 0;
+    if (!cacheSync() || !cacheStreamStop()) return 0;
     m_cacheBlockNumber = 0XFFFFFFFF;
     return &m_cacheBuffer;
   }
+  /** End the multi-block read a sequential file read leaves open, so the
+   * card is idle.  Other SdFat calls that use the card end it themselves.
+   * \return true for success or false if an error occurs.
+   */
+#if USE_MULTIPLE_CARDS
+  bool cacheStreamStop();
+#else  // USE_MULTIPLE_CARDS
+  static bool cacheStreamStop();
+#endif  // USE_MULTIPLE_CARDS
   /** Initialize a FAT volume.  Try partition one first then try super
    * floppy format.
    *
@@ -79,6 +90,16 @@ class SdVolume {
    */
   bool init(Sd2Card* dev) { return init(dev, 1) ? true : init(dev, 0);}
   bool init(Sd2Card* dev, uint8_t part);
+  bool setEraseFreed(bool enable);
+  /** Set the most blocks one card erase command may cover, so the card is
+   * busy for no longer than the caller can wait.  Rounded down to whole
+   * erase groups, but never less than one group.
+   *
+   * \param[in] blocks The largest erase, SD_ERASE_MAX_BLOCKS until set.
+   */
+  void setEraseMaxBlocks(uint32_t blocks) {
+    m_eraseMaxBlocks = blocks < 0XFFFF ? blocks : 0XFFFF;
+  }
 
   // inline functions that return volume info
   /** \return The volume's cluster size in blocks. */
@@ -97,7 +118,25 @@ class SdVolume {
   uint32_t fatStartBlock() const {return m_fatStartBlock;}
   /** \return The FAT type of the volume. Values are 12, 16 or 32. */
   uint8_t fatType() const {return m_fatType;}
+  int32_t eraseFreeStep(uint32_t* cluster, uint32_t maxClusters);
+  /** \return True if freed clusters are erased, see setEraseFreed(). */
+  bool eraseFreed() const {return m_eraseFreed;}
   int32_t freeClusterCount();
+  int32_t freeChainStep(uint32_t maxClusters, bool erase = true);
+  /** \return True if a chain handed over by SdBaseFile::removeDeferred()
+   * still has clusters to be freed by freeChainStep().
+   */
+  bool freeChainPending() const {return m_freeCursor != 0;}
+  /** \return The next cluster freeChainStep() will free, or zero if no
+   * chain is pending.  init() forgets the chain, so save this first and
+   * hand it back with freeChainResume() to keep the chain from being lost.
+   */
+  uint32_t freeChainCursor() const {return m_freeCursor;}
+  /** Carry on freeing a chain after init(), see freeChainCursor().
+   *
+   * \param[in] cluster The cursor saved before init().
+   */
+  void freeChainResume(uint32_t cluster) {m_freeCursor = cluster;}
   /** \return The number of entries in the root directory for FAT16 volumes. */
   uint32_t rootDirEntryCount() const {return m_rootDirEntryCount;}
   /** \return The logical block number for the start of the root directory
@@ -130,6 +169,10 @@ class SdVolume {
   uint8_t m_fatType;             // Volume type (12, 16, OR 32).
   uint16_t m_rootDirEntryCount;  // Number of entries in FAT16 root dir.
   uint32_t m_rootDirStart;       // Start block for FAT16, cluster for FAT32.
+  uint32_t m_freeCursor;         // Next cluster of a chain freed by steps.
+  bool m_eraseFreed;             // Erase clusters as they are freed.
+  uint8_t m_eraseMask;           // Mask for blocks in a card erase group.
+  uint16_t m_eraseMaxBlocks;     // Most blocks in one card erase command.
 //------------------------------------------------------------------------------
 // block caches
 // use of static functions save a bit of flash - maybe not worth complexity
@@ -158,6 +201,10 @@ class SdVolume {
   uint32_t m_cacheFatBlockNumber;  // current Fat block number
   uint8_t  m_cacheFatStatus;       // status of cache Fatblock
 #endif  // USE_SEPARATE_FAT_CACHE
+  SdBaseFile* m_cacheAppendFile;  // file appending to the cached block
+  uint32_t m_cacheAppendBlock;    // block that file is appending to
+  bool m_streaming;               // a multi-block read is open on the card
+  uint32_t m_streamBlock;         // block after the last one streamed
 #else  // USE_MULTIPLE_CARDS
   static uint8_t m_fatCount;            // number of FATs on volume
   static uint32_t m_blocksPerFat;       // FAT size in blocks
@@ -170,47 +217,59 @@ class SdVolume {
   static uint8_t  m_cacheFatStatus;       // status of cache Fatblock
 #endif  // USE_SEPARATE_FAT_CACHE
   static Sd2Card* m_sdCard;            // Sd2Card object for cache
+  static SdBaseFile* m_cacheAppendFile;  // file appending to the cached block
+  static uint32_t m_cacheAppendBlock;    // block that file is appending to
+  static bool m_streaming;               // a multi-block read is open
+  static uint32_t m_streamBlock;         // block after the last one streamed
 #endif  // USE_MULTIPLE_CARDS
 
   cache_t *cacheAddress() {return &m_cacheBuffer;}
+  void cacheDirty() {m_cacheStatus |= CACHE_STATUS_DIRTY;}
   uint32_t cacheBlockNumber() {return m_cacheBlockNumber;}
 #if USE_MULTIPLE_CARDS
   cache_t* cacheFetch(uint32_t blockNumber, uint8_t options);
   cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options);
   cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options);
+  cache_t* cacheFetchStream(uint32_t blockNumber, bool fat);
   void cacheInvalidate();
   bool cacheSync();
   bool cacheWriteData();
   bool cacheWriteFat();
+  bool streamRead(uint32_t blockNumber, uint8_t* dst);
 #else  // USE_MULTIPLE_CARDS
   static cache_t* cacheFetch(uint32_t blockNumber, uint8_t options);
   static cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options);
   static cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options);
+  static cache_t* cacheFetchStream(uint32_t blockNumber, bool fat);
   static void cacheInvalidate();
   static bool cacheSync();
   static bool cacheWriteData();
   static bool cacheWriteFat();
+  static bool streamRead(uint32_t blockNumber, uint8_t* dst);
 #endif  // USE_MULTIPLE_CARDS
 //------------------------------------------------------------------------------
   bool allocContiguous(uint32_t count, uint32_t* curCluster);
   uint8_t blockOfCluster(uint32_t position) const {
     return (position >> 9) & m_clusterBlockMask;}
   uint32_t clusterStartBlock(uint32_t cluster) const;
+  bool eraseClusters(uint32_t first, uint32_t last);
   bool fatGet(uint32_t cluster, uint32_t* value);
   bool fatPut(uint32_t cluster, uint32_t value);
   bool fatPutEOC(uint32_t cluster) {
     return fatPut(cluster, 0x0FFFFFFF);
   }
+  int16_t fatScan(uint32_t cluster, uint32_t max, bool free);
   bool freeChain(uint32_t cluster);
+  bool freeChainLater(uint32_t cluster);
   bool isEOC(uint32_t cluster) const {
     if (FAT12_SUPPORT && m_fatType == 12) return  cluster >= FAT12EOC_MIN;
     if (m_fatType == 16) return cluster >= FAT16EOC_MIN;
     return  cluster >= FAT32EOC_MIN;
   }
   bool readBlock(uint32_t block, uint8_t* dst) {
-    return m_sdCard->readBlock(block, dst);}
+    return cacheStreamStop() && m_sdCard->readBlock(block, dst);}
   bool writeBlock(uint32_t block, const uint8_t* dst) {
-    return m_sdCard->writeBlock(block, dst);
+    return cacheStreamStop() && m_sdCard->writeBlock(block, dst);
   }
 };
 #endif  // SdVolume
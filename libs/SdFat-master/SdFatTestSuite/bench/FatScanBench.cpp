@@ -0,0 +1,282 @@
+/*
+ * FAT scan benchmark, run on the host against a card image (see utils/host).
+ *
+ * Builds a large volume whose FAT is full apart from a scattering of two
+ * cluster holes near the start and a small free run at the very end, then
+ * times the two operations that have to read the whole FAT:
+ *
+ *  - freeClusterCount()
+ *  - an allocation that fits none of the holes, so allocContiguous() has to
+ *    search from the start of the FAT to the free run at its end
+ *
+ * Both the host CPU time per scan and, for the first pass, the card commands
+ * it cost under the latency model are reported.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>
+
+#include <SdFat.h>
+
+#include "card_format.h"
+#include "card_model.h"
+
+// clusters in each of the holes left in the FAT
+const uint32_t HOLE_CLUSTERS = 2;
+// clusters left free at the end of the FAT
+const uint32_t TAIL_CLUSTERS = 16;
+// size of the allocation that has to search the whole FAT
+const uint32_t ALLOC_CLUSTERS = HOLE_CLUSTERS + 1;
+// most holes whose files, K0.BIN up, still have 8.3 names
+const int MAX_HOLES = 5000000;
+
+struct benchOptions_t {
+  int help;
+  int imageSizeMB;
+  int fatType;
+  int passes;
+  int holes;
+  const char* imageFilename;
+};
+
+benchOptions_t options = {0, 4096, 0, 20, 2000, NULL};
+
+cardLatencyModel_t cardLatency;
+
+Sd2Card card;
+SdVolume volume;
+//------------------------------------------------------------------------------
+static uint64_t hostMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+//------------------------------------------------------------------------------
+static uint32_t clusterBytes() {
+  return 512UL * volume.blocksPerCluster();
+}
+//------------------------------------------------------------------------------
+// Fill the FAT: files of HOLE_CLUSTERS with every other one deleted, then one
+// contiguous file over everything else but the last TAIL_CLUSTERS.
+static bool fillFat() {
+  SdFile root;
+  SdFile dir;
+  SdFile file;
+  char name[24];
+
+  if (!volume.init(&card) || !root.openRoot(&volume)
+    || !dir.makeDir(&root, "FRAG")) {
+    fprintf(stderr, "Couldn't open the new volume\n");
+    return false;
+  }
+  for (int i = 0; i < 2 * options.holes; i++) {
+    snprintf(name, sizeof(name), "K%d.BIN", i);
+    if (!file.createContiguous(&dir, name, HOLE_CLUSTERS * clusterBytes())) {
+      fprintf(stderr, "Couldn't create '%s'\n", name);
+      return false;
+    }
+    file.close();
+  }
+  int32_t free = volume.freeClusterCount();
+  if (free < (int32_t)TAIL_CLUSTERS + 1) {
+    fprintf(stderr, "The card is too small for %d holes\n", options.holes);
+    return false;
+  }
+  if (!file.createContiguous(&root, "FILL.BIN",
+                             (free - TAIL_CLUSTERS) * clusterBytes())) {
+    fprintf(stderr, "Couldn't create the fill file\n");
+    return false;
+  }
+  file.close();
+  for (int i = 0; i < 2 * options.holes; i += 2) {
+    snprintf(name, sizeof(name), "K%d.BIN", i);
+    if (!dir.remove(&dir, name)) {
+      fprintf(stderr, "Couldn't remove '%s'\n", name);
+      return false;
+    }
+  }
+  return root.sync() && volume.cacheClear();
+}
+//------------------------------------------------------------------------------
+static void printResult(const char* name, uint64_t hostUs, uint64_t cardUs,
+                        const cardStats_t* stats) {
+  printf("%-20s %9.1f us CPU per pass, %8llu us of card time, %u CMD17,"
+    " %u CMD18, %llu blocks read\n", name, (double)hostUs / options.passes,
+    (unsigned long long)cardUs, stats->commands[CARD_OP_READ_BLOCK],
+    stats->commands[CARD_OP_READ_START],
+    (unsigned long long)stats->blocksRead);
+}
+//------------------------------------------------------------------------------
+static bool runBenchmark() {
+  int32_t expectFree = 0;
+  uint64_t hostUs = 0;
+  uint64_t cardUs = 0;
+  cardStats_t firstStats = cardStats_t();
+
+  // freeClusterCount() from a cold cache each time
+  for (int pass = 0; pass < options.passes; pass++) {
+    if (!volume.init(&card)) return false;
+    cardModelResetStats();
+    uint64_t cardStart = cardModelMicros();
+    uint64_t start = hostMicros();
+    int32_t free = volume.freeClusterCount();
+    hostUs += hostMicros() - start;
+    if (pass == 0) {
+      cardUs = cardModelMicros() - cardStart;
+      firstStats = *cardModelStats();
+      expectFree = free;
+    }
+    if (free != expectFree || free < 0) {
+      fprintf(stderr, "freeClusterCount() failed\n");
+      return false;
+    }
+  }
+  printf("%u clusters, FAT%d, %d free\n", volume.clusterCount(),
+    volume.fatType(), expectFree);
+  printResult("freeClusterCount()", hostUs, cardUs, &firstStats);
+
+  // allocations that search from cluster 2 to the end of the FAT
+  hostUs = 0;
+  for (int pass = 0; pass < options.passes; pass++) {
+    SdFile root;
+    SdFile file;
+    if (!volume.init(&card) || !root.openRoot(&volume)) return false;
+    cardModelResetStats();
+    uint64_t cardStart = cardModelMicros();
+    uint64_t start = hostMicros();
+    bool ok = file.createContiguous(&root, "ALLOC.BIN",
+                                    ALLOC_CLUSTERS * clusterBytes());
+    hostUs += hostMicros() - start;
+    if (pass == 0) {
+      cardUs = cardModelMicros() - cardStart;
+      firstStats = *cardModelStats();
+    }
+    if (!ok || volume.clusterCount() + 1 - file.firstCluster()
+      >= TAIL_CLUSTERS) {
+      fprintf(stderr, "Allocation didn't reach the end of the FAT\n");
+      return false;
+    }
+    if (!file.remove()) return false;
+  }
+  printResult("full FAT allocation", hostUs, cardUs, &firstStats);
+  return true;
+}
+//------------------------------------------------------------------------------
+static void printUsage(const char* argv0) {
+  fprintf(stderr,
+    "FAT scan benchmark against a modelled card\n\n"
+    "Usage:\n"
+    "     %s [options]\n\n"
+    "Options:\n"
+    "   --help                 This page\n"
+    "   --card <settings>      Card latency model, see openlog_host --help\n"
+    "   --passes <num>         Times to repeat each scan (default %d)\n"
+    "   --holes <num>          Free holes to leave in the FAT (default %d)\n"
+    "   --image <filename>     Card image to use (default a temporary file), it is\n"
+    "                          always reformatted\n"
+    "   --image-size <MB>      Card image size (default %d MB)\n"
+    "   --fat <16|32>          Filesystem (default by card size)\n"
+    "\n", argv0, options.passes, options.holes, options.imageSizeMB);
+}
+//------------------------------------------------------------------------------
+static void parseCommandlineOptions(int argc, char** argv) {
+  enum {
+    SETTING_CARD = 1,
+    SETTING_PASSES,
+    SETTING_HOLES,
+    SETTING_IMAGE,
+    SETTING_IMAGE_SIZE,
+    SETTING_FAT,
+  };
+  static struct option longOptions[] = {
+    {"help", no_argument, &options.help, 1},
+    {"card", required_argument, 0, SETTING_CARD},
+    {"passes", required_argument, 0, SETTING_PASSES},
+    {"holes", required_argument, 0, SETTING_HOLES},
+    {"image", required_argument, 0, SETTING_IMAGE},
+    {"image-size", required_argument, 0, SETTING_IMAGE_SIZE},
+    {"fat", required_argument, 0, SETTING_FAT},
+    {0, 0, 0, 0}
+  };
+  int c;
+
+  while ((c = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+    switch (c) {
+      case SETTING_CARD:
+        if (!cardModelParse(optarg, &cardLatency)) {
+          fprintf(stderr, "Couldn't understand card latency settings '%s'\n",
+            optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case SETTING_PASSES:
+        options.passes = atoi(optarg);
+        break;
+      case SETTING_HOLES:
+        options.holes = atoi(optarg);
+        break;
+      case SETTING_IMAGE:
+        options.imageFilename = optarg;
+        break;
+      case SETTING_IMAGE_SIZE:
+        options.imageSizeMB = atoi(optarg);
+        break;
+      case SETTING_FAT:
+        options.fatType = atoi(optarg);
+        break;
+      case 0:
+        break;
+      default:
+        options.help = 1;
+        break;
+    }
+  }
+  if (options.passes < 1 || options.holes < 0
+    || options.holes > MAX_HOLES || options.imageSizeMB < 8
+    || (options.fatType != 0 && options.fatType != 16
+    && options.fatType != 32)) {
+    options.help = 1;
+  }
+}
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  char tempImage[] = "/tmp/fat_scan_bench_XXXXXX";
+  const char* imageFilename;
+  bool success;
+
+  cardLatency = cardLatencyIdeal;
+  parseCommandlineOptions(argc, argv);
+  if (options.help) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  imageFilename = options.imageFilename;
+  if (!imageFilename) {
+    int fd = mkstemp(tempImage);
+    if (fd == -1) {
+      fprintf(stderr, "Couldn't create a temporary card image\n");
+      return EXIT_FAILURE;
+    }
+    close(fd);
+    imageFilename = tempImage;
+  }
+  // setting the card up isn't part of the benchmark
+  cardModelConfigure(&cardLatencyIdeal, false);
+  success = Sd2Card::createImage(imageFilename,
+                                 (uint32_t)options.imageSizeMB * 2048)
+    && card.init() && formatCard(&card, options.fatType) && fillFat();
+  if (success) {
+    cardModelConfigure(&cardLatency, false);
+    cardModelPrintSettings(stdout);
+    success = runBenchmark();
+  } else {
+    fprintf(stderr, "Couldn't prepare the card image\n");
+  }
+  Sd2Card::closeImage();
+  if (!options.imageFilename) unlink(tempImage);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,390 @@
+/*
+ * SdFat throughput benchmark suite, run on the host against a card image
+ * (see utils/host).
+ *
+ * Formats the image as FAT16 then as FAT32 (or just one with --fat) and
+ * times, on each:
+ *
+ *  - appends to a new file at a range of write sizes
+ *  - writing over a contiguous file
+ *  - reading a contiguous file and one fragmented a cluster at a time
+ *  - seekSet() to random positions in each of those, and reading a byte
+ *  - freeClusterCount()
+ *  - opening files by name in a directory of many entries
+ *
+ * Each case starts from a cold cache.  Besides the host CPU time, the card
+ * commands each case costs and their time under the latency model are
+ * reported, so changes to the write and read paths can be compared by
+ * command count as well as by time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>
+
+#include <SdFat.h>
+
+#include "card_format.h"
+#include "card_model.h"
+
+// write sizes for the append cases
+const uint16_t APPEND_SIZES[] = {1, 16, 128, 512, 4096};
+// size of each read and write in the other cases
+const uint16_t IO_SIZE = 512;
+// most entries whose names, E00000.TXT up, fit the five digits
+const int MAX_ENTRIES = 100000;
+
+struct benchOptions_t {
+  int help;
+  int imageSizeMB;
+  int fatType;
+  int fileKB;
+  int entries;
+  int lookups;
+  int seeks;
+  const char* imageFilename;
+};
+
+benchOptions_t options = {0, 1024, 0, 1024, 256, 64, 200, NULL};
+
+cardLatencyModel_t cardLatency;
+
+Sd2Card card;
+SdVolume volume;
+SdFile root;
+
+uint8_t buffer[4096];
+
+uint64_t caseHostStart;
+uint64_t caseCardStart;
+//------------------------------------------------------------------------------
+static uint64_t hostMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+//------------------------------------------------------------------------------
+static uint32_t fileBytes() {
+  return (uint32_t)options.fileKB * 1024;
+}
+//------------------------------------------------------------------------------
+// repeatable random numbers for the seek positions
+static uint32_t nextRandom(uint32_t* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+//------------------------------------------------------------------------------
+static void startCase() {
+  volume.cacheClear();
+  cardModelResetStats();
+  caseCardStart = cardModelMicros();
+  caseHostStart = hostMicros();
+}
+//------------------------------------------------------------------------------
+static void endCase(const char* name, uint32_t ops) {
+  uint64_t hostUs = hostMicros() - caseHostStart;
+  uint64_t cardUs = cardModelMicros() - caseCardStart;
+  const cardStats_t* stats = cardModelStats();
+
+  printf("%-22s %8u %9.2f %10llu %6u %6u %6u %6u %6u %9llu %9llu\n", name,
+    ops, (double)hostUs / ops, (unsigned long long)cardUs,
+    stats->commands[CARD_OP_READ_BLOCK], stats->commands[CARD_OP_READ_START],
+    stats->commands[CARD_OP_WRITE_BLOCK], stats->commands[CARD_OP_WRITE_START],
+    stats->commands[CARD_OP_ERASE], (unsigned long long)stats->blocksRead,
+    (unsigned long long)stats->blocksWritten);
+}
+//------------------------------------------------------------------------------
+static bool benchAppend() {
+  char name[24];
+
+  for (size_t i = 0; i < sizeof(APPEND_SIZES) / sizeof(APPEND_SIZES[0]); i++) {
+    uint16_t size = APPEND_SIZES[i];
+    uint32_t ops = 0;
+    SdFile file;
+
+    snprintf(name, sizeof(name), "APP%u.BIN", size);
+    startCase();
+    if (!file.open(&root, name, O_CREAT | O_APPEND | O_WRITE)) return false;
+    for (uint32_t n = 0; n < fileBytes(); n += size) {
+      if (file.write(buffer, size) != size) return false;
+      ops++;
+    }
+    if (!file.close()) return false;
+    snprintf(name, sizeof(name), "append %u", size);
+    endCase(name, ops);
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// A contiguous file, and one whose clusters alternate with another's
+static bool createFiles() {
+  uint32_t clusterBytes = 512UL * volume.blocksPerCluster();
+  SdFile file;
+  SdFile other;
+
+  if (!file.createContiguous(&root, "CONTIG.BIN", fileBytes())) return false;
+  for (uint32_t n = 0; n < fileBytes(); n += IO_SIZE) {
+    if (file.write(buffer, IO_SIZE) != IO_SIZE) return false;
+  }
+  if (!file.close()) return false;
+  if (!file.open(&root, "FRAG.BIN", O_CREAT | O_WRITE)
+    || !other.open(&root, "OTHER.BIN", O_CREAT | O_WRITE)) {
+    return false;
+  }
+  for (uint32_t n = 0; n < fileBytes(); n += clusterBytes) {
+    for (uint32_t m = 0; m < clusterBytes; m += IO_SIZE) {
+      if (file.write(buffer, IO_SIZE) != IO_SIZE
+        || other.write(buffer, IO_SIZE) != IO_SIZE) {
+        return false;
+      }
+    }
+  }
+  return file.close() && other.close();
+}
+//------------------------------------------------------------------------------
+static bool benchContiguousWrite() {
+  uint32_t ops = 0;
+  SdFile file;
+
+  startCase();
+  if (!file.open(&root, "CONTIG.BIN", O_WRITE)) return false;
+  for (uint32_t n = 0; n < fileBytes(); n += IO_SIZE) {
+    if (file.write(buffer, IO_SIZE) != IO_SIZE) return false;
+    ops++;
+  }
+  if (!file.close()) return false;
+  endCase("write contiguous", ops);
+  return true;
+}
+//------------------------------------------------------------------------------
+static bool benchRead(const char* name, const char* label) {
+  uint32_t ops = 0;
+  SdFile file;
+
+  startCase();
+  if (!file.open(&root, name, O_READ)) return false;
+  while (true) {
+    int n = file.read(buffer, IO_SIZE);
+    if (n < 0) return false;
+    if (n == 0) break;
+    ops++;
+  }
+  file.close();
+  endCase(label, ops);
+  return true;
+}
+//------------------------------------------------------------------------------
+static bool benchSeek(const char* name, const char* label) {
+  uint32_t state = 12345;
+  SdFile file;
+
+  startCase();
+  if (!file.open(&root, name, O_READ)) return false;
+  for (int i = 0; i < options.seeks; i++) {
+    if (!file.seekSet(nextRandom(&state) % file.fileSize())
+      || file.read() < 0) {
+      return false;
+    }
+  }
+  file.close();
+  endCase(label, options.seeks);
+  return true;
+}
+//------------------------------------------------------------------------------
+static bool benchFreeClusterCount() {
+  startCase();
+  if (volume.freeClusterCount() < 0) return false;
+  endCase("freeClusterCount", 1);
+  return true;
+}
+//------------------------------------------------------------------------------
+static bool benchLookup() {
+  char name[24];
+  char label[32];
+  SdFile dir;
+  SdFile file;
+
+  if (!dir.makeDir(&root, "LOOKUP")) return false;
+  for (int i = 0; i < options.entries; i++) {
+    snprintf(name, sizeof(name), "E%05d.TXT", i);
+    if (!file.open(&dir, name, O_CREAT | O_WRITE) || !file.close()) {
+      return false;
+    }
+  }
+  // names spread evenly over the directory
+  startCase();
+  for (int i = 0; i < options.lookups; i++) {
+    snprintf(name, sizeof(name), "E%05d.TXT",
+      (int)((int64_t)(2 * i + 1) * options.entries / (2 * options.lookups)));
+    if (!file.open(&dir, name, O_READ)) return false;
+    file.close();
+  }
+  snprintf(label, sizeof(label), "open in %d entries", options.entries);
+  endCase(label, options.lookups);
+  return dir.close();
+}
+//------------------------------------------------------------------------------
+static bool runBenchmark(int fatType) {
+  // setting the card up isn't part of the benchmark
+  cardModelConfigure(&cardLatencyIdeal, false);
+  if (!card.init() || !formatCard(&card, fatType) || !volume.init(&card)
+    || !root.openRoot(&volume) || !createFiles() || !volume.cacheClear()) {
+    fprintf(stderr, "Couldn't prepare the card image\n");
+    return false;
+  }
+  cardModelConfigure(&cardLatency, false);
+
+  printf("\nFAT%d, %u clusters of %u bytes, %d KB files\n\n", volume.fatType(),
+    volume.clusterCount(), 512U * volume.blocksPerCluster(), options.fileKB);
+  printf("%-22s %8s %9s %10s %6s %6s %6s %6s %6s %9s %9s\n", "case", "ops",
+    "CPU us/op", "card us", "CMD17", "CMD18", "CMD24", "CMD25", "erase",
+    "blocks rd", "blocks wr");
+  bool success = benchAppend()
+    && benchContiguousWrite()
+    && benchRead("CONTIG.BIN", "read contiguous")
+    && benchRead("FRAG.BIN", "read fragmented")
+    && benchSeek("CONTIG.BIN", "seekSet contiguous")
+    && benchSeek("FRAG.BIN", "seekSet fragmented")
+    && benchFreeClusterCount()
+    && benchLookup();
+  root.close();
+  if (!success) fprintf(stderr, "FAT%d benchmark failed\n", fatType);
+  return success;
+}
+//------------------------------------------------------------------------------
+static void printUsage(const char* argv0) {
+  fprintf(stderr,
+    "SdFat throughput benchmark suite against a modelled card\n\n"
+    "Usage:\n"
+    "     %s [options]\n\n"
+    "Options:\n"
+    "   --help                 This page\n"
+    "   --card <settings>      Card latency model, see openlog_host --help\n"
+    "   --fat <16|32>          Run on just this filesystem (default both)\n"
+    "   --file-size <KB>       Size of the files written and read (default %d)\n"
+    "   --entries <num>        Directory entries for the lookup case (default %d)\n"
+    "   --lookups <num>        Files opened in the lookup case (default %d)\n"
+    "   --seeks <num>          Seeks in each seekSet case (default %d)\n"
+    "   --image <filename>     Card image to use (default a temporary file), it is\n"
+    "                          always reformatted\n"
+    "   --image-size <MB>      Card image size (default %d MB)\n"
+    "\n", argv0, options.fileKB, options.entries, options.lookups,
+    options.seeks, options.imageSizeMB);
+}
+//------------------------------------------------------------------------------
+static void parseCommandlineOptions(int argc, char** argv) {
+  enum {
+    SETTING_CARD = 1,
+    SETTING_FAT,
+    SETTING_FILE_SIZE,
+    SETTING_ENTRIES,
+    SETTING_LOOKUPS,
+    SETTING_SEEKS,
+    SETTING_IMAGE,
+    SETTING_IMAGE_SIZE,
+  };
+  static struct option longOptions[] = {
+    {"help", no_argument, &options.help, 1},
+    {"card", required_argument, 0, SETTING_CARD},
+    {"fat", required_argument, 0, SETTING_FAT},
+    {"file-size", required_argument, 0, SETTING_FILE_SIZE},
+    {"entries", required_argument, 0, SETTING_ENTRIES},
+    {"lookups", required_argument, 0, SETTING_LOOKUPS},
+    {"seeks", required_argument, 0, SETTING_SEEKS},
+    {"image", required_argument, 0, SETTING_IMAGE},
+    {"image-size", required_argument, 0, SETTING_IMAGE_SIZE},
+    {0, 0, 0, 0}
+  };
+  int c;
+
+  while ((c = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+    switch (c) {
+      case SETTING_CARD:
+        if (!cardModelParse(optarg, &cardLatency)) {
+          fprintf(stderr, "Couldn't understand card latency settings '%s'\n",
+            optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case SETTING_FAT:
+        options.fatType = atoi(optarg);
+        break;
+      case SETTING_FILE_SIZE:
+        options.fileKB = atoi(optarg);
+        break;
+      case SETTING_ENTRIES:
+        options.entries = atoi(optarg);
+        break;
+      case SETTING_LOOKUPS:
+        options.lookups = atoi(optarg);
+        break;
+      case SETTING_SEEKS:
+        options.seeks = atoi(optarg);
+        break;
+      case SETTING_IMAGE:
+        options.imageFilename = optarg;
+        break;
+      case SETTING_IMAGE_SIZE:
+        options.imageSizeMB = atoi(optarg);
+        break;
+      case 0:
+        break;
+      default:
+        options.help = 1;
+        break;
+    }
+  }
+  if (options.fileKB < 4 || options.entries < 1
+    || options.entries > MAX_ENTRIES || options.lookups < 1
+    || options.seeks < 1 || options.imageSizeMB < 8
+    || (options.fatType != 0 && options.fatType != 16
+    && options.fatType != 32)) {
+    options.help = 1;
+  }
+}
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  char tempImage[] = "/tmp/throughput_bench_XXXXXX";
+  const char* imageFilename;
+  bool success;
+
+  cardLatency = cardLatencyIdeal;
+  parseCommandlineOptions(argc, argv);
+  if (options.help) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  imageFilename = options.imageFilename;
+  if (!imageFilename) {
+    int fd = mkstemp(tempImage);
+    if (fd == -1) {
+      fprintf(stderr, "Couldn't create a temporary card image\n");
+      return EXIT_FAILURE;
+    }
+    close(fd);
+    imageFilename = tempImage;
+  }
+  for (size_t i = 0; i < sizeof(buffer); i++) buffer[i] = i * 7 + 1;
+
+  success = Sd2Card::createImage(imageFilename,
+                                 (uint32_t)options.imageSizeMB * 2048);
+  if (success) {
+    cardModelConfigure(&cardLatency, false);
+    cardModelPrintSettings(stdout);
+    if (options.fatType) {
+      success = runBenchmark(options.fatType);
+    } else {
+      success = runBenchmark(16) && runBenchmark(32);
+    }
+  } else {
+    fprintf(stderr, "Couldn't create the card image\n");
+  }
+  Sd2Card::closeImage();
+  if (!options.imageFilename) unlink(tempImage);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,317 @@
+/*
+ * Host stand-in for SdFat's Sd2Card, see include/Sd2Card.h.
+ */
+#include <Sd2Card.h>
+#include <SdTrace.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "card_model.h"
+
+// Cards above 2GB have to be SDHC
+static const uint32_t SDHC_MIN_BLOCKS = 4194304;
+
+int Sd2Card::m_imageFd = -1;
+uint32_t Sd2Card::m_imageBlocks = 0;
+//------------------------------------------------------------------------------
+bool Sd2Card::openImage(const char* path) {
+  struct stat st;
+  closeImage();
+  m_imageFd = open(path, O_RDWR);
+  if (m_imageFd < 0) return false;
+  if (fstat(m_imageFd, &st) != 0 || st.st_size < 512) {
+    closeImage();
+    return false;
+  }
+  m_imageBlocks = st.st_size / 512;
+  return true;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::createImage(const char* path, uint32_t blockCount) {
+  closeImage();
+  m_imageFd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (m_imageFd < 0) return false;
+  // Leave the image sparse, a freshly erased card reads as zeros
+  if (ftruncate(m_imageFd, (off_t) blockCount * 512) != 0) {
+    closeImage();
+    return false;
+  }
+  m_imageBlocks = blockCount;
+  return true;
+}
+//------------------------------------------------------------------------------
+void Sd2Card::closeImage() {
+  if (m_imageFd >= 0) close(m_imageFd);
+  m_imageFd = -1;
+  m_imageBlocks = 0;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::begin(uint8_t chipSelectPin, uint8_t sckDivisor) {
+  m_errorCode = m_type = 0;
+  m_status = 0;
+  m_state = STATE_IDLE;
+  m_chipSelectPin = chipSelectPin;
+  m_sckDivisor = sckDivisor;
+  if (m_imageFd < 0) {
+    // No card in the socket
+    error(SD_CARD_ERROR_CMD0);
+    return false;
+  }
+  if (!cardModelReconnect()) {
+    // Still off the bus after a dropout
+    error(SD_CARD_ERROR_CMD0);
+    return false;
+  }
+  type(m_imageBlocks > SDHC_MIN_BLOCKS ? SD_CARD_TYPE_SDHC : SD_CARD_TYPE_SD2);
+  return true;
+}
+//------------------------------------------------------------------------------
+uint32_t Sd2Card::cardSize() {
+  return m_imageFd < 0 ? 0 : m_imageBlocks;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::checkBlock(uint32_t block, uint8_t errorCode) {
+  if (m_imageFd < 0 || block >= m_imageBlocks || !cardModelOnline()) {
+    error(errorCode);
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::isIdle() {
+  // The real card would misinterpret a command sent in the middle of a multi-block transfer
+  if (m_state != STATE_IDLE) {
+    error(m_state == STATE_READ_MULTIPLE ? SD_CARD_ERROR_CMD18 : SD_CARD_ERROR_CMD25);
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::imageRead(uint32_t block, uint8_t* dst) {
+  return pread(m_imageFd, dst, 512, (off_t) block * 512) == 512;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::imageWrite(uint32_t block, const uint8_t* src) {
+  return pwrite(m_imageFd, src, 512, (off_t) block * 512) == 512;
+}
+//------------------------------------------------------------------------------
+// Store a block of data written to the card, flipped a bit if the model says so
+bool Sd2Card::imageWriteData(uint32_t block, const uint8_t* src) {
+  uint8_t stored[512];
+  int bit = cardModelWriteCorruption();
+  if (bit >= 0) {
+    memcpy(stored, src, sizeof(stored));
+    stored[bit >> 3] ^= 1 << (bit & 7);
+    src = stored;
+  }
+  return imageWrite(block, src);
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::erase(uint32_t firstBlock, uint32_t lastBlock) {
+  SD_TRACE(SD_TRACE_ERASE, firstBlock);
+  static const uint8_t zero[512] = {0};
+  if (!isIdle()) goto fail;
+  if (lastBlock < firstBlock
+    || !checkBlock(lastBlock, SD_CARD_ERROR_ERASE)) {
+    error(SD_CARD_ERROR_ERASE);
+    goto fail;
+  }
+  cardModelCommand(CARD_OP_ERASE, lastBlock - firstBlock + 1);
+  for (uint32_t b = firstBlock; b <= lastBlock; b++) {
+    if (!imageWrite(b, zero)) {
+      error(SD_CARD_ERROR_ERASE);
+      goto fail;
+    }
+  }
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::eraseSingleBlockEnable() {
+  csd_t csd;
+  return readCSD(&csd) ? csd.v1.erase_blk_en : false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::isBusy() {
+  return cardModelBusy();
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::readBlock(uint32_t blockNumber, uint8_t* dst) {
+  SD_TRACE(SD_TRACE_READ_BLOCK, blockNumber);
+  if (!isIdle()) goto fail;
+  if (!checkBlock(blockNumber, SD_CARD_ERROR_CMD17)) goto fail;
+  cardModelCommand(CARD_OP_READ_BLOCK, 1);
+  if (!imageRead(blockNumber, dst)) {
+    error(SD_CARD_ERROR_READ);
+    goto fail;
+  }
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::readCID(cid_t* cid) {
+  if (!isIdle()) return false;
+  cardModelCommand(CARD_OP_REGISTER, 0);
+  memset(cid, 0, sizeof(*cid));
+  cid->mid = 0X1D;
+  memcpy(cid->oid, "HO", 2);
+  memcpy(cid->pnm, "IMAGE", 5);
+  return true;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::readCSD(csd_t* csd) {
+  if (!isIdle()) return false;
+  if (m_imageFd < 0) {
+    error(SD_CARD_ERROR_READ_REG);
+    return false;
+  }
+  cardModelCommand(CARD_OP_REGISTER, 0);
+  memset(csd, 0, sizeof(*csd));
+  if (m_imageBlocks > SDHC_MIN_BLOCKS) {
+    uint32_t c_size = (m_imageBlocks >> 10) - 1;
+    csd->v2.csd_ver = 1;
+    csd->v2.read_bl_len = 9;
+    csd->v2.c_size_high = c_size >> 16;
+    csd->v2.c_size_mid = c_size >> 8;
+    csd->v2.c_size_low = c_size;
+    csd->v2.erase_blk_en = 1;
+    csd->v2.sector_size_high = 0X3F;
+    csd->v2.sector_size_low = 1;
+  } else {
+    // Pick the smallest block length and multiplier that fit the size in the 12-bit C_SIZE
+    uint8_t read_bl_len = 9;
+    uint8_t c_size_mult = 0;
+    while ((m_imageBlocks >> (c_size_mult + read_bl_len - 7)) > 4096) {
+      if (c_size_mult < 7) {
+        c_size_mult++;
+      } else {
+        read_bl_len++;
+      }
+    }
+    uint16_t c_size = (m_imageBlocks >> (c_size_mult + read_bl_len - 7)) - 1;
+    csd->v1.csd_ver = 0;
+    csd->v1.read_bl_len = read_bl_len;
+    csd->v1.c_size_high = c_size >> 10;
+    csd->v1.c_size_mid = c_size >> 2;
+    csd->v1.c_size_low = c_size;
+    csd->v1.c_size_mult_high = c_size_mult >> 1;
+    csd->v1.c_size_mult_low = c_size_mult;
+    csd->v1.erase_blk_en = 1;
+    csd->v1.sector_size_high = 0X3F;
+    csd->v1.sector_size_low = 1;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::readOCR(uint32_t* ocr) {
+  if (!isIdle()) return false;
+  cardModelCommand(CARD_OP_REGISTER, 0);
+  // Powered up, 3.2-3.4V, CCS set for SDHC
+  *ocr = 0X80300000 | (m_type == SD_CARD_TYPE_SDHC ? 0X40000000 : 0);
+  return true;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::readStart(uint32_t blockNumber) {
+  SD_TRACE(SD_TRACE_READ_START, blockNumber);
+  if (!isIdle()) goto fail;
+  if (!checkBlock(blockNumber, SD_CARD_ERROR_CMD18)) goto fail;
+  cardModelCommand(CARD_OP_READ_START, 0);
+  m_block = blockNumber;
+  m_state = STATE_READ_MULTIPLE;
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::readData(uint8_t *dst) {
+  SD_TRACE(SD_TRACE_READ_DATA, 0);
+  if (m_state != STATE_READ_MULTIPLE
+    || !checkBlock(m_block, SD_CARD_ERROR_READ)
+    || !imageRead(m_block, dst)) {
+    error(SD_CARD_ERROR_READ);
+    goto fail;
+  }
+  cardModelCommand(CARD_OP_READ_DATA, 1);
+  m_block++;
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::readStop() {
+  SD_TRACE(SD_TRACE_READ_STOP, 0);
+  if (m_state != STATE_READ_MULTIPLE) {
+    error(SD_CARD_ERROR_CMD12);
+    return false;
+  }
+  cardModelCommand(CARD_OP_READ_STOP, 0);
+  m_state = STATE_IDLE;
+  return true;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
+  SD_TRACE(SD_TRACE_WRITE_BLOCK, blockNumber);
+  if (!isIdle()) goto fail;
+  if (!checkBlock(blockNumber, SD_CARD_ERROR_CMD24)) goto fail;
+  cardModelCommand(CARD_OP_WRITE_BLOCK, 1);
+  if (cardModelWriteDropout() || !imageWriteData(blockNumber, src)) {
+    error(SD_CARD_ERROR_WRITE);
+    goto fail;
+  }
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
+  SD_TRACE(SD_TRACE_WRITE_START, blockNumber);
+  if (!isIdle()) goto fail;
+  if (!checkBlock(blockNumber, SD_CARD_ERROR_CMD25)) goto fail;
+  // The pre-erase count (ACMD23) is only a hint to the card
+  (void) eraseCount;
+  cardModelCommand(CARD_OP_WRITE_START, 0);
+  m_block = blockNumber;
+  m_state = STATE_WRITE_MULTIPLE;
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::writeData(const uint8_t* src) {
+  SD_TRACE(SD_TRACE_WRITE_DATA, 0);
+  if (m_state != STATE_WRITE_MULTIPLE
+    || !checkBlock(m_block, SD_CARD_ERROR_WRITE_MULTIPLE)
+    || cardModelWriteDropout()
+    || !imageWriteData(m_block, src)) {
+    error(SD_CARD_ERROR_WRITE_MULTIPLE);
+    goto fail;
+  }
+  cardModelCommand(CARD_OP_WRITE_DATA, 1);
+  m_block++;
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool Sd2Card::writeStop() {
+  SD_TRACE(SD_TRACE_WRITE_STOP, 0);
+  if (m_state != STATE_WRITE_MULTIPLE) {
+    error(SD_CARD_ERROR_STOP_TRAN);
+    return false;
+  }
+  cardModelCommand(CARD_OP_WRITE_STOP, 0);
+  m_state = STATE_IDLE;
+  return true;
+}
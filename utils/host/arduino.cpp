@@ -0,0 +1,267 @@
+/*
+ * Host implementation of the parts of the Arduino core declared in include/Arduino.h and include/EEPROM.h.
+ */
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+volatile uint8_t ADCSRA, ACSR, DIDR0, DIDR1, PORTB, PORTD, UCSR0A;
+volatile uint16_t UBRR0;
+volatile uint8_t TCCR1A, TCCR1B;
+
+EEPROMClass EEPROM;
+
+static uint8_t eepromData[HOST_EEPROM_SIZE];
+static bool eepromInitialised = false;
+static int eepromFd = -1;
+
+static uint64_t monotonicMicros(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Like the AVR, time starts at power on (the first time anybody asks)
+static uint64_t bootMicros(void)
+{
+    static uint64_t boot = 0;
+
+    if (boot == 0) {
+        boot = monotonicMicros();
+    }
+
+    return boot;
+}
+
+uint32_t millis(void)
+{
+    return (uint32_t) ((monotonicMicros() - bootMicros()) / 1000);
+}
+
+uint32_t micros(void)
+{
+    return (uint32_t) (monotonicMicros() - bootMicros());
+}
+
+uint16_t hostTimer1Count(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint16_t) (((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec) * (F_CPU / 1000000) / 1000);
+}
+
+void delay(uint32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    usleep(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void) pin;
+    (void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    (void) pin;
+    (void) val;
+}
+
+int digitalRead(uint8_t pin)
+{
+    (void) pin;
+
+    return LOW;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+
+    while (size--) {
+        n += write(*buffer++);
+    }
+
+    return n;
+}
+
+size_t Print::printNumber(unsigned long n, int base)
+{
+    char buf[8 * sizeof(long) + 1];
+    char *str = &buf[sizeof(buf) - 1];
+
+    *str = '\0';
+
+    if (base < 2) {
+        base = 10;
+    }
+
+    do {
+        unsigned long m = n;
+        n /= base;
+        char c = m - base * n;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return write(str);
+}
+
+size_t Print::print(const __FlashStringHelper *s)
+{
+    return write((const char *) s);
+}
+
+size_t Print::print(const char *s)
+{
+    return write(s);
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+    return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base == 10 && n < 0) {
+        return print('-') + printNumber(-n, 10);
+    }
+
+    return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t Print::println(void)
+{
+    return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper *s)
+{
+    return print(s) + println();
+}
+
+size_t Print::println(const char *s)
+{
+    return print(s) + println();
+}
+
+size_t Print::println(char c)
+{
+    return print(c) + println();
+}
+
+size_t Print::println(unsigned char n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned int n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(long n, int base)
+{
+    return print(n, base) + println();
+}
+
+size_t Print::println(unsigned long n, int base)
+{
+    return print(n, base) + println();
+}
+
+static void eepromInit(void)
+{
+    if (!eepromInitialised) {
+        memset(eepromData, 0xFF, sizeof(eepromData));
+        eepromInitialised = true;
+    }
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+    eepromInit();
+
+    return address >= 0 && address < HOST_EEPROM_SIZE ? eepromData[address] : 0xFF;
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    eepromInit();
+
+    if (address < 0 || address >= HOST_EEPROM_SIZE)
+        return;
+
+    eepromData[address] = value;
+
+    if (eepromFd != -1) {
+        if (pwrite(eepromFd, &value, 1, address) != 1) {
+            fprintf(stderr, "Failed to save EEPROM write\n");
+        }
+    }
+}
+
+bool EEPROMClass::attachFile(const char *filename)
+{
+    eepromInit();
+
+    eepromFd = open(filename, O_RDWR | O_CREAT, 0644);
+
+    if (eepromFd == -1)
+        return false;
+
+    ssize_t bytesRead = pread(eepromFd, eepromData, sizeof(eepromData), 0);
+
+    if (bytesRead < 0) {
+        bytesRead = 0;
+    }
+
+    // A new or short file is erased EEPROM
+    if (bytesRead < HOST_EEPROM_SIZE) {
+        memset(eepromData + bytesRead, 0xFF, HOST_EEPROM_SIZE - bytesRead);
+
+        if (pwrite(eepromFd, eepromData, sizeof(eepromData), 0) != sizeof(eepromData)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,400 @@
+/*
+ * Card formatter for the host build, ported from SdFat's SdFormatter example.
+ */
+#include <SdFat.h>
+
+#include "card_format.h"
+
+// constants for file system structure
+static uint16_t const BU16 = 128;
+static uint16_t const BU32 = 8192;
+
+//  strings needed in file system structures
+static const char noName[] = "NO NAME    ";
+static const char fat16str[] = "FAT16   ";
+static const char fat32str[] = "FAT32   ";
+
+typedef struct formatState_t {
+    Sd2Card *card;
+    uint32_t cardSizeBlocks;
+    uint32_t cardCapacityMB;
+
+    cache_t cache;
+
+    // MBR information
+    uint8_t partType;
+    uint32_t relSector;
+    uint32_t partSize;
+
+    // Fake disk geometry
+    uint8_t numberOfHeads;
+    uint8_t sectorsPerTrack;
+
+    // FAT parameters
+    uint16_t reservedSectors;
+    uint8_t sectorsPerCluster;
+    uint32_t fatStart;
+    uint32_t fatSize;
+    uint32_t dataStart;
+} formatState_t;
+
+static bool sdError(formatState_t *state, const char *msg)
+{
+    fprintf(stderr, "Format error: %s", msg);
+
+    if (state->card->errorCode()) {
+        fprintf(stderr, " (SD error 0x%X,0x%X)", state->card->errorCode(), state->card->errorData());
+    }
+
+    fprintf(stderr, "\n");
+
+    return false;
+}
+
+static bool writeCache(formatState_t *state, uint32_t lbn)
+{
+    return state->card->writeBlock(lbn, state->cache.data);
+}
+
+// initialize appropriate sizes for SD capacity
+static bool initSizes(formatState_t *state)
+{
+    uint32_t cardCapacityMB = state->cardCapacityMB;
+
+    if (cardCapacityMB <= 6) {
+        return sdError(state, "Card is too small.");
+    } else if (cardCapacityMB <= 16) {
+        state->sectorsPerCluster = 2;
+    } else if (cardCapacityMB <= 32) {
+        state->sectorsPerCluster = 4;
+    } else if (cardCapacityMB <= 64) {
+        state->sectorsPerCluster = 8;
+    } else if (cardCapacityMB <= 128) {
+        state->sectorsPerCluster = 16;
+    } else if (cardCapacityMB <= 1024) {
+        state->sectorsPerCluster = 32;
+    } else if (cardCapacityMB <= 32768) {
+        state->sectorsPerCluster = 64;
+    } else {
+        // SDXC cards
+        state->sectorsPerCluster = 128;
+    }
+
+    // set fake disk geometry
+    state->sectorsPerTrack = cardCapacityMB <= 256 ? 32 : 63;
+
+    if (cardCapacityMB <= 16) {
+        state->numberOfHeads = 2;
+    } else if (cardCapacityMB <= 32) {
+        state->numberOfHeads = 4;
+    } else if (cardCapacityMB <= 128) {
+        state->numberOfHeads = 8;
+    } else if (cardCapacityMB <= 504) {
+        state->numberOfHeads = 16;
+    } else if (cardCapacityMB <= 1008) {
+        state->numberOfHeads = 32;
+    } else if (cardCapacityMB <= 2016) {
+        state->numberOfHeads = 64;
+    } else if (cardCapacityMB <= 4032) {
+        state->numberOfHeads = 128;
+    } else {
+        state->numberOfHeads = 255;
+    }
+
+    return true;
+}
+
+// zero cache and optionally set the sector signature
+static void clearCache(formatState_t *state, uint8_t addSig)
+{
+    memset(&state->cache, 0, sizeof(state->cache));
+
+    if (addSig) {
+        state->cache.mbr.mbrSig0 = BOOTSIG0;
+        state->cache.mbr.mbrSig1 = BOOTSIG1;
+    }
+}
+
+// zero FAT and root dir area on SD
+static bool clearFatDir(formatState_t *state, uint32_t bgn, uint32_t count)
+{
+    clearCache(state, false);
+
+    if (!state->card->writeStart(bgn, count)) {
+        return sdError(state, "Clear FAT/DIR writeStart failed");
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!state->card->writeData(state->cache.data)) {
+            return sdError(state, "Clear FAT/DIR writeData failed");
+        }
+    }
+    if (!state->card->writeStop()) {
+        return sdError(state, "Clear FAT/DIR writeStop failed");
+    }
+
+    return true;
+}
+
+// return cylinder number for a logical block number
+static uint16_t lbnToCylinder(formatState_t *state, uint32_t lbn)
+{
+    return lbn / (state->numberOfHeads * state->sectorsPerTrack);
+}
+
+// return head number for a logical block number
+static uint8_t lbnToHead(formatState_t *state, uint32_t lbn)
+{
+    return (lbn % (state->numberOfHeads * state->sectorsPerTrack)) / state->sectorsPerTrack;
+}
+
+// return sector number for a logical block number
+static uint8_t lbnToSector(formatState_t *state, uint32_t lbn)
+{
+    return (lbn % state->sectorsPerTrack) + 1;
+}
+
+// format and write the Master Boot Record
+static bool writeMbr(formatState_t *state)
+{
+    clearCache(state, true);
+
+    part_t* p = state->cache.mbr.part;
+    p->boot = 0;
+    uint16_t c = lbnToCylinder(state, state->relSector);
+    if (c > 1023) {
+        return sdError(state, "MBR CHS");
+    }
+    p->beginCylinderHigh = c >> 8;
+    p->beginCylinderLow = c & 0XFF;
+    p->beginHead = lbnToHead(state, state->relSector);
+    p->beginSector = lbnToSector(state, state->relSector);
+    p->type = state->partType;
+    uint32_t endLbn = state->relSector + state->partSize - 1;
+    c = lbnToCylinder(state, endLbn);
+    if (c <= 1023) {
+        p->endCylinderHigh = c >> 8;
+        p->endCylinderLow = c & 0XFF;
+        p->endHead = lbnToHead(state, endLbn);
+        p->endSector = lbnToSector(state, endLbn);
+    } else {
+        // Too big flag, c = 1023, h = 254, s = 63
+        p->endCylinderHigh = 3;
+        p->endCylinderLow = 255;
+        p->endHead = 254;
+        p->endSector = 63;
+    }
+    p->firstSector = state->relSector;
+    p->totalSectors = state->partSize;
+
+    if (!writeCache(state, 0)) {
+        return sdError(state, "write MBR");
+    }
+
+    return true;
+}
+
+// generate serial number from card size and micros since boot
+static uint32_t volSerialNumber(formatState_t *state)
+{
+    return (state->cardSizeBlocks << 8) + micros();
+}
+
+// format the SD as FAT16
+static bool makeFat16(formatState_t *state)
+{
+    uint32_t nc;
+
+    for (state->dataStart = 2 * BU16;; state->dataStart += BU16) {
+        nc = (state->cardSizeBlocks - state->dataStart) / state->sectorsPerCluster;
+        state->fatSize = (nc + 2 + 255) / 256;
+        uint32_t r = BU16 + 1 + 2 * state->fatSize + 32;
+        if (state->dataStart < r) continue;
+        state->relSector = state->dataStart - r + BU16;
+        break;
+    }
+    // check valid cluster count for FAT16 volume
+    if (nc < 4085 || nc >= 65525) {
+        return sdError(state, "Bad cluster count");
+    }
+    state->reservedSectors = 1;
+    state->fatStart = state->relSector + state->reservedSectors;
+    state->partSize = nc * state->sectorsPerCluster + 2 * state->fatSize + state->reservedSectors + 32;
+    if (state->partSize < 32680) {
+        state->partType = 0X01;
+    } else if (state->partSize < 65536) {
+        state->partType = 0X04;
+    } else {
+        state->partType = 0X06;
+    }
+    if (!writeMbr(state)) {
+        return false;
+    }
+
+    clearCache(state, true);
+    fat_boot_t* pb = &state->cache.fbs;
+    pb->jump[0] = 0XEB;
+    pb->jump[1] = 0X00;
+    pb->jump[2] = 0X90;
+    for (uint8_t i = 0; i < sizeof(pb->oemId); i++) {
+        pb->oemId[i] = ' ';
+    }
+    pb->bytesPerSector = 512;
+    pb->sectorsPerCluster = state->sectorsPerCluster;
+    pb->reservedSectorCount = state->reservedSectors;
+    pb->fatCount = 2;
+    pb->rootDirEntryCount = 512;
+    pb->mediaType = 0XF8;
+    pb->sectorsPerFat16 = state->fatSize;
+    pb->sectorsPerTrack = state->sectorsPerTrack;
+    pb->headCount = state->numberOfHeads;
+    pb->hidddenSectors = state->relSector;
+    pb->totalSectors32 = state->partSize;
+    pb->driveNumber = 0X80;
+    pb->bootSignature = EXTENDED_BOOT_SIG;
+    pb->volumeSerialNumber = volSerialNumber(state);
+    memcpy(pb->volumeLabel, noName, sizeof(pb->volumeLabel));
+    memcpy(pb->fileSystemType, fat16str, sizeof(pb->fileSystemType));
+    // write partition boot sector
+    if (!writeCache(state, state->relSector)) {
+        return sdError(state, "FAT16 write PBS failed");
+    }
+    // clear FAT and root directory
+    if (!clearFatDir(state, state->fatStart, state->dataStart - state->fatStart)) {
+        return false;
+    }
+    clearCache(state, false);
+    state->cache.fat16[0] = 0XFFF8;
+    state->cache.fat16[1] = 0XFFFF;
+    // write first block of FAT and backup for reserved clusters
+    if (!writeCache(state, state->fatStart) || !writeCache(state, state->fatStart + state->fatSize)) {
+        return sdError(state, "FAT16 reserve failed");
+    }
+
+    return true;
+}
+
+// format the SD as FAT32
+static bool makeFat32(formatState_t *state)
+{
+    uint32_t nc;
+
+    state->relSector = BU32;
+    for (state->dataStart = 2 * BU32;; state->dataStart += BU32) {
+        nc = (state->cardSizeBlocks - state->dataStart) / state->sectorsPerCluster;
+        state->fatSize = (nc + 2 + 127) / 128;
+        uint32_t r = state->relSector + 9 + 2 * state->fatSize;
+        if (state->dataStart >= r) break;
+    }
+    // error if too few clusters in FAT32 volume
+    if (nc < 65525) {
+        return sdError(state, "Bad cluster count");
+    }
+    state->reservedSectors = state->dataStart - state->relSector - 2 * state->fatSize;
+    state->fatStart = state->relSector + state->reservedSectors;
+    state->partSize = nc * state->sectorsPerCluster + state->dataStart - state->relSector;
+    // type depends on address of end sector
+    // max CHS has lbn = 16450560 = 1024*255*63
+    if ((state->relSector + state->partSize) <= 16450560) {
+        // FAT32
+        state->partType = 0X0B;
+    } else {
+        // FAT32 with INT 13
+        state->partType = 0X0C;
+    }
+    if (!writeMbr(state)) {
+        return false;
+    }
+
+    clearCache(state, true);
+    fat32_boot_t* pb = &state->cache.fbs32;
+    pb->jump[0] = 0XEB;
+    pb->jump[1] = 0X00;
+    pb->jump[2] = 0X90;
+    for (uint8_t i = 0; i < sizeof(pb->oemId); i++) {
+        pb->oemId[i] = ' ';
+    }
+    pb->bytesPerSector = 512;
+    pb->sectorsPerCluster = state->sectorsPerCluster;
+    pb->reservedSectorCount = state->reservedSectors;
+    pb->fatCount = 2;
+    pb->mediaType = 0XF8;
+    pb->sectorsPerTrack = state->sectorsPerTrack;
+    pb->headCount = state->numberOfHeads;
+    pb->hidddenSectors = state->relSector;
+    pb->totalSectors32 = state->partSize;
+    pb->sectorsPerFat32 = state->fatSize;
+    pb->fat32RootCluster = 2;
+    pb->fat32FSInfo = 1;
+    pb->fat32BackBootBlock = 6;
+    pb->driveNumber = 0X80;
+    pb->bootSignature = EXTENDED_BOOT_SIG;
+    pb->volumeSerialNumber = volSerialNumber(state);
+    memcpy(pb->volumeLabel, noName, sizeof(pb->volumeLabel));
+    memcpy(pb->fileSystemType, fat32str, sizeof(pb->fileSystemType));
+    // write partition boot sector and backup
+    if (!writeCache(state, state->relSector) || !writeCache(state, state->relSector + 6)) {
+        return sdError(state, "FAT32 write PBS failed");
+    }
+    clearCache(state, true);
+    // write extra boot area and backup
+    if (!writeCache(state, state->relSector + 2) || !writeCache(state, state->relSector + 8)) {
+        return sdError(state, "FAT32 PBS ext failed");
+    }
+    fat32_fsinfo_t* pf = &state->cache.fsinfo;
+    pf->leadSignature = FSINFO_LEAD_SIG;
+    pf->structSignature = FSINFO_STRUCT_SIG;
+    pf->freeCount = 0XFFFFFFFF;
+    pf->nextFree = 0XFFFFFFFF;
+    // write FSINFO sector and backup
+    if (!writeCache(state, state->relSector + 1) || !writeCache(state, state->relSector + 7)) {
+        return sdError(state, "FAT32 FSINFO failed");
+    }
+    if (!clearFatDir(state, state->fatStart, 2 * state->fatSize + state->sectorsPerCluster)) {
+        return false;
+    }
+    clearCache(state, false);
+    state->cache.fat32[0] = 0x0FFFFFF8;
+    state->cache.fat32[1] = 0x0FFFFFFF;
+    state->cache.fat32[2] = 0x0FFFFFFF;
+    // write first block of FAT and backup for reserved clusters
+    if (!writeCache(state, state->fatStart) || !writeCache(state, state->fatStart + state->fatSize)) {
+        return sdError(state, "FAT32 reserve failed");
+    }
+
+    return true;
+}
+
+bool formatCard(Sd2Card *card, int fatType)
+{
+    static formatState_t state;
+
+    memset(&state, 0, sizeof(state));
+
+    state.card = card;
+    state.cardSizeBlocks = card->cardSize();
+
+    if (state.cardSizeBlocks == 0) {
+        return sdError(&state, "cardSize");
+    }
+
+    state.cardCapacityMB = (state.cardSizeBlocks + 2047) / 2048;
+
+    if (!initSizes(&state)) {
+        return false;
+    }
+
+    if (fatType == 0) {
+        fatType = card->type() == SD_CARD_TYPE_SDHC ? 32 : 16;
+    }
+
+    if (fatType == 32) {
+        // Small cards need smaller clusters to reach the minimum FAT32 cluster count
+        while (state.sectorsPerCluster > 1 && state.cardSizeBlocks / state.sectorsPerCluster < 65525 + 2 * BU32) {
+            state.sectorsPerCluster /= 2;
+        }
+
+        return makeFat32(&state);
+    }
+
+    return makeFat16(&state);
+}
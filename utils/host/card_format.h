@@ -0,0 +1,17 @@
+#ifndef CARD_FORMAT_H_
+#define CARD_FORMAT_H_
+
+#include <Sd2Card.h>
+
+/**
+ * Partition and format the card the way SdFat's SdFormatter example does (and so the way the SD Association's
+ * formatter does): FAT16 for cards of 2GB and below, FAT32 for SDHC cards.
+ *
+ * fatType may be 16 or 32 to override that choice, or 0 for the default. Forcing FAT32 on a small card shrinks the
+ * clusters until there are enough of them for a valid FAT32 volume.
+ *
+ * Returns false (after printing the reason to stderr) if the card can't be formatted.
+ */
+bool formatCard(Sd2Card *card, int fatType);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * Timing model and I/O counters for the host Sd2Card, see card_model.h.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "card_model.h"
+
+const cardLatencyModel_t cardLatencyIdeal = {
+    .commandUs = 0,
+    .transferUs = 0,
+    .readUs = 0,
+    .multiReadUs = 0,
+    .writeUs = 0,
+    .multiWriteUs = 0,
+    .eraseUs = 0,
+    .gcProbability = 0,
+    .gcMinUs = 0, .gcMaxUs = 0,
+    .dropoutProbability = 0,
+    .dropoutMinUs = 0, .dropoutMaxUs = 0,
+    .corruptProbability = 0,
+    .seed = 1,
+};
+
+static const char *const cardOpNames[CARD_OP_COUNT] = {
+    "readBlock", "readStart", "readData", "readStop",
+    "writeBlock", "writeStart", "writeData", "writeStop",
+    "erase", "register"
+};
+
+static cardLatencyModel_t model = cardLatencyIdeal;
+static bool modelRealTime = false;
+static cardStats_t stats;
+
+static uint64_t virtualMicros = 0;
+static uint64_t busyUntil = 0;
+static bool readStreamStarted = false;
+static uint32_t randomState = 1;
+
+static bool offline = false;
+static uint64_t offlineUntil = 0;
+
+static uint64_t monotonicMicros(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift32, so that runs are repeatable regardless of the C library
+static uint32_t nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState;
+}
+
+static uint32_t garbageCollectionUs(void)
+{
+    if (model.gcProbability <= 0 || (nextRandom() / 4294967296.0) >= model.gcProbability) {
+        return 0;
+    }
+
+    stats.gcStalls++;
+
+    return model.gcMinUs + (model.gcMaxUs > model.gcMinUs ? nextRandom() % (model.gcMaxUs - model.gcMinUs + 1) : 0);
+}
+
+bool cardModelWriteDropout(void)
+{
+    if (offline) {
+        return true;
+    }
+
+    if (model.dropoutProbability <= 0 || (nextRandom() / 4294967296.0) >= model.dropoutProbability) {
+        return false;
+    }
+
+    stats.dropouts++;
+    offline = true;
+    offlineUntil = cardModelMicros() + model.dropoutMinUs
+        + (model.dropoutMaxUs > model.dropoutMinUs ? nextRandom() % (model.dropoutMaxUs - model.dropoutMinUs + 1) : 0);
+
+    return true;
+}
+
+int cardModelWriteCorruption(void)
+{
+    if (model.corruptProbability <= 0 || (nextRandom() / 4294967296.0) >= model.corruptProbability) {
+        return -1;
+    }
+
+    stats.corruptions++;
+
+    return nextRandom() % (512 * 8);
+}
+
+bool cardModelOnline(void)
+{
+    return !offline;
+}
+
+bool cardModelReconnect(void)
+{
+    if (offline && cardModelMicros() < offlineUntil) {
+        return false;
+    }
+
+    offline = false;
+
+    return true;
+}
+
+uint64_t cardModelMicros(void)
+{
+    return modelRealTime ? monotonicMicros() : virtualMicros;
+}
+
+void cardModelAdvance(uint32_t us)
+{
+    virtualMicros += us;
+}
+
+static void waitUntil(uint64_t deadline)
+{
+    if (!modelRealTime) {
+        if (deadline > virtualMicros) {
+            virtualMicros = deadline;
+        }
+        return;
+    }
+
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000;
+    ts.tv_nsec = (deadline % 1000000) * 1000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void cardModelConfigure(const cardLatencyModel_t *newModel, bool realTime)
+{
+    model = *newModel;
+    modelRealTime = realTime;
+    randomState = model.seed ? model.seed : 1;
+    busyUntil = 0;
+    offline = false;
+}
+
+bool cardModelBusy(void)
+{
+    return cardModelMicros() < busyUntil;
+}
+
+void cardModelCommand(cardOp_e op, uint32_t blocks)
+{
+    uint64_t start = cardModelMicros();
+    uint64_t time = start;
+
+    // Like waitNotBusy() in the real driver, wait for the previous write to finish programming first
+    if (time < busyUntil) {
+        stats.busyWaitUs += busyUntil - time;
+        time = busyUntil;
+    }
+
+    // Data blocks of a multi-block transfer don't need a command of their own
+    if (op != CARD_OP_READ_DATA && op != CARD_OP_WRITE_DATA) {
+        time += model.commandUs;
+    }
+
+    switch (op) {
+        case CARD_OP_READ_BLOCK:
+            time += (uint64_t) blocks * (model.readUs + model.transferUs);
+            stats.blocksRead += blocks;
+        break;
+        case CARD_OP_READ_START:
+            readStreamStarted = false;
+        break;
+        case CARD_OP_READ_DATA:
+            // The card reads ahead during a multi-block read, so only the first block waits the full access time
+            time += (uint64_t) blocks * model.transferUs;
+            time += readStreamStarted ? (uint64_t) blocks * model.multiReadUs
+                : model.readUs + (uint64_t) (blocks - 1) * model.multiReadUs;
+            readStreamStarted = true;
+            stats.blocksRead += blocks;
+        break;
+        case CARD_OP_WRITE_BLOCK:
+            time += (uint64_t) blocks * model.transferUs;
+            busyUntil = time + model.writeUs + garbageCollectionUs();
+            stats.blocksWritten += blocks;
+        break;
+        case CARD_OP_WRITE_DATA:
+            time += (uint64_t) blocks * model.transferUs;
+            busyUntil = time + model.multiWriteUs + garbageCollectionUs();
+            stats.blocksWritten += blocks;
+        break;
+        case CARD_OP_ERASE:
+            busyUntil = time + (uint64_t) blocks * model.eraseUs;
+            stats.blocksErased += blocks;
+        break;
+        default:
+        break;
+    }
+
+    waitUntil(time);
+
+    uint64_t elapsed = time - start;
+
+    stats.commands[op]++;
+    stats.totalUs += elapsed;
+
+    if (elapsed > stats.maxCommandUs) {
+        stats.maxCommandUs = elapsed;
+    }
+}
+
+const cardStats_t* cardModelStats(void)
+{
+    return &stats;
+}
+
+void cardModelResetStats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+static bool parseUs(const char *value, uint32_t *result)
+{
+    char *end;
+    unsigned long parsed = strtoul(value, &end, 10);
+
+    if (end == value || *end != '\0') {
+        return false;
+    }
+
+    *result = (uint32_t) parsed;
+
+    return true;
+}
+
+bool cardModelParse(const char *spec, cardLatencyModel_t *result)
+{
+    char buffer[256];
+    char *setting, *savePtr;
+    bool readGiven = false, multiReadGiven = false;
+
+    if (strlen(spec) >= sizeof(buffer)) {
+        return false;
+    }
+
+    strcpy(buffer, spec);
+
+    for (setting = strtok_r(buffer, ",", &savePtr); setting; setting = strtok_r(NULL, ",", &savePtr)) {
+        char *value = strchr(setting, '=');
+
+        if (!value) {
+            return false;
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(setting, "cmd") == 0) {
+            if (!parseUs(value, &result->commandUs))
+                return false;
+        } else if (strcmp(setting, "xfer") == 0) {
+            if (!parseUs(value, &result->transferUs))
+                return false;
+        } else if (strcmp(setting, "read") == 0) {
+            if (!parseUs(value, &result->readUs))
+                return false;
+            readGiven = true;
+        } else if (strcmp(setting, "mread") == 0) {
+            if (!parseUs(value, &result->multiReadUs))
+                return false;
+            multiReadGiven = true;
+        } else if (strcmp(setting, "write") == 0) {
+            if (!parseUs(value, &result->writeUs))
+                return false;
+        } else if (strcmp(setting, "mwrite") == 0) {
+            if (!parseUs(value, &result->multiWriteUs))
+                return false;
+        } else if (strcmp(setting, "erase") == 0) {
+            if (!parseUs(value, &result->eraseUs))
+                return false;
+        } else if (strcmp(setting, "seed") == 0) {
+            if (!parseUs(value, &result->seed))
+                return false;
+        } else if (strcmp(setting, "gc") == 0) {
+            double probability;
+            unsigned int minUs, maxUs;
+
+            if (sscanf(value, "%lf:%u-%u", &probability, &minUs, &maxUs) != 3
+                    || probability < 0 || probability > 1 || maxUs < minUs) {
+                return false;
+            }
+
+            result->gcProbability = probability;
+            result->gcMinUs = minUs;
+            result->gcMaxUs = maxUs;
+        } else if (strcmp(setting, "dropout") == 0) {
+            double probability;
+            unsigned int minUs, maxUs;
+
+            if (sscanf(value, "%lf:%u-%u", &probability, &minUs, &maxUs) != 3
+                    || probability < 0 || probability > 1 || maxUs < minUs) {
+                return false;
+            }
+
+            result->dropoutProbability = probability;
+            result->dropoutMinUs = minUs;
+            result->dropoutMaxUs = maxUs;
+        } else if (strcmp(setting, "corrupt") == 0) {
+            double probability;
+
+            if (sscanf(value, "%lf", &probability) != 1 || probability < 0 || probability > 1) {
+                return false;
+            }
+
+            result->corruptProbability = probability;
+        } else {
+            return false;
+        }
+    }
+
+    if (readGiven && !multiReadGiven) {
+        result->multiReadUs = result->readUs;
+    }
+
+    return true;
+}
+
+void cardModelPrintSettings(FILE *file)
+{
+    fprintf(file,
+        "Card model: cmd=%u,xfer=%u,read=%u,mread=%u,write=%u,mwrite=%u,erase=%u,gc=%g:%u-%u,dropout=%g:%u-%u,"
+        "corrupt=%g,seed=%u\n",
+        model.commandUs, model.transferUs, model.readUs, model.multiReadUs, model.writeUs, model.multiWriteUs,
+        model.eraseUs,
+        model.gcProbability, model.gcMinUs, model.gcMaxUs, model.dropoutProbability, model.dropoutMinUs,
+        model.dropoutMaxUs, model.corruptProbability, model.seed);
+}
+
+void cardModelPrintStats(FILE *file)
+{
+    fprintf(file, "Card commands:");
+
+    for (int i = 0; i < CARD_OP_COUNT; i++) {
+        if (stats.commands[i]) {
+            fprintf(file, " %s %u", cardOpNames[i], stats.commands[i]);
+        }
+    }
+
+    fprintf(file, "\nCard blocks: read %llu, written %llu, erased %llu, GC stalls %u, dropouts %u, corrupted %u\n",
+        (unsigned long long) stats.blocksRead, (unsigned long long) stats.blocksWritten,
+        (unsigned long long) stats.blocksErased, stats.gcStalls, stats.dropouts, stats.corruptions);
+
+    fprintf(file, "Card time: %llu us in commands, %llu us of that waiting for busy, longest command %u us\n",
+        (unsigned long long) stats.totalUs, (unsigned long long) stats.busyWaitUs, stats.maxCommandUs);
+}
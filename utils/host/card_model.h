@@ -0,0 +1,140 @@
+#ifndef CARD_MODEL_H_
+#define CARD_MODEL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Timing model and I/O counters for the host Sd2Card.
+ *
+ * Every command pays a fixed overhead, then waits out whatever busy time the previous write left behind (as the real
+ * driver's waitNotBusy() does), then pays a transfer time per block. Reads also wait for the card's access time before
+ * each block's data token. Writes leave the card busy programming for a while afterwards, and may randomly leave it
+ * busy for much longer while it does garbage collection.
+ *
+ * In real time mode (the emulator) these delays are actually slept, so the firmware falls behind the UART the way it
+ * would on hardware. In virtual time mode (benchmarks) they only advance a simulated clock, so results are exactly
+ * repeatable for a given seed.
+ *
+ * A write can also make the card drop off the bus, as a flaky contact would. The write fails, and so does every
+ * command after it until the dropout is over and the card is initialised again.
+ *
+ * Or a write can succeed but store the block with a bit flipped, as failing flash might, which only reading it back
+ * will show.
+ */
+
+typedef enum {
+    CARD_OP_READ_BLOCK = 0,
+    CARD_OP_READ_START,
+    CARD_OP_READ_DATA,
+    CARD_OP_READ_STOP,
+    CARD_OP_WRITE_BLOCK,
+    CARD_OP_WRITE_START,
+    CARD_OP_WRITE_DATA,
+    CARD_OP_WRITE_STOP,
+    CARD_OP_ERASE,
+    CARD_OP_REGISTER,
+    CARD_OP_COUNT
+} cardOp_e;
+
+typedef struct cardLatencyModel_t {
+    uint32_t commandUs;        // Fixed cost of sending any command and getting its response
+    uint32_t transferUs;       // Moving one 512 byte block over SPI
+    uint32_t readUs;           // Access time before each block's data token on reads
+    uint32_t multiReadUs;      // Access time for each block after the first of a multi-block read (CMD18)
+    uint32_t writeUs;          // Busy time programming a single block write (CMD24)
+    uint32_t multiWriteUs;     // Busy time per block during a multi-block write (CMD25)
+    uint32_t eraseUs;          // Busy time per block erased
+
+    // Chance (0..1) that a write triggers garbage collection, and how long the card then stays busy
+    double gcProbability;
+    uint32_t gcMinUs, gcMaxUs;
+
+    // Chance (0..1) that a write makes the card drop off the bus, and how long it stays off
+    double dropoutProbability;
+    uint32_t dropoutMinUs, dropoutMaxUs;
+
+    // Chance (0..1) that a block written is silently stored with one bit flipped
+    double corruptProbability;
+
+    uint32_t seed;
+} cardLatencyModel_t;
+
+typedef struct cardStats_t {
+    uint32_t commands[CARD_OP_COUNT];
+    uint64_t blocksRead, blocksWritten, blocksErased;
+    uint32_t gcStalls;
+    uint32_t dropouts;
+    uint32_t corruptions;
+
+    uint64_t busyWaitUs;       // Time spent waiting for the card to stop being busy
+    uint64_t totalUs;          // Total time spent in card commands, including busy waits
+    uint32_t maxCommandUs;     // Longest single command, the worst-case stall the firmware sees
+} cardStats_t;
+
+extern const cardLatencyModel_t cardLatencyIdeal;
+
+/**
+ * Parse a latency model from a comma-separated list of key=value settings, on top of the current contents of model:
+ *
+ *   cmd=<us>, xfer=<us>, read=<us>, mread=<us>, write=<us>, mwrite=<us>, erase=<us>,
+ *   gc=<probability>:<min us>-<max us>, dropout=<probability>:<min us>-<max us>, corrupt=<probability>, seed=<n>
+ *
+ * mread is the same as read unless it's given.
+ *
+ * Returns false if the spec couldn't be understood.
+ */
+bool cardModelParse(const char *spec, cardLatencyModel_t *model);
+
+void cardModelConfigure(const cardLatencyModel_t *model, bool realTime);
+
+/**
+ * Account for a card command that moves the given number of blocks. Called by the host Sd2Card before it does the
+ * I/O, this waits (or advances the virtual clock) for as long as the command would take.
+ */
+void cardModelCommand(cardOp_e op, uint32_t blocks);
+
+/**
+ * Called by the host Sd2Card for each block it writes: true if the card dropped off the bus during the write, in which
+ * case the write fails.
+ */
+bool cardModelWriteDropout(void);
+
+/**
+ * Called by the host Sd2Card for each block it writes successfully: the bit of the block to flip on its way to the
+ * image, or -1 to store the block as it is.
+ */
+int cardModelWriteCorruption(void);
+
+/**
+ * False while the card is off the bus after a dropout, until cardModelReconnect() succeeds.
+ */
+bool cardModelOnline(void);
+
+/**
+ * Called when the card is initialised: brings it back on the bus if the dropout is over. False if it's still off.
+ */
+bool cardModelReconnect(void);
+
+/**
+ * True if the card would still be busy programming a previous write right now.
+ */
+bool cardModelBusy(void);
+
+/**
+ * The model's clock in microseconds, virtual or real depending on the mode.
+ */
+uint64_t cardModelMicros(void);
+
+/**
+ * Advance the virtual clock, e.g. to account for the time the firmware spends between card commands. No effect in
+ * real time mode, where time passes by itself.
+ */
+void cardModelAdvance(uint32_t us);
+
+const cardStats_t* cardModelStats(void);
+void cardModelResetStats(void);
+void cardModelPrintStats(FILE *file);
+void cardModelPrintSettings(FILE *file);
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ * Emulated ATmega328 USART for the host build, see include/SerialPort.h.
+ *
+ * A receiver thread plays the part of the USART and its RX interrupt: it reads whatever the tty has for us and
+ * releases each byte into the ring buffer at the moment its stop bit would have finished arriving at the current baud
+ * rate. Bytes that find the ring full are dropped and flagged with SP_RX_BUF_OVERRUN, just like the real ISR. The ring
+ * is single producer/single consumer, so as on the AVR the head and tail indexes are its only synchronisation.
+ *
+ * The line can be given its own baud rate (as when the flight controller's setting doesn't match the OpenLog's). The
+ * USART then receives at whatever rate UBRR0 and U2X0 give it, and garbles every byte (with SP_FRAMING_ERROR) if that's
+ * too far off the line's. A byte is only received if the receiver was on (RXEN0) in time to see its start bit, and
+ * PIND reads the bit that is on the line at that instant, so the firmware can time the bits itself.
+ */
+#include <SerialPort.h>
+#include <avr/sleep.h>
+
+#include <atomic>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_uart.h"
+
+static int uartFd = -1;
+
+static uint8_t *ringBuf;
+static size_t ringSize;
+static std::atomic<size_t> ringHead(0), ringTail(0);
+
+static std::atomic<uint8_t> rxErrorBits(0);
+static std::atomic<bool> hungUp(false);
+
+// What the sender is using, or zero to follow the baud rate that the firmware asked SerialPort for
+static std::atomic<uint32_t> lineBaud(0);
+static std::atomic<uint32_t> configuredBaud(115200);
+static std::atomic<int> frameBits(1 + 8 + 1);
+
+// When RXEN0 was last turned on, or never if it's off now
+#define RECEIVER_OFF UINT64_MAX
+static std::atomic<uint64_t> receiverOnSinceNs(RECEIVER_OFF);
+
+// The USART copes with this much difference between its rate and the line's
+#define USART_BAUD_TOLERANCE_PERCENT 4.5
+
+/*
+ * The bytes most recently put on the line, for PIND to look up. The receiver thread never gets more than a read's worth
+ * of bytes ahead of the clock, so it can't lap the readers.
+ */
+#define LINE_HISTORY 256
+
+typedef struct lineByte_t {
+    uint64_t startNs;
+    uint32_t bitNs;
+    uint8_t value;
+} lineByte_t;
+
+static lineByte_t lineHistory[LINE_HISTORY];
+static std::atomic<uint32_t> lineHistoryHead(0);
+
+// Lets sleep_mode() doze until the receiver thread has something for it
+static pthread_mutex_t wakeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t receiverThread;
+
+// Don't bother sleeping for less than this, just deliver the byte a little early
+#define RECEIVER_MIN_SLEEP_NS 50000
+
+// With only one CPU, the firmware can't watch RXD while we're busy putting bytes on the line
+#define RECEIVER_OFF_LEAD_NS 500000
+
+static uint64_t monotonicNanos(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleepUntilNanos(uint64_t deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static uint32_t usartBaud(void)
+{
+    return F_CPU / ((UCSR0A & _BV(U2X0) ? 8 : 16) * ((uint32_t) UBRR0 + 1));
+}
+
+static uint32_t lineBitNs(void)
+{
+    uint32_t baud = lineBaud ? lineBaud.load() : configuredBaud.load();
+
+    return 1000000000 / baud;
+}
+
+static void wakeSleeper(void)
+{
+    pthread_mutex_lock(&wakeMutex);
+    pthread_cond_broadcast(&wakeCond);
+    pthread_mutex_unlock(&wakeMutex);
+}
+
+// What the RX ISR does with each received byte
+static void receiveByte(uint8_t b)
+{
+    size_t h = ringHead.load(std::memory_order_relaxed);
+    size_t next = h + 1 < ringSize ? h + 1 : 0;
+
+    if (next == ringTail.load(std::memory_order_acquire)) {
+        rxErrorBits |= SP_RX_BUF_OVERRUN;
+        return;
+    }
+
+    ringBuf[h] = b;
+    ringHead.store(next, std::memory_order_release);
+}
+
+static void putOnLine(uint64_t startNs, uint32_t bitNs, uint8_t b)
+{
+    uint32_t next = (lineHistoryHead.load(std::memory_order_relaxed) + 1) % LINE_HISTORY;
+
+    lineHistory[next].startNs = startNs;
+    lineHistory[next].bitNs = bitNs;
+    lineHistory[next].value = b;
+
+    lineHistoryHead.store(next, std::memory_order_release);
+}
+
+// What the USART makes of a byte that started arriving at startNs
+static void usartReceive(uint64_t startNs, uint32_t bitNs, uint8_t b)
+{
+    uint64_t startBitSampled = startNs + bitNs / 2;
+
+    // If the receiver wasn't on when the byte started, see whether it comes on in time to catch the start bit
+    while (receiverOnSinceNs > startNs && monotonicNanos() < startBitSampled) {
+    }
+
+    if (receiverOnSinceNs > startBitSampled)
+        return;
+
+    if (lineBaud) {
+        double error = 100.0 * ((double) usartBaud() - lineBaud) / lineBaud;
+
+        if (error > USART_BAUD_TOLERANCE_PERCENT || error < -USART_BAUD_TOLERANCE_PERCENT) {
+            rxErrorBits |= SP_FRAMING_ERROR;
+            b ^= 0xA5;
+        }
+    }
+
+    receiveByte(b);
+}
+
+static void* receiverMain(void *arg)
+{
+    uint8_t buffer[64];
+    uint64_t lineFreeAt = 0;
+
+    (void) arg;
+
+    while (true) {
+        ssize_t bytesRead = read(uartFd, buffer, sizeof(buffer));
+
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+
+        if (bytesRead <= 0) {
+            hungUp = true;
+            wakeSleeper();
+            break;
+        }
+
+        uint64_t now = monotonicNanos();
+
+        // If the line has been idle, the first byte of this batch only started arriving now
+        if (lineFreeAt < now) {
+            lineFreeAt = now;
+
+            // Or if the firmware might be timing the bits on RXD, once we're out of its way
+            if (receiverOnSinceNs == RECEIVER_OFF) {
+                lineFreeAt += RECEIVER_OFF_LEAD_NS;
+            }
+        }
+
+        uint32_t bitNs = lineBitNs();
+        uint64_t byteNs = (uint64_t) bitNs * frameBits;
+        uint64_t batchStartNs = lineFreeAt;
+
+        // Put the whole batch on the line up front, PIND has to be able to see it before we get round to receiving it
+        for (ssize_t i = 0; i < bytesRead; i++) {
+            putOnLine(batchStartNs + i * byteNs, bitNs, buffer[i]);
+        }
+
+        lineFreeAt += bytesRead * byteNs;
+
+        for (ssize_t i = 0; i < bytesRead; i++) {
+            uint64_t startNs = batchStartNs + i * byteNs;
+            uint64_t receivedNs = startNs + byteNs;
+
+            /*
+             * While the receiver is off nothing is waiting for these bytes, except maybe the firmware polling RXD, so
+             * don't take the CPU from it more than once a batch.
+             */
+            if (receiverOnSinceNs > startNs) {
+                receivedNs = lineFreeAt;
+            }
+
+            if (receivedNs > now + RECEIVER_MIN_SLEEP_NS) {
+                sleepUntilNanos(receivedNs);
+                now = monotonicNanos();
+            }
+
+            usartReceive(startNs, bitNs, buffer[i]);
+        }
+
+        wakeSleeper();
+    }
+
+    return NULL;
+}
+
+bool hostUartAttach(int fd)
+{
+    uartFd = fd;
+
+    return pthread_create(&receiverThread, NULL, receiverMain, NULL) == 0;
+}
+
+void hostUartSetLineBaud(uint32_t baud)
+{
+    lineBaud = baud;
+}
+
+uint8_t hostUartRxdPin(void)
+{
+    uint64_t now = monotonicNanos();
+    uint32_t head = lineHistoryHead.load(std::memory_order_acquire);
+
+    // Find the byte that was the last to start, the line is idle (high) if it has finished
+    for (uint32_t i = 0; i < LINE_HISTORY; i++) {
+        const lineByte_t *line = &lineHistory[(head + LINE_HISTORY - i) % LINE_HISTORY];
+
+        if (line->startNs <= now) {
+            uint64_t bit = line->bitNs ? (now - line->startNs) / line->bitNs : 9;
+
+            if (bit == 0)
+                return 0; //Start bit
+            if (bit <= 8)
+                return (line->value >> (bit - 1)) & 1;
+            break;
+        }
+    }
+
+    return _BV(PIND0);
+}
+
+HostUsartControl& HostUsartControl::operator=(uint8_t value)
+{
+    if ((value & _BV(RXEN0)) && !(value_ & _BV(RXEN0))) {
+        receiverOnSinceNs = monotonicNanos();
+    } else if (!(value & _BV(RXEN0))) {
+        receiverOnSinceNs = RECEIVER_OFF;
+    }
+
+    value_ = value;
+
+    return *this;
+}
+
+HostUsartControl UCSR0B;
+
+void hostUartInitRx(uint8_t *buffer, size_t size)
+{
+    ringBuf = buffer;
+    ringSize = size;
+    ringHead = ringTail = 0;
+}
+
+void hostUartBegin(uint32_t baud, int stopBits)
+{
+    if (baud == 0)
+        return;
+
+    // Set the registers up as SerialPort::begin() does
+    UCSR0B = 0;
+
+    uint16_t setting = F_CPU / 4 / baud;
+
+    if (setting > 8192 || baud == 57600) {
+        UCSR0A = 0;
+        setting /= 2;
+    } else {
+        UCSR0A = _BV(U2X0);
+    }
+
+    UBRR0 = (setting - 1) / 2;
+
+    configuredBaud = baud;
+    frameBits = 1 + 8 + stopBits; // Start bit, 8 data bits and the stop bits
+
+    UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
+}
+
+size_t hostUartAvailable(void)
+{
+    size_t h = ringHead.load(std::memory_order_acquire);
+    size_t t = ringTail.load(std::memory_order_relaxed);
+
+    return h >= t ? h - t : ringSize - t + h;
+}
+
+size_t hostUartRead(uint8_t *b, size_t n)
+{
+    size_t h = ringHead.load(std::memory_order_acquire);
+    size_t t = ringTail.load(std::memory_order_relaxed);
+    size_t count = 0;
+
+    while (count < n && t != h) {
+        // Copy up to the head or the end of the ring, whichever is first
+        size_t run = (h > t ? h : ringSize) - t;
+
+        if (run > n - count) {
+            run = n - count;
+        }
+
+        memcpy(b + count, ringBuf + t, run);
+        count += run;
+        t += run;
+
+        if (t == ringSize) {
+            t = 0;
+        }
+    }
+
+    ringTail.store(t, std::memory_order_release);
+
+    return count;
+}
+
+int hostUartPeek(void)
+{
+    size_t t = ringTail.load(std::memory_order_relaxed);
+
+    return t == ringHead.load(std::memory_order_acquire) ? -1 : ringBuf[t];
+}
+
+void hostUartFlushRx(void)
+{
+    ringTail.store(ringHead.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+size_t hostUartWrite(const uint8_t *b, size_t n)
+{
+    size_t written = 0;
+
+    if (uartFd == -1)
+        return n;
+
+    while (written < n) {
+        ssize_t result = write(uartFd, b + written, n - written);
+
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        written += result;
+    }
+
+    // Without a TX buffer the firmware waits for each byte to shift out
+    sleepUntilNanos(monotonicNanos() + 1000000000ULL * frameBits * n / usartBaud());
+
+    return n;
+}
+
+uint8_t hostUartGetRxError(void)
+{
+    return rxErrorBits;
+}
+
+void hostUartClearRxError(void)
+{
+    rxErrorBits = 0;
+}
+
+void sleep_mode(void)
+{
+    pthread_mutex_lock(&wakeMutex);
+
+    while (hostUartAvailable() == 0 && !hungUp) {
+        pthread_cond_wait(&wakeCond, &wakeMutex);
+    }
+
+    pthread_mutex_unlock(&wakeMutex);
+
+    // The firmware always syncs before it sleeps, so this is the one safe moment to pull the plug
+    if (hungUp && hostUartAvailable() == 0) {
+        exit(EXIT_SUCCESS);
+    }
+}
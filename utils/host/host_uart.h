@@ -0,0 +1,16 @@
+#ifndef HOST_UART_H_
+#define HOST_UART_H_
+
+/**
+ * Connect the emulated USART to the given tty and start receiving from it. Before this is called, writes are discarded
+ * and nothing is ever received.
+ */
+bool hostUartAttach(int fd);
+
+/**
+ * Have the other end of the line send at this baud rate regardless of what the firmware sets, or at whatever it sets if
+ * zero (the default).
+ */
+void hostUartSetLineBaud(uint32_t baud);
+
+#endif
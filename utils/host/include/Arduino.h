@@ -0,0 +1,167 @@
+/*
+ * Just enough of the Arduino core to build the OpenLog sketch and SdFat on the host. Flash strings live in ordinary
+ * memory, the AVR registers that the sketch pokes are plain variables, and time comes from the host's monotonic clock.
+ */
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+
+#define F_CPU 16000000UL
+
+#define SS 10
+#define MOSI 11
+#define MISO 12
+#define SCK 13
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Program memory is just memory (SdBaseFile.h may have already defined these for non-AVR targets)
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef PGM_P
+#define PGM_P const char *
+#endif
+#ifndef PSTR
+#define PSTR(s) (s)
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#endif
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+#ifndef pgm_read_dword
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#endif
+
+// The registers and bits that the sketch writes to while powering down peripherals
+extern volatile uint8_t ADCSRA, ACSR, DIDR0, DIDR1, PORTB, PORTD, UCSR0A;
+extern volatile uint16_t UBRR0;
+
+#define ADEN 7
+#define ACD 7
+#define AIN1D 1
+#define AIN0D 0
+#define U2X0 1
+
+/*
+ * The emulated USART (host_uart.cpp) needs to know when its receiver is turned on or off, so UCSR0B is an object that
+ * tells it about every write. PIND reads the level that the emulated line would have on RXD at this instant.
+ */
+class HostUsartControl {
+ public:
+  operator uint8_t() const {return value_;}
+  HostUsartControl& operator=(uint8_t value);
+  HostUsartControl& operator|=(uint8_t bits) {return *this = value_ | bits;}
+  HostUsartControl& operator&=(uint8_t bits) {return *this = value_ & bits;}
+
+ private:
+  volatile uint8_t value_;
+};
+
+extern HostUsartControl UCSR0B;
+
+uint8_t hostUartRxdPin(void);
+#define PIND hostUartRxdPin()
+
+#define RXCIE0 7
+#define RXEN0 4
+#define TXEN0 3
+#define PIND0 0
+
+// Timer1 only ever counts CPU cycles (no prescaler), straight off the host's clock
+extern volatile uint8_t TCCR1A, TCCR1B;
+
+uint16_t hostTimer1Count(void);
+#define TCNT1 hostTimer1Count()
+
+#define CS10 0
+
+// Nothing interrupts the sketch on the host, the USART and timers run on their own
+#define cli()
+#define sei()
+
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+class Print {
+ public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) {
+    return str ? write((const uint8_t *) str, strlen(str)) : 0;
+  }
+
+  size_t print(const __FlashStringHelper *s);
+  size_t print(const char *s);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+
+  size_t println(void);
+  size_t println(const __FlashStringHelper *s);
+  size_t println(const char *s);
+  size_t println(char c);
+  size_t println(unsigned char n, int base = DEC);
+  size_t println(int n, int base = DEC);
+  size_t println(unsigned int n, int base = DEC);
+  size_t println(long n, int base = DEC);
+  size_t println(unsigned long n, int base = DEC);
+
+ private:
+  size_t printNumber(unsigned long n, int base);
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+};
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Host stand-in for the ATmega328's 1KB EEPROM. It starts out erased (0xFF) and can be loaded from and saved to a file
+ * so that settings like the log file number survive between runs of the emulator.
+ */
+#ifndef HOST_EEPROM_H_
+#define HOST_EEPROM_H_
+
+#include <stdint.h>
+
+#define HOST_EEPROM_SIZE 1024
+
+class EEPROMClass {
+ public:
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+
+  // Host only: back the EEPROM with a file, loading it now and saving on every write
+  bool attachFile(const char *filename);
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Host stand-in for SdFat's Sd2Card, backed by a disk image file instead of an SD card on the SPI bus. It has the same
+ * public interface and error codes as the real driver so that SdVolume and SdBaseFile build unmodified on top of it,
+ * and it enforces the same command sequencing (a multi-block read or write must be stopped before any other command).
+ *
+ * Images larger than 2GB are presented as SDHC cards, smaller ones as standard capacity SD2 cards. Each command takes
+ * as long as the latency model in card_model.h says it should, and is counted in its statistics.
+ */
+#ifndef SpiCard_h
+#define SpiCard_h
+
+#include <Arduino.h>
+#include <SdFatConfig.h>
+#include <SdInfo.h>
+
+uint8_t const SD_CHIP_SELECT_PIN = SS;
+//------------------------------------------------------------------------------
+// SD card errors
+uint8_t const SD_CARD_ERROR_CMD0 = 0X1;
+uint8_t const SD_CARD_ERROR_CMD8 = 0X2;
+uint8_t const SD_CARD_ERROR_CMD12 = 0X3;
+uint8_t const SD_CARD_ERROR_CMD17 = 0X4;
+uint8_t const SD_CARD_ERROR_CMD18 = 0X5;
+uint8_t const SD_CARD_ERROR_CMD24 = 0X6;
+uint8_t const SD_CARD_ERROR_CMD25 = 0X7;
+uint8_t const SD_CARD_ERROR_CMD58 = 0X8;
+uint8_t const SD_CARD_ERROR_ACMD23 = 0X9;
+uint8_t const SD_CARD_ERROR_ACMD41 = 0XA;
+uint8_t const SD_CARD_ERROR_BAD_CSD = 0XB;
+uint8_t const SD_CARD_ERROR_ERASE = 0XC;
+uint8_t const SD_CARD_ERROR_ERASE_SINGLE_BLOCK = 0XD;
+uint8_t const SD_CARD_ERROR_ERASE_TIMEOUT = 0XE;
+uint8_t const SD_CARD_ERROR_READ = 0XF;
+uint8_t const SD_CARD_ERROR_READ_REG = 0X10;
+uint8_t const SD_CARD_ERROR_READ_TIMEOUT = 0X11;
+uint8_t const SD_CARD_ERROR_STOP_TRAN = 0X12;
+uint8_t const SD_CARD_ERROR_WRITE = 0X13;
+uint8_t const SD_CARD_ERROR_WRITE_BLOCK_ZERO = 0X14;  // REMOVE - not used
+uint8_t const SD_CARD_ERROR_WRITE_MULTIPLE = 0X15;
+uint8_t const SD_CARD_ERROR_WRITE_PROGRAMMING = 0X16;
+uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X17;
+uint8_t const SD_CARD_ERROR_SCK_RATE = 0X18;
+uint8_t const SD_CARD_ERROR_INIT_NOT_CALLED = 0X19;
+uint8_t const SD_CARD_ERROR_CMD59 = 0X1A;
+uint8_t const SD_CARD_ERROR_READ_CRC = 0X1B;
+uint8_t const SD_CARD_ERROR_SPI_DMA = 0X1C;
+//------------------------------------------------------------------------------
+// card types
+uint8_t const SD_CARD_TYPE_SD1  = 1;
+uint8_t const SD_CARD_TYPE_SD2  = 2;
+uint8_t const SD_CARD_TYPE_SDHC = 3;
+//------------------------------------------------------------------------------
+class Sd2Card {
+ public:
+  Sd2Card() : m_errorCode(SD_CARD_ERROR_INIT_NOT_CALLED), m_type(0) {}
+  bool begin(uint8_t chipSelectPin = SD_CHIP_SELECT_PIN,
+            uint8_t sckDivisor = SPI_FULL_SPEED);
+  uint32_t cardSize();
+  bool erase(uint32_t firstBlock, uint32_t lastBlock);
+  bool eraseSingleBlockEnable();
+  void error(uint8_t code) {m_errorCode = code;}
+  int errorCode() const {return m_errorCode;}
+  int errorData() const {return m_status;}
+  bool init(uint8_t sckDivisor = SPI_FULL_SPEED,
+            uint8_t chipSelectPin = SD_CHIP_SELECT_PIN) {
+    return begin(chipSelectPin, sckDivisor);
+  }
+  bool isBusy();
+  bool readBlock(uint32_t block, uint8_t* dst);
+  bool readCID(cid_t* cid);
+  bool readCSD(csd_t* csd);
+  bool readData(uint8_t *dst);
+  bool readOCR(uint32_t* ocr);
+  bool readStart(uint32_t blockNumber);
+  bool readStop();
+  uint8_t sckDivisor() {return m_sckDivisor;}
+  int type() const {return m_type;}
+  bool writeBlock(uint32_t blockNumber, const uint8_t* src);
+  bool writeData(const uint8_t* src);
+  bool writeStart(uint32_t blockNumber, uint32_t eraseCount);
+  bool writeStop();
+
+  // Host only: the image that every Sd2Card reads and writes, as there is only one card socket
+  static bool openImage(const char* path);
+  static bool createImage(const char* path, uint32_t blockCount);
+  static void closeImage();
+
+ private:
+  enum {STATE_IDLE, STATE_READ_MULTIPLE, STATE_WRITE_MULTIPLE};
+
+  bool checkBlock(uint32_t block, uint8_t errorCode);
+  bool imageRead(uint32_t block, uint8_t* dst);
+  bool imageWrite(uint32_t block, const uint8_t* src);
+  bool imageWriteData(uint32_t block, const uint8_t* src);
+  bool isIdle();
+  void type(uint8_t value) {m_type = value;}
+
+  static int m_imageFd;
+  static uint32_t m_imageBlocks;
+  uint32_t m_block;
+  uint8_t m_state;
+  uint8_t m_chipSelectPin;
+  uint8_t m_errorCode;
+  uint8_t m_sckDivisor;
+  uint8_t m_status;
+  uint8_t m_type;
+};
+#endif  // SpiCard_h
@@ -0,0 +1,12 @@
+/*
+ * The host build only needs SdFile from SdFat, the rest of SdFat.h drags in Arduino streams and the SPI driver.
+ */
+#ifndef HOST_SDFAT_H_
+#define HOST_SDFAT_H_
+
+#define DBG_FAIL_MACRO
+
+#include <SdFile.h>
+#include <SdTrace.h>
+
+#endif
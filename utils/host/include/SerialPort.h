@@ -0,0 +1,68 @@
+/*
+ * Host stand-in for Bill Greiman's SerialPort library. The USART is emulated by a thread that reads from a tty (one end
+ * of a pty pair, or a real serial port) and releases each byte into the RX ring buffer only once it would have finished
+ * arriving at the configured baud rate, the way the RX ISR would. The ring buffer has the same capacity as on the AVR,
+ * so bytes are dropped (and SP_RX_BUF_OVERRUN set) exactly when the firmware falls behind.
+ *
+ * TX has no buffer (as the OpenLog is configured): writes block for as long as the bytes would take to shift out.
+ */
+#ifndef HOST_SERIAL_PORT_H_
+#define HOST_SERIAL_PORT_H_
+
+#include <Arduino.h>
+
+#define ENABLE_RX_ERROR_CHECKING 1
+
+static const uint8_t SP_1_STOP_BIT = 0;
+static const uint8_t SP_2_STOP_BIT = 1 << 3;
+static const uint8_t SP_NO_PARITY = 0;
+static const uint8_t SP_8_BIT_CHAR = (1 << 1) | (1 << 2);
+
+static const uint8_t SP_FRAMING_ERROR    = 1 << 4;
+static const uint8_t SP_RX_DATA_OVERRUN  = 1 << 3;
+static const uint8_t SP_PARITY_ERROR     = 1 << 2;
+static const uint8_t SP_RX_BUF_OVERRUN   = 1;
+
+// The emulated USART, implemented in host_uart.cpp
+void hostUartInitRx(uint8_t *buffer, size_t size);
+void hostUartBegin(uint32_t baud, int stopBits);
+size_t hostUartAvailable(void);
+size_t hostUartRead(uint8_t *b, size_t n);
+int hostUartPeek(void);
+void hostUartFlushRx(void);
+size_t hostUartWrite(const uint8_t *b, size_t n);
+uint8_t hostUartGetRxError(void);
+void hostUartClearRxError(void);
+
+template<uint8_t PortNumber, size_t RxBufSize, size_t TxBufSize>
+class SerialPort : public Stream {
+ public:
+  SerialPort() {
+    hostUartInitRx(rxBuffer_, sizeof(rxBuffer_));
+  }
+  int available(void) {return hostUartAvailable();}
+  void begin(uint32_t baud, uint8_t options = SP_8_BIT_CHAR) {
+    hostUartBegin(baud, options & SP_2_STOP_BIT ? 2 : 1);
+  }
+  void clearRxError() {hostUartClearRxError();}
+  uint8_t getRxError() {return hostUartGetRxError();}
+  void end() {flushRx();}
+  void flush() {}
+  void flushRx() {hostUartFlushRx();}
+  void flushTx() {}
+  int peek(void) {return hostUartPeek();}
+  int read() {
+    uint8_t b;
+    return hostUartRead(&b, 1) ? b : -1;
+  }
+  size_t read(uint8_t* b, size_t n) {return hostUartRead(b, n);}
+  size_t write(uint8_t b) {return hostUartWrite(&b, 1);}
+  size_t write(const uint8_t* b, size_t n) {return hostUartWrite(b, n);}
+  size_t write(const char* s) {return hostUartWrite((const uint8_t *) s, strlen(s));}
+
+ private:
+  // One slot always stays empty to tell full from empty, so as in the real library this holds RxBufSize bytes
+  uint8_t rxBuffer_[RxBufSize + 1];
+};
+
+#endif
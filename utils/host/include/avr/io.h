@@ -0,0 +1,2 @@
+// The host build keeps its register stand-ins in Arduino.h
+#include <Arduino.h>
@@ -0,0 +1,2 @@
+// The host build keeps its program memory stand-ins in Arduino.h
+#include <Arduino.h>
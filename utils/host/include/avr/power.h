@@ -0,0 +1,18 @@
+// Peripheral power control has nothing to do on the host
+#ifndef HOST_AVR_POWER_H_
+#define HOST_AVR_POWER_H_
+
+#define power_adc_disable()
+#define power_adc_enable()
+#define power_spi_disable()
+#define power_spi_enable()
+#define power_twi_disable()
+#define power_twi_enable()
+#define power_timer0_disable()
+#define power_timer0_enable()
+#define power_timer1_disable()
+#define power_timer1_enable()
+#define power_timer2_disable()
+#define power_timer2_enable()
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * On the host, sleep_mode() blocks until the emulated UART has received a byte (as the USART RX interrupt would wake
+ * the AVR from idle). It exits the emulator if the serial line hangs up while the receive buffer is empty.
+ */
+#ifndef HOST_AVR_SLEEP_H_
+#define HOST_AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+
+void sleep_mode(void);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ * Event-level model of the OpenLog's ingest pipeline, for capacity planning without hardware.
+ *
+ * The flight controller produces a Blackbox frame every looptime and queues it in its serial TX buffer (skipping the
+ * frame if it doesn't fit, as Blackbox does). Bytes leave its UART back to back at the baud rate. Each byte that
+ * reaches the ATmega328 costs an RX interrupt and goes into the 800 byte SerialPort ring, or is dropped if the ring is
+ * full.
+ *
+ * The main loop mirrors append_file(): drain up to 128 bytes into localBuffer, copy them into SdFat's block cache,
+ * and talk to the card whenever a block fills, a new cluster has to be allocated, or the 5 second sync comes due. Card
+ * commands take as long as the card latency model says (the same model and --card settings as openlog_host), plus
+ * whatever time the RX interrupts steal while they run.
+ *
+ * Many runs with different seeds give the probability that a flight of the given length drops data, along with the
+ * ring occupancy distribution.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <getopt.h>
+
+#include "card_model.h"
+
+#define AVR_CPU_MHZ 16
+
+// AVR cycle costs of the firmware's own work (measured from the generated code, roughly)
+#define RX_ISR_CYCLES 70
+#define SERIAL_READ_CYCLES 50
+#define SERIAL_READ_CYCLES_PER_BYTE 8
+#define SDFAT_WRITE_CYCLES 200
+#define SDFAT_WRITE_CYCLES_PER_BYTE 6
+#define APPEND_LOOP_CYCLES 60
+
+// The SPI clock is F_CPU / 2 at SPI_FULL_SPEED, and SdFat's AVR transfer loop needs about 18 cycles per byte
+#define SPI_CYCLES_PER_BYTE 18
+
+#define SYNC_INTERVAL_US 5000000ULL
+
+#define MAX_QUEUED_FRAMES 1024
+
+typedef struct simOptions_t {
+    int help;
+    int baudRate, stopBits;
+    int looptime;
+    int iInterval, iSize, pSize;
+    int fcBufferSize;
+    int ringSize;
+    int localBufferSize;
+    int clusterBlocks;
+    int isrCycles;
+    int duration;
+    int runs;
+} simOptions_t;
+
+simOptions_t defaultOptions = {
+    .help = 0,
+    .baudRate = 115200, .stopBits = 1,
+    .looptime = 2500,
+    .iInterval = 32, .iSize = 50, .pSize = 22,
+    .fcBufferSize = 256,
+    .ringSize = 800,
+    .localBufferSize = 128,
+    .clusterBlocks = 64,
+    .isrCycles = RX_ISR_CYCLES,
+    .duration = 60,
+    .runs = 20,
+};
+
+simOptions_t options;
+
+cardLatencyModel_t cardLatency;
+
+typedef struct queuedFrame_t {
+    uint32_t id;
+    int remaining;
+} queuedFrame_t;
+
+typedef struct simState_t {
+    double now;
+    double endTime;
+
+    // Flight controller side
+    uint32_t loopIteration;
+    double nextLoopTime;
+    double lineFreeTime;
+    double byteTimeUs;
+    int fcQueuedBytes;
+    queuedFrame_t frames[MAX_QUEUED_FRAMES];
+    int frameHead, frameCount;
+
+    // OpenLog side
+    int ring;
+    uint32_t blockFill;
+    uint32_t blocksInCluster;
+    double lastSync;
+
+    // Results
+    uint64_t bytesSent, bytesDropped;
+    uint32_t framesGenerated, framesSkipped, framesDamaged;
+    uint32_t lastDamagedFrame;
+    bool anyDamaged;
+    uint64_t *occupancy;
+    int maxRing;
+} simState_t;
+
+static void queueFrames(simState_t *state, double until)
+{
+    // Run the flight controller's loop up to the given time, queueing a frame each iteration
+    while (state->nextLoopTime <= until) {
+        int size = state->loopIteration % options.iInterval == 0 ? options.iSize : options.pSize;
+
+        state->framesGenerated++;
+
+        if (state->fcQueuedBytes + size > options.fcBufferSize || state->frameCount == MAX_QUEUED_FRAMES) {
+            state->framesSkipped++;
+        } else {
+            queuedFrame_t *frame = &state->frames[(state->frameHead + state->frameCount) % MAX_QUEUED_FRAMES];
+
+            frame->id = state->loopIteration;
+            frame->remaining = size;
+            state->frameCount++;
+
+            if (state->fcQueuedBytes == 0 && state->lineFreeTime < state->nextLoopTime) {
+                // The line was idle, this frame starts going out now
+                state->lineFreeTime = state->nextLoopTime;
+            }
+            state->fcQueuedBytes += size;
+        }
+
+        state->loopIteration++;
+        state->nextLoopTime += options.looptime;
+    }
+}
+
+/**
+ * When will the next byte finish arriving at the OpenLog's USART?
+ */
+static double nextArrival(simState_t *state)
+{
+    while (true) {
+        queueFrames(state, state->frameCount ? state->lineFreeTime + state->byteTimeUs : state->nextLoopTime);
+
+        if (state->frameCount) {
+            return state->lineFreeTime + state->byteTimeUs;
+        }
+    }
+}
+
+// The RX ISR
+static void receiveByte(simState_t *state)
+{
+    queuedFrame_t *frame = &state->frames[state->frameHead];
+
+    state->lineFreeTime += state->byteTimeUs;
+    state->fcQueuedBytes--;
+    state->bytesSent++;
+
+    if (state->ring >= options.ringSize) {
+        state->bytesDropped++;
+
+        if (!state->anyDamaged || state->lastDamagedFrame != frame->id) {
+            state->framesDamaged++;
+            state->lastDamagedFrame = frame->id;
+            state->anyDamaged = true;
+        }
+    } else {
+        state->ring++;
+    }
+
+    state->occupancy[state->ring]++;
+
+    if (state->ring > state->maxRing) {
+        state->maxRing = state->ring;
+    }
+
+    if (--frame->remaining == 0) {
+        state->frameHead = (state->frameHead + 1) % MAX_QUEUED_FRAMES;
+        state->frameCount--;
+    }
+}
+
+/**
+ * Spend the given amount of main-loop time, stretched by the RX interrupts that arrive while we're at it.
+ */
+static void runMainLoop(simState_t *state, double workUs)
+{
+    double end = state->now + workUs;
+    double isrUs = (double) options.isrCycles / AVR_CPU_MHZ;
+
+    while (true) {
+        double arrival = nextArrival(state);
+
+        if (arrival > end)
+            break;
+
+        receiveByte(state);
+        end += isrUs;
+    }
+
+    state->now = end;
+}
+
+static void waitForData(simState_t *state)
+{
+    double arrival = nextArrival(state);
+
+    if (arrival > state->now) {
+        state->now = arrival;
+    }
+
+    runMainLoop(state, 0);
+}
+
+static void cardCommand(simState_t *state, cardOp_e op, uint32_t blocks)
+{
+    // Bring the card's clock up to date with ours, then see how long the command keeps us waiting
+    uint64_t now = (uint64_t) state->now;
+
+    if (cardModelMicros() < now) {
+        cardModelAdvance(now - cardModelMicros());
+    }
+
+    uint64_t start = cardModelMicros();
+
+    cardModelCommand(op, blocks);
+
+    runMainLoop(state, cardModelMicros() - start);
+}
+
+// SdFat's single block cache on the ATmega328: data, FAT and directory blocks all take turns in it
+static void sdfatWrite(simState_t *state, int n)
+{
+    runMainLoop(state, (SDFAT_WRITE_CYCLES + (double) SDFAT_WRITE_CYCLES_PER_BYTE * n) / AVR_CPU_MHZ);
+
+    state->blockFill += n;
+
+    while (state->blockFill >= 512) {
+        state->blockFill -= 512;
+
+        // The full data block is written out when the cache moves on to the next one
+        cardCommand(state, CARD_OP_WRITE_BLOCK, 1);
+
+        if (++state->blocksInCluster == (uint32_t) options.clusterBlocks) {
+            state->blocksInCluster = 0;
+
+            // Allocating the next cluster reads a FAT block then writes it back to both FATs
+            cardCommand(state, CARD_OP_READ_BLOCK, 1);
+            cardCommand(state, CARD_OP_WRITE_BLOCK, 1);
+            cardCommand(state, CARD_OP_WRITE_BLOCK, 1);
+        }
+    }
+}
+
+static void sdfatSync(simState_t *state)
+{
+    // Flush the data block, update the directory entry, then fetch the partial data block back into the cache
+    cardCommand(state, CARD_OP_WRITE_BLOCK, 1);
+    cardCommand(state, CARD_OP_READ_BLOCK, 1);
+    cardCommand(state, CARD_OP_WRITE_BLOCK, 1);
+    cardCommand(state, CARD_OP_READ_BLOCK, 1);
+}
+
+static void runSimulation(simState_t *state, uint32_t seed)
+{
+    cardLatencyModel_t model = cardLatency;
+
+    model.seed = seed;
+    cardModelConfigure(&model, false);
+    cardModelResetStats();
+
+    state->byteTimeUs = (1000000.0 * (1 + 8 + options.stopBits)) / options.baudRate;
+    state->endTime = options.duration * 1000000.0;
+
+    while (state->now < state->endTime) {
+        if (state->ring == 0) {
+            waitForData(state);
+            continue;
+        }
+
+        int n = state->ring < options.localBufferSize ? state->ring : options.localBufferSize;
+
+        runMainLoop(state, (APPEND_LOOP_CYCLES + SERIAL_READ_CYCLES + (double) SERIAL_READ_CYCLES_PER_BYTE * n) / AVR_CPU_MHZ);
+        state->ring -= n;
+
+        sdfatWrite(state, n);
+
+        if (state->now - state->lastSync > SYNC_INTERVAL_US) {
+            sdfatSync(state);
+            state->lastSync = state->now;
+        }
+    }
+}
+
+static uint32_t occupancyPercentile(const uint64_t *occupancy, uint64_t total, double fraction)
+{
+    uint64_t target = (uint64_t) (total * fraction), seen = 0;
+
+    for (int i = 0; i <= options.ringSize; i++) {
+        seen += occupancy[i];
+
+        if (seen > target)
+            return i;
+    }
+
+    return options.ringSize;
+}
+
+static void simulate()
+{
+    uint64_t *occupancy = (uint64_t*) calloc(options.ringSize + 1, sizeof(*occupancy));
+    uint64_t totalSent = 0, totalDropped = 0, samples = 0;
+    uint32_t totalFrames = 0, totalSkipped = 0, totalDamaged = 0;
+    int runsWithLoss = 0, worstRing = 0;
+    double byteRate = (double) (options.iSize + (options.iInterval - 1) * options.pSize) / options.iInterval
+        * (1000000.0 / options.looptime);
+    double lineRate = (double) options.baudRate / (1 + 8 + options.stopBits);
+
+    cardModelConfigure(&cardLatency, false);
+    cardModelPrintSettings(stdout);
+    printf("%d baud, looptime %d us, frames I %d/P %d bytes (I every %d), %.0f bytes/s offered, line capacity %.0f bytes/s\n",
+        options.baudRate, options.looptime, options.iSize, options.pSize, options.iInterval, byteRate, lineRate);
+    printf("RX ring %d bytes, local buffer %d bytes, %d blocks per cluster, %d runs of %d seconds\n\n",
+        options.ringSize, options.localBufferSize, options.clusterBlocks, options.runs, options.duration);
+
+    for (int run = 0; run < options.runs; run++) {
+        simState_t state;
+
+        memset(&state, 0, sizeof(state));
+        state.occupancy = occupancy;
+
+        runSimulation(&state, cardLatency.seed + run);
+
+        if (state.bytesDropped) {
+            runsWithLoss++;
+        }
+        if (state.maxRing > worstRing) {
+            worstRing = state.maxRing;
+        }
+
+        totalSent += state.bytesSent;
+        totalDropped += state.bytesDropped;
+        totalFrames += state.framesGenerated;
+        totalSkipped += state.framesSkipped;
+        totalDamaged += state.framesDamaged;
+    }
+
+    for (int i = 0; i <= options.ringSize; i++) {
+        samples += occupancy[i];
+    }
+
+    if (samples == 0) {
+        printf("No data arrived\n");
+        free(occupancy);
+        return;
+    }
+
+    printf("Ring occupancy at each arrival: median %u, 99th percentile %u, 99.9th %u, max %d of %d bytes\n",
+        occupancyPercentile(occupancy, samples, 0.5), occupancyPercentile(occupancy, samples, 0.99),
+        occupancyPercentile(occupancy, samples, 0.999), worstRing, options.ringSize);
+    printf("Bytes dropped by the OpenLog: %llu of %llu (%.4f%%)\n", (unsigned long long) totalDropped,
+        (unsigned long long) totalSent, (100.0 * totalDropped) / totalSent);
+    printf("Frames damaged by the OpenLog: %u of %u (%.4f%%)\n", totalDamaged, totalFrames - totalSkipped,
+        (100.0 * totalDamaged) / (totalFrames - totalSkipped));
+    printf("Frames skipped by the flight controller (serial port saturated): %u of %u (%.4f%%)\n", totalSkipped,
+        totalFrames, (100.0 * totalSkipped) / totalFrames);
+    printf("Probability of a %d second flight dropping data: %.1f%% (%d of %d runs)\n", options.duration,
+        (100.0 * runsWithLoss) / options.runs, runsWithLoss, options.runs);
+
+    free(occupancy);
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "OpenLog ingest pipeline simulator\n\n"
+        "Usage:\n"
+        "     %s [options]\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --baud <num>           Serial baud rate (default %d)\n"
+        "   --stopbits <1|2>       Stop bits (default %d)\n"
+        "   --looptime <us>        Blackbox frame interval (default %d us)\n"
+        "   --i-interval <num>     One I frame every this many frames (default %d)\n"
+        "   --i-size <bytes>       I frame size (default %d)\n"
+        "   --p-size <bytes>       P frame size (default %d)\n"
+        "   --fc-buffer <bytes>    Flight controller serial TX buffer (default %d)\n"
+        "   --ring <bytes>         OpenLog RX ring buffer size (default %d)\n"
+        "   --local-buffer <bytes> append_file() localBuffer size (default %d)\n"
+        "   --cluster <blocks>     Blocks per cluster on the card (default %d)\n"
+        "   --isr-cycles <num>     RX interrupt cost in CPU cycles (default %d)\n"
+        "   --card <settings>      Card latency model, see openlog_host --help (the SPI\n"
+        "                          transfer time defaults to SPI_FULL_SPEED's %d us/block)\n"
+        "   --duration <seconds>   Length of each simulated flight (default %d)\n"
+        "   --runs <num>           Number of flights to simulate (default %d)\n"
+        "\n", argv0, defaultOptions.baudRate, defaultOptions.stopBits, defaultOptions.looptime,
+        defaultOptions.iInterval, defaultOptions.iSize, defaultOptions.pSize, defaultOptions.fcBufferSize,
+        defaultOptions.ringSize, defaultOptions.localBufferSize, defaultOptions.clusterBlocks, defaultOptions.isrCycles,
+        512 * SPI_CYCLES_PER_BYTE / AVR_CPU_MHZ, defaultOptions.duration, defaultOptions.runs
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    enum {
+        SETTING_BAUDRATE = 1,
+        SETTING_STOPBITS,
+        SETTING_LOOPTIME,
+        SETTING_I_INTERVAL,
+        SETTING_I_SIZE,
+        SETTING_P_SIZE,
+        SETTING_FC_BUFFER,
+        SETTING_RING,
+        SETTING_LOCAL_BUFFER,
+        SETTING_CLUSTER,
+        SETTING_ISR_CYCLES,
+        SETTING_CARD,
+        SETTING_DURATION,
+        SETTING_RUNS,
+    };
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"baud", required_argument, 0, SETTING_BAUDRATE},
+            {"stopbits", required_argument, 0, SETTING_STOPBITS},
+            {"looptime", required_argument, 0, SETTING_LOOPTIME},
+            {"i-interval", required_argument, 0, SETTING_I_INTERVAL},
+            {"i-size", required_argument, 0, SETTING_I_SIZE},
+            {"p-size", required_argument, 0, SETTING_P_SIZE},
+            {"fc-buffer", required_argument, 0, SETTING_FC_BUFFER},
+            {"ring", required_argument, 0, SETTING_RING},
+            {"local-buffer", required_argument, 0, SETTING_LOCAL_BUFFER},
+            {"cluster", required_argument, 0, SETTING_CLUSTER},
+            {"isr-cycles", required_argument, 0, SETTING_ISR_CYCLES},
+            {"card", required_argument, 0, SETTING_CARD},
+            {"duration", required_argument, 0, SETTING_DURATION},
+            {"runs", required_argument, 0, SETTING_RUNS},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+        int value;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        if (c == SETTING_CARD) {
+            if (!cardModelParse(optarg, &cardLatency)) {
+                fprintf(stderr, "Couldn't understand card latency settings '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            case '?':
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+            default:
+                // All the remaining settings are positive integers
+                value = atoi(optarg);
+
+                if (value <= 0) {
+                    fprintf(stderr, "%s: option '%s' must be greater than zero\n", argv[0], argv[optind - 2]);
+                    exit(EXIT_FAILURE);
+                }
+
+                switch (c) {
+                    case SETTING_BAUDRATE: options.baudRate = value; break;
+                    case SETTING_STOPBITS: options.stopBits = value; break;
+                    case SETTING_LOOPTIME: options.looptime = value; break;
+                    case SETTING_I_INTERVAL: options.iInterval = value; break;
+                    case SETTING_I_SIZE: options.iSize = value; break;
+                    case SETTING_P_SIZE: options.pSize = value; break;
+                    case SETTING_FC_BUFFER: options.fcBufferSize = value; break;
+                    case SETTING_RING: options.ringSize = value; break;
+                    case SETTING_LOCAL_BUFFER: options.localBufferSize = value; break;
+                    case SETTING_CLUSTER: options.clusterBlocks = value; break;
+                    case SETTING_ISR_CYCLES: options.isrCycles = value; break;
+                    case SETTING_DURATION: options.duration = value; break;
+                    case SETTING_RUNS: options.runs = value; break;
+                }
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    options = defaultOptions;
+
+    cardLatency = cardLatencyIdeal;
+    cardLatency.transferUs = 512 * SPI_CYCLES_PER_BYTE / AVR_CPU_MHZ;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (options.iSize > options.fcBufferSize || options.pSize > options.fcBufferSize) {
+        fprintf(stderr, "Frames must fit in the flight controller's TX buffer\n");
+        return EXIT_FAILURE;
+    }
+
+    simulate();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+/*
+ * Builds the OpenLog sketch for the host. The Arduino IDE generates prototypes for every function in a sketch before
+ * compiling it, so we have to do the same here: keep this list in step with the sketch.
+ */
+#include <Arduino.h>
+#include <SdFat.h>
+
+int freeRam();
+void printRam();
+void systemError(byte error_type);
+void setup(void);
+void loop(void);
+char* newlog(void);
+void append_file(char* file_name, const byte *replay, byte replayLength);
+boolean recover_log(SdFile *file);
+byte detect_baud(byte *buffer);
+void save_detected_baud(void);
+uint16_t write_log(SdFile *file, const byte *buffer, byte n);
+void write_timestamp(SdFile *file, byte type, byte n);
+uint16_t write_encoded(SdFile *file, const byte *buffer, byte n);
+boolean write_card(SdFile *file, const byte *buffer, uint16_t n);
+boolean write_compressed(SdFile *file, const byte *buffer, byte n);
+boolean flush_compressed(SdFile *file);
+boolean write_compressed_run(SdFile *file, byte value, uint16_t length);
+boolean write_compressed_literals(SdFile *file, const byte *buffer, byte n);
+boolean write_compressed_token(SdFile *file, const byte *token, byte length);
+boolean write_framed(SdFile *file, const byte *buffer, byte n);
+boolean end_frame(SdFile *file);
+void sync_log(SdFile *file, boolean endFrame);
+void dump_sd_trace(void);
+void restart_verify(SdFile *file);
+void verify_log(SdFile *file, byte *buffer, byte size);
+uint16_t log_session_data(SdFile *file, byte *buffer, byte n);
+uint16_t write_held_intro(SdFile *file);
+void start_new_log(SdFile *file);
+void open_next_log(SdFile *current);
+void add_index_entry(uint32_t offset);
+void flush_index(SdFile *file);
+void charge_log_clusters(SdFile *file);
+boolean log_number(const char *name, uint16_t *number);
+void free_deleted_clusters(uint32_t budget, boolean erase);
+void erase_free_space(uint16_t budgetMsec);
+void save_erase_cursor(void);
+void find_oldest_log(void);
+boolean recycle_oldest_log(SdFile *file);
+void report_logged(uint32_t bytesLogged);
+boolean command_mode_requested(void);
+void command_shell(void);
+void command_list(void);
+void command_read(char *args);
+uint16_t stream_file(SdFile *file, uint32_t offset);
+void blink_error(byte ERROR_TYPE);
+void set_default_settings(void);
+void read_system_settings(void);
+void read_config_file(void);
+void record_config_file(void);
+void writeBaud(long uartRate);
+long readBaud(void);
+uint32_t strtolong(const char* str);
+
+#include "../../OpenLog_v3_Blackbox/OpenLog_v3_Blackbox.ino"
@@ -0,0 +1,30 @@
+#ifndef OPENLOG_FIRMWARE_H_
+#define OPENLOG_FIRMWARE_H_
+
+// The entry points of the OpenLog sketch that the host emulator drives (see openlog_firmware.cpp)
+void setup(void);
+void loop(void);
+void writeBaud(long uartRate);
+
+// Used by recovery_test to break the card under the firmware
+extern Sd2Card card;
+extern SdVolume volume;
+extern SdFile currentDirectory;
+extern int32_t freeClusters;
+boolean recover_log(SdFile *file);
+uint16_t write_log(SdFile *file, const byte *buffer, byte n);
+void sync_log(SdFile *file, boolean endFrame);
+void free_deleted_clusters(uint32_t budget, boolean erase);
+
+// Used by rotation_test to switch logs across boots
+extern SdFile nextLogFile;
+char* newlog(void);
+void open_next_log(SdFile *current);
+void start_new_log(SdFile *file);
+
+// Used by verify_test to read the log back between appends
+extern uint16_t verifyFailures;
+void restart_verify(SdFile *file);
+void verify_log(SdFile *file, byte *buffer, byte size);
+
+#endif
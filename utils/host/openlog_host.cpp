@@ -0,0 +1,410 @@
+/*
+ * Runs the OpenLog firmware on the host, logging to a FAT-formatted disk image instead of an SD card. The emulated
+ * UART is connected to a tty (typically the slave side of a pty that blackbox_bench --loopback created), and paces the
+ * bytes it receives at the configured baud rate (or the --line-baud rate) so the firmware sees the same arrival rate it
+ * would on the hardware.
+ *
+ * The emulator exits once the tty hangs up and the firmware has gone idle (and so synced its log).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <getopt.h>
+
+#include <SdFat.h>
+#include <EEPROM.h>
+
+#include "../src/serial.h"
+#include "card_format.h"
+#include "card_model.h"
+#include "host_uart.h"
+#include "openlog_firmware.h"
+
+typedef struct hostOptions_t {
+    int help;
+    int extractLast;
+    int imageSizeMB;
+    int fatType;
+    int cardStats;
+    long baudRate;
+    long lineBaudRate;
+    const char *device;
+    const char *imageFilename;
+    const char *eepromFilename;
+    const char *extractFilename;
+} hostOptions_t;
+
+hostOptions_t defaultOptions = {
+    .help = 0,
+    .extractLast = 0,
+    .imageSizeMB = 256,
+    .fatType = 0,
+    .cardStats = 0,
+    .baudRate = 0,
+    .lineBaudRate = 0,
+    .device = NULL,
+    .imageFilename = NULL,
+    .eepromFilename = NULL,
+    .extractFilename = NULL,
+};
+
+hostOptions_t options;
+
+cardLatencyModel_t cardLatency;
+
+/**
+ * Open the card image, or create and format a new one if the file doesn't exist yet or is empty.
+ */
+static bool openCardImage(const char *filename)
+{
+    struct stat st;
+
+    if (stat(filename, &st) == 0 && st.st_size > 0) {
+        if (!Sd2Card::openImage(filename)) {
+            fprintf(stderr, "Couldn't open card image '%s'\n", filename);
+            return false;
+        }
+
+        return true;
+    }
+
+    fprintf(stderr, "Creating %d MB card image '%s'...\n", options.imageSizeMB, filename);
+
+    if (!Sd2Card::createImage(filename, (uint32_t) options.imageSizeMB * 2048)) {
+        fprintf(stderr, "Couldn't create card image '%s'\n", filename);
+        return false;
+    }
+
+    Sd2Card card;
+
+    if (!card.init() || !formatCard(&card, options.fatType)) {
+        fprintf(stderr, "Couldn't format card image '%s'\n", filename);
+        return false;
+    }
+
+    return true;
+}
+
+static bool openRootDirectory(SdFile *root)
+{
+    static Sd2Card card;
+    static SdVolume volume;
+
+    if (!card.init()) {
+        fprintf(stderr, "card.init failed, error 0x%X\n", card.errorCode());
+        return false;
+    }
+    if (!volume.init(&card)) {
+        fprintf(stderr, "volume.init failed\n");
+        return false;
+    }
+    if (!root->openRoot(&volume)) {
+        fprintf(stderr, "openRoot failed\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Find the highest numbered non-empty LOGnnnnn.TXT in the root directory (the most recent log). Returns false if there
+ * isn't one.
+ */
+static bool findLastLog(SdFile *root, char *filename)
+{
+    dir_t entry;
+    long bestNumber = -1;
+
+    root->rewind();
+
+    while (root->readDir(&entry) > 0) {
+        long number = 0;
+        int i;
+
+        if (!DIR_IS_FILE(&entry) || entry.fileSize == 0
+                || memcmp(entry.name, "LOG", 3) != 0 || memcmp(entry.name + 8, "TXT", 3) != 0) {
+            continue;
+        }
+
+        for (i = 3; i < 8 && entry.name[i] >= '0' && entry.name[i] <= '9'; i++) {
+            number = number * 10 + (entry.name[i] - '0');
+        }
+
+        if (i == 8 && number > bestNumber) {
+            bestNumber = number;
+            SdBaseFile::dirName(entry, filename);
+        }
+    }
+
+    return bestNumber != -1;
+}
+
+/**
+ * Copy a file from the card image to stdout.
+ */
+static bool extractFile(const char *filename, bool last)
+{
+    SdFile root, file;
+    char lastFilename[13];
+    uint8_t buffer[512];
+    int bytesRead;
+
+    if (!openRootDirectory(&root))
+        return false;
+
+    if (last) {
+        if (!findLastLog(&root, lastFilename)) {
+            fprintf(stderr, "No logs found on the card\n");
+            return false;
+        }
+
+        filename = lastFilename;
+        fprintf(stderr, "Extracting %s\n", filename);
+    }
+
+    if (!file.open(&root, filename, O_READ)) {
+        fprintf(stderr, "Couldn't open '%s' on the card\n", filename);
+        return false;
+    }
+
+    while ((bytesRead = file.read(buffer, sizeof(buffer))) > 0) {
+        if (fwrite(buffer, 1, bytesRead, stdout) != (size_t) bytesRead) {
+            return false;
+        }
+    }
+
+    return bytesRead == 0;
+}
+
+static void printCardStats(void)
+{
+    cardModelPrintStats(stderr);
+}
+
+static bool runFirmware(const char *device)
+{
+    int fd = serial_open(device, 115200, 1, NULL);
+
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't open '%s'\n", device);
+        return false;
+    }
+
+    if (!hostUartAttach(fd)) {
+        fprintf(stderr, "Couldn't start the UART receiver\n");
+        return false;
+    }
+
+    if (options.baudRate) {
+        writeBaud(options.baudRate);
+    }
+
+    hostUartSetLineBaud(options.lineBaudRate);
+
+    // The firmware has to keep up with the UART in real time, so card commands really take as long as the model says
+    cardModelConfigure(&cardLatency, true);
+    cardModelResetStats();
+
+    if (options.cardStats) {
+        cardModelPrintSettings(stderr);
+        atexit(printCardStats);
+    }
+
+    setup();
+
+    while (true) {
+        loop();
+    }
+
+    return true;
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "OpenLog firmware host emulator\n\n"
+        "Usage:\n"
+        "     %s --image <filename> [options]\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --image <filename>     SD card image to log to, a new one is created and\n"
+        "                          formatted if the file doesn't exist or is empty\n"
+        "   --image-size <MB>      Size of a new card image (default %d MB), images\n"
+        "                          over 2048 MB are SDHC cards\n"
+        "   --fat <16|32>          Filesystem for a new card image (default FAT16 for\n"
+        "                          2GB and smaller, FAT32 for SDHC)\n"
+        "   --device <filename>    Serial port or pty to run the firmware on\n"
+        "   --baud <num>           Store this baud rate in EEPROM before booting\n"
+        "   --line-baud <num>      Baud rate the sender really uses, when it doesn't\n"
+        "                          match the firmware's setting\n"
+        "   --eeprom <filename>    File to keep the emulated EEPROM in between runs\n"
+        "   --card <settings>      Card latency model, comma separated microsecond timings\n"
+        "                          (default all zero):\n"
+        "                            cmd=<us>     per command overhead\n"
+        "                            xfer=<us>    SPI transfer time per block\n"
+        "                            read=<us>    access time per block read\n"
+        "                            mread=<us>   access time per block after the first\n"
+        "                                         of a multi-block read (default read)\n"
+        "                            write=<us>   busy time after a single block write\n"
+        "                            mwrite=<us>  busy time per block of a multi-block write\n"
+        "                            erase=<us>   busy time per block erased\n"
+        "                            gc=<p>:<min>-<max>  chance of a garbage collection\n"
+        "                                         stall after each block written\n"
+        "                            dropout=<p>:<min>-<max>  chance of the card\n"
+        "                                         dropping off the bus during each\n"
+        "                                         block written, until it's initialised\n"
+        "                                         again at least <min>-<max> us later\n"
+        "                            corrupt=<p>  chance of each block written being\n"
+        "                                         stored with a bit flipped\n"
+        "                            seed=<n>     random seed for the stalls\n"
+        "   --card-stats           Print card command counts and timings on exit\n"
+        "   --extract <name>       Copy a file from the card image to stdout\n"
+        "   --extract-last         Copy the most recent non-empty log to stdout\n"
+        "\n", argv0, defaultOptions.imageSizeMB
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    enum {
+        SETTING_IMAGE = 1,
+        SETTING_IMAGE_SIZE,
+        SETTING_FAT,
+        SETTING_DEVICE,
+        SETTING_BAUDRATE,
+        SETTING_LINE_BAUDRATE,
+        SETTING_EEPROM,
+        SETTING_EXTRACT,
+        SETTING_CARD,
+    };
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"image", required_argument, 0, SETTING_IMAGE},
+            {"image-size", required_argument, 0, SETTING_IMAGE_SIZE},
+            {"fat", required_argument, 0, SETTING_FAT},
+            {"device", required_argument, 0, SETTING_DEVICE},
+            {"baud", required_argument, 0, SETTING_BAUDRATE},
+            {"line-baud", required_argument, 0, SETTING_LINE_BAUDRATE},
+            {"eeprom", required_argument, 0, SETTING_EEPROM},
+            {"extract", required_argument, 0, SETTING_EXTRACT},
+            {"extract-last", no_argument, &options.extractLast, 1},
+            {"card", required_argument, 0, SETTING_CARD},
+            {"card-stats", no_argument, &options.cardStats, 1},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case SETTING_IMAGE:
+                options.imageFilename = optarg;
+            break;
+            case SETTING_IMAGE_SIZE:
+                options.imageSizeMB = atoi(optarg);
+
+                if (options.imageSizeMB < 8) {
+                    fprintf(stderr, "Card images must be at least 8 MB\n");
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case SETTING_FAT:
+                options.fatType = atoi(optarg);
+
+                if (options.fatType != 16 && options.fatType != 32) {
+                    fprintf(stderr, "FAT type must be 16 or 32\n");
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case SETTING_DEVICE:
+                options.device = optarg;
+            break;
+            case SETTING_BAUDRATE:
+                options.baudRate = atol(optarg);
+            break;
+            case SETTING_LINE_BAUDRATE:
+                options.lineBaudRate = atol(optarg);
+            break;
+            case SETTING_EEPROM:
+                options.eepromFilename = optarg;
+            break;
+            case SETTING_EXTRACT:
+                options.extractFilename = optarg;
+            break;
+            case SETTING_CARD:
+                if (!cardModelParse(optarg, &cardLatency)) {
+                    fprintf(stderr, "Couldn't understand card latency settings '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            default:
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    options = defaultOptions;
+    cardLatency = cardLatencyIdeal;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help || !options.imageFilename) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (options.extractFilename || options.extractLast) {
+        if (!Sd2Card::openImage(options.imageFilename)) {
+            fprintf(stderr, "Couldn't open card image '%s'\n", options.imageFilename);
+            return EXIT_FAILURE;
+        }
+
+        return extractFile(options.extractFilename, options.extractLast) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!options.device) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!openCardImage(options.imageFilename)) {
+        return EXIT_FAILURE;
+    }
+
+    if (options.eepromFilename && !EEPROM.attachFile(options.eepromFilename)) {
+        fprintf(stderr, "Couldn't open EEPROM file '%s'\n", options.eepromFilename);
+        return EXIT_FAILURE;
+    }
+
+    return runFirmware(options.device) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
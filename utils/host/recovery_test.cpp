@@ -0,0 +1,148 @@
+/*
+ * Checks that the firmware's recover_log() keeps a deferred delete going across the card being initialised again.
+ *
+ * An old log is deleted with removeDeferred() and partly freed, then the card drops off the bus in the middle of
+ * writing the current log. Once recover_log() has the log open again, the rest of the old log's clusters must still be
+ * freed, and the firmware's count of free clusters must still match the FAT.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <SdFat.h>
+#include <EEPROM.h>
+
+#include "card_format.h"
+#include "card_model.h"
+#include "openlog_firmware.h"
+
+#define IMAGE_SIZE_MB 64
+#define OLD_LOG_SIZE (2 * 1024 * 1024)
+#define PARTIAL_FREE_CLUSTERS 8
+
+// The EEPROM location of the firmware's recycle setting, which has to be on for it to keep count of free clusters
+#define LOCATION_RECYCLE 0x14
+
+static bool fail(const char *reason)
+{
+    fprintf(stderr, "FAIL: %s\n", reason);
+    return false;
+}
+
+static bool writeOldLog(void)
+{
+    SdFile oldLog;
+    uint8_t block[512];
+
+    memset(block, 0x55, sizeof(block));
+
+    if (!oldLog.open(&currentDirectory, "OLD.TXT", O_CREAT | O_WRITE))
+        return fail("couldn't create the old log");
+
+    for (uint32_t written = 0; written < OLD_LOG_SIZE; written += sizeof(block)) {
+        if (oldLog.write(block, sizeof(block)) != sizeof(block))
+            return fail("couldn't write the old log");
+    }
+
+    return oldLog.close();
+}
+
+static bool runTest(void)
+{
+    cardLatencyModel_t dropout = cardLatencyIdeal;
+    SdFile oldLog, log;
+    uint8_t data[128];
+
+    EEPROM.write(LOCATION_RECYCLE, 1);
+    setup();
+
+    if (!writeOldLog())
+        return false;
+
+    // The old log was written behind the firmware's back
+    freeClusters = volume.freeClusterCount();
+
+    if (!log.open(&currentDirectory, "LOG.TXT", O_CREAT | O_APPEND | O_WRITE))
+        return fail("couldn't create the log");
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = i;
+    for (int i = 0; i < 64; i++)
+        write_log(&log, data, sizeof(data));
+
+    if (!oldLog.open(&currentDirectory, "OLD.TXT", O_WRITE) || !oldLog.removeDeferred())
+        return fail("couldn't delete the old log");
+
+    free_deleted_clusters(PARTIAL_FREE_CLUSTERS, false);
+    sync_log(&log, false);
+
+    if (!volume.freeChainPending())
+        return fail("the old log was freed in one step");
+
+    // The card drops out on the next block written, and comes back as soon as it's initialised again
+    dropout.dropoutProbability = 1;
+    cardModelConfigure(&dropout, false);
+
+    for (int i = 0; i < 1024 && !log.getWriteError(); i++)
+        write_log(&log, data, sizeof(data));
+
+    cardModelConfigure(&cardLatencyIdeal, false);
+
+    if (!log.getWriteError())
+        return fail("the write never failed");
+    if (!recover_log(&log))
+        return fail("recover_log() couldn't reopen the log");
+    if (!volume.freeChainPending())
+        return fail("the rest of the old log was forgotten");
+
+    while (volume.freeChainPending())
+        free_deleted_clusters(64, false);
+
+    write_log(&log, data, sizeof(data));
+    sync_log(&log, false);
+
+    int32_t cardFree = volume.freeClusterCount();
+
+    if (freeClusters != cardFree) {
+        fprintf(stderr, "FAIL: the firmware counts %ld free clusters, the FAT has %ld\n", (long) freeClusters,
+            (long) cardFree);
+        return false;
+    }
+
+    return true;
+}
+
+int main(void)
+{
+    char imageFilename[] = "/tmp/recovery_test.XXXXXX";
+    int fd = mkstemp(imageFilename);
+    bool success;
+
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't create a temporary card image\n");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    cardModelConfigure(&cardLatencyIdeal, false);
+
+    Sd2Card formatter;
+
+    success = Sd2Card::createImage(imageFilename, (uint32_t) IMAGE_SIZE_MB * 2048)
+        && formatter.init() && formatCard(&formatter, 0);
+
+    if (!success)
+        fprintf(stderr, "Couldn't format the card image\n");
+    else
+        success = runTest();
+
+    Sd2Card::closeImage();
+    unlink(imageFilename);
+
+    if (success)
+        printf("recover_log() kept the deferred delete going\n");
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
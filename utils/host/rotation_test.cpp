@@ -0,0 +1,142 @@
+/*
+ * Checks that rotating to a new log for each Blackbox session never reopens the log being written, across two boots.
+ *
+ * The first boot logs a session and gets the next log ready, then loses power. The second boot's newlog() reuses that
+ * empty file, and the next log is got ready again while the log is still empty. After the next session header the
+ * first session must still be in its own file, with the second session in a different one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <SdFat.h>
+#include <EEPROM.h>
+
+#include "card_format.h"
+#include "card_model.h"
+#include "openlog_firmware.h"
+
+#define IMAGE_SIZE_MB 64
+#define SESSION_WRITES 100
+
+// The EEPROM locations of the number the firmware's next log search starts from
+#define LOCATION_FILE_NUMBER_LSB 0x03
+#define LOCATION_FILE_NUMBER_MSB 0x04
+
+static bool fail(const char *reason)
+{
+    fprintf(stderr, "FAIL: %s\n", reason);
+    return false;
+}
+
+// Opens the log newlog() picks as append_file() does
+static bool openLog(SdFile *log)
+{
+    if (!log->open(&currentDirectory, newlog(), O_CREAT | O_APPEND | O_RDWR))
+        return fail("couldn't open the log");
+
+    log->rewind();
+    log->sync();
+
+    return true;
+}
+
+static void writeSession(SdFile *log, uint8_t fill)
+{
+    uint8_t data[128];
+
+    memset(data, fill, sizeof(data));
+    for (int i = 0; i < SESSION_WRITES; i++)
+        write_log(log, data, sizeof(data));
+
+    sync_log(log, false);
+}
+
+static bool runTest(void)
+{
+    SdFile log, firstLog;
+    char firstName[13], name[13];
+
+    // First boot: a session, then the next log is opened while idle and the power goes
+    setup();
+    if (!openLog(&log))
+        return false;
+    writeSession(&log, 0x11);
+    open_next_log(&log);
+
+    log = SdFile();
+    nextLogFile = SdFile();
+
+    // Second boot: newlog() reuses the empty file, and we go idle before any data arrives
+    setup();
+    if (!openLog(&log) || !log.getFilename(firstName))
+        return false;
+    if (strcmp(firstName, "LOG00001.TXT") != 0)
+        return fail("the second boot didn't reuse the empty log");
+
+    open_next_log(&log);
+    if (!nextLogFile.getFilename(name) || strcmp(name, firstName) == 0)
+        return fail("the next log is the log being written");
+
+    writeSession(&log, 0x22);
+    uint32_t firstSize = log.fileSize();
+
+    // The next session header
+    start_new_log(&log);
+    writeSession(&log, 0x33);
+
+    if (!log.getFilename(name) || strcmp(name, firstName) == 0)
+        return fail("the second session went into the first session's log");
+
+    if (!firstLog.open(&currentDirectory, firstName, O_READ))
+        return fail("couldn't reopen the first session's log");
+    if (firstLog.fileSize() != firstSize) {
+        fprintf(stderr, "FAIL: the first session's log was %lu bytes, it's now %lu\n", (unsigned long) firstSize,
+            (unsigned long) firstLog.fileSize());
+        return false;
+    }
+    firstLog.close();
+
+    // The file number has moved past the log we switched to, so the next boot won't pick it
+    uint16_t fileNumber = EEPROM.read(LOCATION_FILE_NUMBER_LSB) | (EEPROM.read(LOCATION_FILE_NUMBER_MSB) << 8);
+
+    if (fileNumber != (uint16_t) (atoi(name + 3) + 1))
+        return fail("the file number in EEPROM wasn't moved past the new log");
+
+    return true;
+}
+
+int main(void)
+{
+    char imageFilename[] = "/tmp/rotation_test.XXXXXX";
+    int fd = mkstemp(imageFilename);
+    bool success;
+
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't create a temporary card image\n");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    cardModelConfigure(&cardLatencyIdeal, false);
+
+    Sd2Card formatter;
+
+    success = Sd2Card::createImage(imageFilename, (uint32_t) IMAGE_SIZE_MB * 2048)
+        && formatter.init() && formatCard(&formatter, 0);
+
+    if (!success)
+        fprintf(stderr, "Couldn't format the card image\n");
+    else
+        success = runTest();
+
+    Sd2Card::closeImage();
+    unlink(imageFilename);
+
+    if (success)
+        printf("Log rotation kept each session in its own file across two boots\n");
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
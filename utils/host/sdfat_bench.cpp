@@ -0,0 +1,351 @@
+/*
+ * Repeatable benchmark of SdFat's append path against the host Sd2Card and its latency model.
+ *
+ * This drives SdFile the way the firmware's append_file() does: open a new log with O_CREAT | O_APPEND | O_WRITE,
+ * allocate its first cluster, then write the incoming stream in localBuffer-sized chunks, syncing every 5 seconds.
+ * Card commands only advance the model's virtual clock, so the results depend only on the settings and the seed.
+ *
+ * For each write() we record how long the firmware would have been stuck in it, which is what decides whether the
+ * serial ring buffer overflows.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <getopt.h>
+
+#include <SdFat.h>
+
+#include "card_format.h"
+#include "card_model.h"
+
+// As append_file() in the firmware
+#define FIRMWARE_CHUNK_SIZE 128
+#define FIRMWARE_SYNC_INTERVAL_MSEC 5000
+#define FIRMWARE_RX_BUFFER_SIZE 800
+
+typedef struct sdfatBenchOptions_t {
+    int help;
+    int imageSizeMB;
+    int fatType;
+    int chunkSize;
+    int syncIntervalMsec;
+    uint32_t rate;
+    uint32_t totalBytes;
+    const char *imageFilename;
+} sdfatBenchOptions_t;
+
+sdfatBenchOptions_t defaultOptions = {
+    .help = 0,
+    .imageSizeMB = 256,
+    .fatType = 0,
+    .chunkSize = FIRMWARE_CHUNK_SIZE,
+    .syncIntervalMsec = FIRMWARE_SYNC_INTERVAL_MSEC,
+    .rate = 0,
+    .totalBytes = 4 * 1024 * 1024,
+    .imageFilename = NULL,
+};
+
+sdfatBenchOptions_t options;
+
+cardLatencyModel_t cardLatency;
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint32_t la = *(const uint32_t*) a, lb = *(const uint32_t*) b;
+
+    return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static bool prepareImage(const char *filename)
+{
+    if (!Sd2Card::createImage(filename, (uint32_t) options.imageSizeMB * 2048)) {
+        fprintf(stderr, "Couldn't create card image '%s'\n", filename);
+        return false;
+    }
+
+    // Formatting isn't part of the benchmark
+    cardModelConfigure(&cardLatencyIdeal, false);
+
+    Sd2Card card;
+
+    return card.init() && formatCard(&card, options.fatType);
+}
+
+static bool runBenchmark()
+{
+    static Sd2Card card;
+    static SdVolume volume;
+    SdFile root, file;
+    uint8_t buffer[512];
+    uint32_t chunkCount = (options.totalBytes + options.chunkSize - 1) / options.chunkSize;
+    uint32_t *latencies = (uint32_t*) malloc(chunkCount * sizeof(*latencies));
+    uint32_t written = 0, chunkIndex = 0, syncs = 0, overflowChunks = 0;
+    uint64_t startTime, lastSyncTime, maxSyncUs = 0;
+
+    for (int i = 0; i < (int) sizeof(buffer); i++) {
+        buffer[i] = i;
+    }
+
+    cardModelConfigure(&cardLatency, false);
+
+    if (!latencies || !card.init() || !volume.init(&card) || !root.openRoot(&volume)) {
+        fprintf(stderr, "Couldn't open the card image's filesystem\n");
+        return false;
+    }
+
+    cardModelResetStats();
+    startTime = lastSyncTime = cardModelMicros();
+
+    if (!file.open(&root, "LOG00000.TXT", O_CREAT | O_APPEND | O_WRITE)) {
+        fprintf(stderr, "Couldn't create the log file\n");
+        return false;
+    }
+
+    // The same trick append_file() uses to allocate the first cluster
+    file.rewind();
+    file.sync();
+
+    while (written < options.totalBytes) {
+        uint32_t n = options.totalBytes - written;
+
+        if (n > (uint32_t) options.chunkSize) {
+            n = options.chunkSize;
+        }
+
+        if (options.rate) {
+            // Don't start on this chunk before it's all arrived
+            uint64_t arrival = startTime + ((uint64_t) (written + n) * 1000000) / options.rate;
+
+            if (cardModelMicros() < arrival) {
+                cardModelAdvance(arrival - cardModelMicros());
+            }
+        }
+
+        uint64_t writeStart = cardModelMicros();
+
+        if (file.write(buffer + (written % 256), n) != (int) n) {
+            fprintf(stderr, "Write failed after %u bytes\n", written);
+            return false;
+        }
+
+        if ((cardModelMicros() - lastSyncTime) / 1000 > (uint32_t) options.syncIntervalMsec) {
+            uint64_t syncStart = cardModelMicros();
+
+            file.sync();
+            syncs++;
+            lastSyncTime = cardModelMicros();
+
+            if (lastSyncTime - syncStart > maxSyncUs) {
+                maxSyncUs = lastSyncTime - syncStart;
+            }
+        }
+
+        latencies[chunkIndex] = (uint32_t) (cardModelMicros() - writeStart);
+
+        // How much data would have piled up in the RX buffer while we were busy?
+        if (options.rate && ((uint64_t) latencies[chunkIndex] * options.rate) / 1000000 > FIRMWARE_RX_BUFFER_SIZE) {
+            overflowChunks++;
+        }
+
+        chunkIndex++;
+        written += n;
+    }
+
+    file.sync();
+    file.close();
+
+    uint64_t elapsedUs = cardModelMicros() - startTime;
+
+    qsort(latencies, chunkIndex, sizeof(*latencies), compareLatency);
+
+    cardModelPrintSettings(stdout);
+    printf("Wrote %u bytes in %u byte chunks with %u periodic syncs in %llu us of card time", written,
+        options.chunkSize, syncs, (unsigned long long) elapsedUs);
+
+    if (elapsedUs > 0) {
+        printf(" (%llu bytes/s)", (unsigned long long) (written * 1000000ULL / elapsedUs));
+    }
+
+    printf("\nPer write() call: median %u us, 99th percentile %u us, 99.9th %u us, max %u us\n",
+        latencies[chunkIndex / 2], latencies[(uint32_t) (chunkIndex * 0.99)], latencies[(uint32_t) (chunkIndex * 0.999)],
+        latencies[chunkIndex - 1]);
+    printf("Longest periodic sync %llu us\n", (unsigned long long) maxSyncUs);
+
+    if (options.rate) {
+        printf("Writes long enough to overflow the %d byte RX buffer at %u bytes/s: %u\n", FIRMWARE_RX_BUFFER_SIZE,
+            options.rate, overflowChunks);
+    }
+
+    cardModelPrintStats(stdout);
+
+    free(latencies);
+
+    return true;
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "SdFat append benchmark against a modelled card\n\n"
+        "Usage:\n"
+        "     %s [options]\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --card <settings>      Card latency model, see openlog_host --help\n"
+        "   --bytes <num>          Amount of data to log (default %u)\n"
+        "   --chunk <bytes>        Size of each write() (default %d, as the firmware)\n"
+        "   --sync <msec>          Sync interval (default %d msec, as the firmware)\n"
+        "   --rate <bytes/s>       Data arrival rate, by default data is always waiting\n"
+        "   --image <filename>     Card image to use (default a temporary file), it is\n"
+        "                          always reformatted\n"
+        "   --image-size <MB>      Card image size (default %d MB)\n"
+        "   --fat <16|32>          Filesystem (default by card size)\n"
+        "\n", argv0, defaultOptions.totalBytes, defaultOptions.chunkSize, defaultOptions.syncIntervalMsec,
+        defaultOptions.imageSizeMB
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    enum {
+        SETTING_CARD = 1,
+        SETTING_BYTES,
+        SETTING_CHUNK,
+        SETTING_SYNC,
+        SETTING_RATE,
+        SETTING_IMAGE,
+        SETTING_IMAGE_SIZE,
+        SETTING_FAT,
+    };
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"card", required_argument, 0, SETTING_CARD},
+            {"bytes", required_argument, 0, SETTING_BYTES},
+            {"chunk", required_argument, 0, SETTING_CHUNK},
+            {"sync", required_argument, 0, SETTING_SYNC},
+            {"rate", required_argument, 0, SETTING_RATE},
+            {"image", required_argument, 0, SETTING_IMAGE},
+            {"image-size", required_argument, 0, SETTING_IMAGE_SIZE},
+            {"fat", required_argument, 0, SETTING_FAT},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case SETTING_CARD:
+                if (!cardModelParse(optarg, &cardLatency)) {
+                    fprintf(stderr, "Couldn't understand card latency settings '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case SETTING_BYTES:
+                options.totalBytes = strtoul(optarg, NULL, 10);
+            break;
+            case SETTING_CHUNK:
+                options.chunkSize = atoi(optarg);
+
+                if (options.chunkSize < 1 || options.chunkSize > 512) {
+                    fprintf(stderr, "Chunk size must be between 1 and 512 bytes\n");
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case SETTING_SYNC:
+                options.syncIntervalMsec = atoi(optarg);
+            break;
+            case SETTING_RATE:
+                options.rate = strtoul(optarg, NULL, 10);
+            break;
+            case SETTING_IMAGE:
+                options.imageFilename = optarg;
+            break;
+            case SETTING_IMAGE_SIZE:
+                options.imageSizeMB = atoi(optarg);
+
+                if (options.imageSizeMB < 8) {
+                    fprintf(stderr, "Card images must be at least 8 MB\n");
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case SETTING_FAT:
+                options.fatType = atoi(optarg);
+
+                if (options.fatType != 16 && options.fatType != 32) {
+                    fprintf(stderr, "FAT type must be 16 or 32\n");
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            default:
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char tempImage[] = "/tmp/sdfat_bench_XXXXXX";
+    const char *imageFilename;
+    bool success;
+
+    options = defaultOptions;
+    cardLatency = cardLatencyIdeal;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help || options.totalBytes == 0) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (options.imageFilename) {
+        imageFilename = options.imageFilename;
+    } else {
+        int fd = mkstemp(tempImage);
+
+        if (fd == -1) {
+            fprintf(stderr, "Couldn't create a temporary card image\n");
+            return EXIT_FAILURE;
+        }
+
+        close(fd);
+        imageFilename = tempImage;
+    }
+
+    success = prepareImage(imageFilename) && runBenchmark();
+
+    Sd2Card::closeImage();
+
+    if (!options.imageFilename) {
+        unlink(tempImage);
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
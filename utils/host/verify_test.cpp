@@ -0,0 +1,136 @@
+/*
+ * Checks that the firmware's verify_log() can be run between appends to the log.
+ *
+ * Each round appends a few blocks to the log, syncs it and reads it back with verify_log(), as the firmware does each
+ * time the flight controller goes quiet. The read must leave the card out of its multi-block read, every range must
+ * read back as it was written, and the log must hold exactly what was appended.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <SdFat.h>
+
+#include "card_format.h"
+#include "card_model.h"
+#include "openlog_firmware.h"
+
+#define IMAGE_SIZE_MB 64
+#define ROUNDS 8
+#define ROUND_WRITES 40
+
+static bool fail(const char *reason)
+{
+    fprintf(stderr, "FAIL: %s\n", reason);
+    return false;
+}
+
+// The byte of the log at offset, not repeating every block so a block read from the wrong place shows up
+static uint8_t logByte(uint32_t offset)
+{
+    return (uint8_t) (offset ^ (offset >> 9));
+}
+
+static bool checkLog(uint32_t size)
+{
+    SdFile log;
+    uint8_t block[512];
+
+    if (!log.open(&currentDirectory, "LOG.TXT", O_READ))
+        return fail("couldn't reopen the log");
+    if (log.fileSize() != size)
+        return fail("the log isn't the size that was appended");
+
+    for (uint32_t offset = 0; offset < size; ) {
+        int count = log.read(block, sizeof(block));
+
+        if (count <= 0)
+            return fail("couldn't read the log");
+
+        for (int i = 0; i < count; i++, offset++) {
+            if (block[i] != logByte(offset)) {
+                fprintf(stderr, "FAIL: the log has the wrong data at offset %lu\n", (unsigned long) offset);
+                return false;
+            }
+        }
+    }
+
+    return log.close();
+}
+
+static bool runTest(void)
+{
+    SdFile log;
+    uint8_t data[128];
+    uint8_t buffer[64];
+    uint32_t offset = 0;
+
+    setup();
+
+    if (!log.open(&currentDirectory, "LOG.TXT", O_CREAT | O_APPEND | O_RDWR))
+        return fail("couldn't create the log");
+    restart_verify(&log);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < ROUND_WRITES; i++) {
+            for (size_t j = 0; j < sizeof(data); j++)
+                data[j] = logByte(offset + j);
+            write_log(&log, data, sizeof(data));
+            offset += sizeof(data);
+        }
+        sync_log(&log, false);
+
+        verify_log(&log, buffer, sizeof(buffer));
+
+        const cardStats_t *stats = cardModelStats();
+
+        if (stats->commands[CARD_OP_READ_START] != stats->commands[CARD_OP_READ_STOP])
+            return fail("verify_log() left the card in a multi-block read");
+        if (log.curPosition() != log.fileSize())
+            return fail("verify_log() didn't leave the log at its end");
+    }
+
+    if (verifyFailures != 0) {
+        fprintf(stderr, "FAIL: %u ranges of the log didn't read back as written\n", (unsigned) verifyFailures);
+        return false;
+    }
+    if (!log.close())
+        return fail("couldn't close the log");
+
+    return checkLog(offset);
+}
+
+int main(void)
+{
+    char imageFilename[] = "/tmp/verify_test.XXXXXX";
+    int fd = mkstemp(imageFilename);
+    bool success;
+
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't create a temporary card image\n");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    cardModelConfigure(&cardLatencyIdeal, false);
+
+    Sd2Card formatter;
+
+    success = Sd2Card::createImage(imageFilename, (uint32_t) IMAGE_SIZE_MB * 2048)
+        && formatter.init() && formatCard(&formatter, 0);
+
+    if (!success)
+        fprintf(stderr, "Couldn't format the card image\n");
+    else
+        success = runTest();
+
+    Sd2Card::closeImage();
+    unlink(imageFilename);
+
+    if (success)
+        printf("Verifying the log between appends kept the card out of multi-block reads and the log intact\n");
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,9 +1,18 @@
+// For the pty functions used by --loopback
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/select.h>
+#include <sys/wait.h>
 
 #include <getopt.h>
 
@@ -22,13 +31,32 @@
 
 #define BENCHMARK_HEADER_INTRO "Blackbox benchmark\n"
 
+// Sent by the OpenLog each time it goes idle: "Logged:<bytes written to card>,<RX error bits>,<verify failures>" (older
+// firmware leaves off the verify failures)
+#define LOGGED_REPORT_PREFIX "Logged:"
+
+// How long to wait for the OpenLog to report after we stop sending (it needs to go idle and sync first)
+#define LOGGED_REPORT_TIMEOUT_MSEC 8000
+// Once we've seen a report, how long the line has to stay quiet before we assume that was the last one. The OpenLog
+// only reads the log back once it has heard nothing for 3 seconds, so the report of that comes well after the first
+#define LOGGED_REPORT_QUIET_MSEC 5000
+
+// The host build of the OpenLog firmware that --loopback runs, looked for next to this program by default
+#define DEFAULT_EMULATOR_NAME "openlog_host"
+
 typedef struct benchOptions_t {
     int help;
     int duration;
     int baudRate, stopBits;
     int looptime;
+    int search, searchStep, minLooptime;
+    double maxLoss;
+    int loopback;
     const char *analyzeFilename;
     const char *outputDevice;
+    const char *emulatorPath;
+    const char *imageFilename;
+    const char *cardLatency;
 } benchOptions_t;
 
 benchOptions_t defaultOptions = {
@@ -37,11 +65,18 @@ benchOptions_t defaultOptions = {
     .stopBits = 1,
     .duration = 15,
     .help = 0,
+    .search = 0, .searchStep = 10, .minLooptime = 100,
+    .maxLoss = 0.1,
+    .loopback = 0,
     .analyzeFilename = NULL, .outputDevice = NULL,
+    .emulatorPath = NULL, .imageFilename = NULL, .cardLatency = "",
 };
 
 benchOptions_t options;
 
+// The running emulator when in --loopback mode
+pid_t emulatorPid = -1;
+
 uint32_t micros() {
     struct timespec ts;
 
@@ -162,57 +197,269 @@ void writeBenchmarkFrames(int fd, int loopTime, int maxIterations, uint32_t *byt
     *actualDurationMsec = (micros() - firstLoop) / 1000;
 }
 
-bool runBenchmark(const char *deviceName)
+/**
+ * Read a line (up to and including '\n') from the fd into buf, waiting no longer than timeoutMsec for it to arrive.
+ * Returns false on timeout or error. The line is always null-terminated.
+ */
+bool readLineTimeout(int fd, char *buf, int bufSize, int timeoutMsec)
+{
+    int len = 0;
+    uint32_t deadline = micros() + timeoutMsec * 1000;
+
+    buf[0] = '\0';
+
+    while (len < bufSize - 1) {
+        int32_t remainingUs = (int32_t) (deadline - micros());
+        struct timeval tv;
+        fd_set readSet;
+
+        if (remainingUs < 0)
+            remainingUs = 0;
+
+        tv.tv_sec = remainingUs / 1000000;
+        tv.tv_usec = remainingUs % 1000000;
+
+        FD_ZERO(&readSet);
+        FD_SET(fd, &readSet);
+
+        if (select(fd + 1, &readSet, NULL, NULL, &tv) <= 0 || read(fd, buf + len, 1) != 1) {
+            buf[len] = '\0';
+            return false;
+        }
+
+        len++;
+
+        if (buf[len - 1] == '\n')
+            break;
+    }
+
+    buf[len] = '\0';
+
+    return true;
+}
+
+/**
+ * Collect the "Logged:" reports that the OpenLog sends each time it goes idle, adding up the number of bytes it
+ * recorded, the RX error bits it saw and the ranges of the log that didn't read back from the card as written.
+ *
+ * Waits up to timeoutMsec for the first report to arrive, then returns once the line has been quiet for quietMsec.
+ * Returns the number of reports received.
+ */
+int collectLoggedReports(int fd, int timeoutMsec, int quietMsec, uint32_t *bytesLogged, unsigned int *rxErrors,
+    unsigned int *verifyFailures)
 {
-    // Choose iteration count to achieve the required number of seconds of flight
-    int maxIterations = (1000000 * options.duration) / options.looptime;
     char lineBuffer[256];
-    int fd;
-    uint32_t byteCount, timingErrorUs, actualDurationMsec;
+    int reportCount = 0;
+    uint32_t startTime = micros();
 
-    fprintf(stderr, "Opening %s at %d baud and %d stop bits...\n", deviceName, options.baudRate, options.stopBits);
-    fd = serial_open(deviceName, options.baudRate, options.stopBits);
+    *bytesLogged = 0;
+    *rxErrors = 0;
+    *verifyFailures = 0;
 
-    if (fd == -1) {
-        fprintf(stderr, "Failed to open serial port, maybe try a different baud rate?\n");
-        return false;
+    while (true) {
+        int waitMsec = reportCount > 0 ? quietMsec : timeoutMsec - (int) ((micros() - startTime) / 1000);
+
+        if (waitMsec <= 0 || !readLineTimeout(fd, lineBuffer, sizeof(lineBuffer), waitMsec))
+            break;
+
+        if (strncmp(lineBuffer, LOGGED_REPORT_PREFIX, strlen(LOGGED_REPORT_PREFIX)) == 0) {
+            unsigned int logged, errors, failures = 0;
+
+            if (sscanf(lineBuffer + strlen(LOGGED_REPORT_PREFIX), "%u,%u,%u", &logged, &errors, &failures) >= 2) {
+                *bytesLogged += logged;
+                *rxErrors |= errors;
+                *verifyFailures += failures;
+                reportCount++;
+            }
+        }
     }
 
-    fprintf(stderr, "Waiting for OpenLog to be ready...\n");
+    return reportCount;
+}
+
+/**
+ * Start the OpenLog emulator with the given arguments (args[0] is filled in with the emulator's path), with its stdout
+ * redirected to stdoutFd unless that is -1. Returns its pid, or -1 on failure.
+ */
+pid_t startEmulator(const char **args, int stdoutFd)
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        if (stdoutFd != -1) {
+            dup2(stdoutFd, STDOUT_FILENO);
+        }
+
+        args[0] = options.emulatorPath;
+        execv(options.emulatorPath, (char * const *) args);
+
+        fprintf(stderr, "Couldn't run the OpenLog emulator \"%s\"\n", options.emulatorPath);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+/**
+ * Create a pty pair and start the OpenLog emulator on the slave side of it, so that the master side can stand in for
+ * the serial port. Returns the master fd, or -1 on failure.
+ */
+int openLoopback()
+{
+    char baudString[16];
+    const char *slaveName = NULL;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
 
+    if (fd == -1 || grantpt(fd) != 0 || unlockpt(fd) != 0 || (slaveName = ptsname(fd)) == NULL) {
+        fprintf(stderr, "Failed to create a pty for the emulator\n");
+
+        if (fd != -1)
+            close(fd);
+
+        return -1;
+    }
+
+    // The emulator mustn't inherit the master, or it'll never see it hang up
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    snprintf(baudString, sizeof(baudString), "%d", options.baudRate);
+
+    const char *args[] = {NULL, "--device", slaveName, "--image", options.imageFilename, "--baud", baudString,
+        "--card", options.cardLatency, "--card-stats", NULL};
+
+    fprintf(stderr, "Starting OpenLog emulator on %s at %d baud, logging to %s...\n", slaveName, options.baudRate,
+        options.imageFilename);
+
+    emulatorPid = startEmulator(args, -1);
+
+    if (emulatorPid == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Close the connection to the OpenLog. In loopback mode this is the emulator's cue to finish up and exit once it's
+ * synced its log, so wait for that.
+ */
+void closeLogger(int fd)
+{
+    close(fd);
+
+    if (emulatorPid != -1) {
+        waitpid(emulatorPid, NULL, 0);
+        emulatorPid = -1;
+    }
+}
+
+/**
+ * Open the serial port (or start the emulator) and wait for the OpenLog to announce that it's ready. Returns the fd, or
+ * -1 on failure.
+ */
+int openLogger(const char *deviceName)
+{
+    int fd, actualRate;
     char ready[4];
 
-    readAll(fd, ready, 3);
+    if (options.loopback) {
+        fd = openLoopback();
+
+        if (fd == -1) {
+            return -1;
+        }
+    } else {
+        fprintf(stderr, "Opening %s at %d baud and %d stop bits...\n", deviceName, options.baudRate, options.stopBits);
+        fd = serial_open(deviceName, options.baudRate, options.stopBits, &actualRate);
+
+        if (fd == -1) {
+            fprintf(stderr, "Failed to open serial port, maybe try a different baud rate?\n");
+            return -1;
+        }
+
+        if (actualRate != options.baudRate) {
+            fprintf(stderr, "Serial port is actually running at %d baud (%+.2f%% from requested)\n", actualRate,
+                (100.0 * (actualRate - options.baudRate)) / options.baudRate);
+        }
+    }
+
+    fprintf(stderr, "Waiting for OpenLog to be ready...\n");
+
+    if (!readAll(fd, ready, 3)) {
+        fprintf(stderr, "No response from OpenLog\n");
+        closeLogger(fd);
+        return -1;
+    }
+
     ready[3] = '\0';
 
     if (strcmp(ready, "12<") != 0) {
         fprintf(stderr, "Unexpected response from Openlog \"%.*s\"\n", 3, ready);
-        return false;
+        closeLogger(fd);
+        return -1;
     }
 
-    fprintf(stderr, "\nRunning %d second benchmark at looptime %d us...\n", options.duration, options.looptime);
+    return fd;
+}
+
+/**
+ * Write the benchmark header which describes the frames that follow. Returns the number of bytes written.
+ */
+uint32_t writeBenchmarkHeader(int fd, int looptime, int maxIterations)
+{
+    char lineBuffer[256];
+    uint32_t byteCount = 0;
 
     print(fd, BENCHMARK_HEADER_INTRO);
+    byteCount += strlen(BENCHMARK_HEADER_INTRO);
 
     snprintf(lineBuffer, sizeof(lineBuffer), "I interval:%d\n", I_FRAME_INTERVAL);
     print(fd, lineBuffer);
+    byteCount += strlen(lineBuffer);
 
     snprintf(lineBuffer, sizeof(lineBuffer), "I size:%d\n", I_FRAME_SIZE);
     print(fd, lineBuffer);
+    byteCount += strlen(lineBuffer);
 
     snprintf(lineBuffer, sizeof(lineBuffer), "P size:%d\n", P_FRAME_SIZE);
     print(fd, lineBuffer);
+    byteCount += strlen(lineBuffer);
 
-    snprintf(lineBuffer, sizeof(lineBuffer), "Looptime:%d\n", options.looptime);
+    snprintf(lineBuffer, sizeof(lineBuffer), "Looptime:%d\n", looptime);
     print(fd, lineBuffer);
+    byteCount += strlen(lineBuffer);
 
     snprintf(lineBuffer, sizeof(lineBuffer), "Serial baud:%d\n", options.baudRate);
     print(fd, lineBuffer);
+    byteCount += strlen(lineBuffer);
 
     snprintf(lineBuffer, sizeof(lineBuffer), "Iterations:%d\n", maxIterations);
     print(fd, lineBuffer);
+    byteCount += strlen(lineBuffer);
 
     print(fd, "\n");
+    byteCount += 1;
+
+    return byteCount;
+}
+
+bool runBenchmark(const char *deviceName)
+{
+    // Choose iteration count to achieve the required number of seconds of flight
+    int maxIterations = (1000000 * options.duration) / options.looptime;
+    int fd;
+    uint32_t byteCount, timingErrorUs, actualDurationMsec;
+
+    fd = openLogger(deviceName);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    fprintf(stderr, "\nRunning %d second benchmark at looptime %d us...\n", options.duration, options.looptime);
+
+    writeBenchmarkHeader(fd, options.looptime, maxIterations);
 
     // Give the header time to flush (I'd like to sleep for just 500ms but sleep takes seconds as an argument :/)
     sleep(1);
@@ -225,9 +472,116 @@ bool runBenchmark(const char *deviceName)
 
     // Wait for card to flush
     fprintf(stderr, "Waiting for OpenLog to finish...\n");
-    sleep(6);
 
-    close(fd);
+    if (options.loopback) {
+        uint32_t bytesLogged;
+        unsigned int rxErrors, verifyFailures;
+
+        // The emulator always reports, so there's no need to guess how long it'll take
+        if (collectLoggedReports(fd, LOGGED_REPORT_TIMEOUT_MSEC, LOGGED_REPORT_QUIET_MSEC, &bytesLogged, &rxErrors,
+                &verifyFailures) > 0) {
+            fprintf(stderr, "OpenLog logged %u bytes, RX errors 0x%02X, verify failures %u\n\n", bytesLogged, rxErrors,
+                verifyFailures);
+        }
+    } else {
+        sleep(6);
+    }
+
+    closeLogger(fd);
+
+    return true;
+}
+
+/**
+ * Lower the looptime step by step until the OpenLog's reported loss rate passes the threshold, then report the
+ * highest rate that was sustained without excessive loss.
+ */
+bool runSearch(const char *deviceName)
+{
+    char discard[256];
+    int fd;
+    int looptime = options.looptime;
+    int bestLooptime = 0;
+    uint32_t bestBytesPerSecond = 0;
+    double bestLoss = 0;
+
+    fd = openLogger(deviceName);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    fprintf(stderr, "\nSearching for maximum throughput at %d baud, starting from looptime %d us, %d seconds per step, "
+        "max loss %.3f%%...\n\n", options.baudRate, looptime, options.duration, options.maxLoss);
+
+    while (looptime >= options.minLooptime) {
+        int maxIterations = (1000000 * options.duration) / looptime;
+        uint32_t headerBytes, frameBytes, bytesSent, bytesLogged, timingErrorUs, actualDurationMsec, bytesPerSecond;
+        unsigned int rxErrors, verifyFailures;
+        double loss;
+
+        // Throw away any reports left over from before this step
+        while (readLineTimeout(fd, discard, sizeof(discard), 0)) {
+        }
+
+        headerBytes = writeBenchmarkHeader(fd, looptime, maxIterations);
+
+        sleep(1);
+
+        writeBenchmarkFrames(fd, looptime, maxIterations, &frameBytes, &timingErrorUs, &actualDurationMsec);
+        tcdrain(fd);
+
+        bytesSent = headerBytes + frameBytes;
+        bytesPerSecond = (frameBytes * 1000) / actualDurationMsec;
+
+        if (collectLoggedReports(fd, LOGGED_REPORT_TIMEOUT_MSEC, LOGGED_REPORT_QUIET_MSEC, &bytesLogged, &rxErrors,
+                &verifyFailures) == 0) {
+            fprintf(stderr, "No \"" LOGGED_REPORT_PREFIX "\" report from the OpenLog, is its TX connected and is the firmware up to date?\n");
+            closeLogger(fd);
+            return false;
+        }
+
+        loss = bytesLogged >= bytesSent ? 0 : (100.0 * (bytesSent - bytesLogged)) / bytesSent;
+
+        fprintf(stderr, "Looptime %5d us: sent %u bytes (%u bytes/s, frame start error %u us), logged %u, loss %.3f%%, RX errors 0x%02X, verify failures %u\n",
+            looptime, bytesSent, bytesPerSecond, timingErrorUs, bytesLogged, loss, rxErrors, verifyFailures);
+
+        if (loss > options.maxLoss) {
+            break;
+        }
+
+        bestLooptime = looptime;
+        bestBytesPerSecond = bytesPerSecond;
+        bestLoss = loss;
+
+        if (looptime == options.minLooptime) {
+            break;
+        }
+
+        // Step down by searchStep percent, but always make some progress
+        int nextLooptime = looptime - (looptime * options.searchStep) / 100;
+
+        if (nextLooptime >= looptime) {
+            nextLooptime = looptime - 1;
+        }
+        if (nextLooptime < options.minLooptime) {
+            nextLooptime = options.minLooptime;
+        }
+
+        looptime = nextLooptime;
+    }
+
+    closeLogger(fd);
+
+    if (bestLooptime == 0) {
+        fprintf(stderr, "\nCouldn't sustain even the starting looptime of %d us, try a larger --looptime\n", options.looptime);
+    } else {
+        fprintf(stderr, "\nSustainable throughput at %d baud: %u bytes/s (looptime %d us, loss %.3f%%)\n",
+            options.baudRate, bestBytesPerSecond, bestLooptime, bestLoss);
+    }
+
+    // A single machine-readable result line on stdout: baud, looptime, bytes/second
+    printf("%d %d %u\n", options.baudRate, bestLooptime, bestBytesPerSecond);
 
     return true;
 }
@@ -371,6 +725,36 @@ void analyzeLog(FILE *input)
     }
 }
 
+/**
+ * Have the emulator pull the log it just recorded back out of the card image, and analyze it.
+ */
+bool analyzeLoopbackLog()
+{
+    const char *args[] = {NULL, "--image", options.imageFilename, "--extract-last", NULL};
+    int pipeFds[2];
+    int status;
+    pid_t pid;
+    FILE *input;
+
+    if (pipe(pipeFds) != 0) {
+        return false;
+    }
+
+    pid = startEmulator(args, pipeFds[1]);
+    close(pipeFds[1]);
+
+    if (pid == -1) {
+        close(pipeFds[0]);
+        return false;
+    }
+
+    input = fdopen(pipeFds[0], "rb");
+    analyzeLog(input);
+    fclose(input);
+
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
 void printUsage(const char *argv0)
 {
     fprintf(stderr,
@@ -380,13 +764,27 @@ void printUsage(const char *argv0)
         "     %s [options]\n\n"
         "Options:\n"
         "   --help                 This page\n"
-        "   --baud <num>           Serial port baud rate (default %d)\n"
+        "   --baud <num>           Serial port baud rate (default %d), non-standard\n"
+        "                          rates like 250000 are supported on Linux\n"
         "   --stopbits <1|2>       Serial port stop bits (default %d)\n"
         "   --looptime <microsec>  Simulated looptime (default %d us)\n"
         "   --duration <seconds>   Simulation duration (default %d seconds)\n"
         "   --device <filename>    Serial port to write to\n"
+        "   --loopback             Instead of a serial port, run the OpenLog firmware's host\n"
+        "                          build on a pty and analyze the log it records\n"
+        "   --emulator <filename>  Host build of the firmware for --loopback (default\n"
+        "                          " DEFAULT_EMULATOR_NAME " next to this program)\n"
+        "   --image <filename>     SD card image for --loopback (default a temporary one)\n"
+        "   --card <settings>      Card latency model for --loopback, as openlog_host --card\n"
         "   --analyze <filename>   OpenLog benchmark log to analyze\n"
-        "\n", argv0, defaultOptions.baudRate, defaultOptions.stopBits, defaultOptions.looptime, defaultOptions.duration
+        "   --search               Lower the looptime step by step until the OpenLog reports\n"
+        "                          losing data, then print the sustainable bytes/second\n"
+        "                          (starts from --looptime, each step lasts --duration)\n"
+        "   --search-step <pct>    Looptime decrease per search step (default %d%%)\n"
+        "   --min-looptime <us>    Lowest looptime the search will try (default %d us)\n"
+        "   --max-loss <pct>       Loss rate that ends the search (default %.3f%%)\n"
+        "\n", argv0, defaultOptions.baudRate, defaultOptions.stopBits, defaultOptions.looptime, defaultOptions.duration,
+        defaultOptions.searchStep, defaultOptions.minLooptime, defaultOptions.maxLoss
     );
 }
 
@@ -401,6 +799,12 @@ static void parseCommandlineOptions(int argc, char **argv)
         SETTING_LOOPTIME,
         SETTING_STOPBITS,
         SETTING_DURATION,
+        SETTING_SEARCH_STEP,
+        SETTING_MIN_LOOPTIME,
+        SETTING_MAX_LOSS,
+        SETTING_EMULATOR,
+        SETTING_IMAGE,
+        SETTING_CARD,
     };
 
     while (1)
@@ -413,6 +817,14 @@ static void parseCommandlineOptions(int argc, char **argv)
             {"stopbits", required_argument, 0, SETTING_STOPBITS},
             {"looptime", required_argument, 0, SETTING_LOOPTIME},
             {"duration", required_argument, 0, SETTING_DURATION},
+            {"search", no_argument, &options.search, 1},
+            {"search-step", required_argument, 0, SETTING_SEARCH_STEP},
+            {"min-looptime", required_argument, 0, SETTING_MIN_LOOPTIME},
+            {"max-loss", required_argument, 0, SETTING_MAX_LOSS},
+            {"loopback", no_argument, &options.loopback, 1},
+            {"emulator", required_argument, 0, SETTING_EMULATOR},
+            {"image", required_argument, 0, SETTING_IMAGE},
+            {"card", required_argument, 0, SETTING_CARD},
             {0, 0, 0, 0}
         };
 
@@ -449,6 +861,34 @@ static void parseCommandlineOptions(int argc, char **argv)
                     exit(EXIT_FAILURE);
                 }
             break;
+            case SETTING_SEARCH_STEP:
+                options.searchStep = atoi(optarg);
+
+                if (options.searchStep <= 0 || options.searchStep >= 100) {
+                    fprintf(stderr, "Search step must be between 1 and 99 percent\n");
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case SETTING_MIN_LOOPTIME:
+                options.minLooptime = atoi(optarg);
+
+                if (options.minLooptime <= 0) {
+                    fprintf(stderr, "Minimum looptime must be greater than zero\n");
+                    exit(EXIT_FAILURE);
+                }
+            break;
+            case SETTING_MAX_LOSS:
+                options.maxLoss = atof(optarg);
+            break;
+            case SETTING_EMULATOR:
+                options.emulatorPath = optarg;
+            break;
+            case SETTING_IMAGE:
+                options.imageFilename = optarg;
+            break;
+            case SETTING_CARD:
+                options.cardLatency = optarg;
+            break;
             case '\0':
                 //Longopt which has set a flag
             break;
@@ -468,8 +908,48 @@ static void parseCommandlineOptions(int argc, char **argv)
     }
 }
 
+/**
+ * Fill in the defaults for --loopback: the emulator next to this program and a temporary card image. Sets
+ * *tempImage if a temporary image was created, so the caller can delete it afterwards.
+ */
+bool prepareLoopback(const char *argv0, bool *tempImage)
+{
+    static char emulatorPath[4096];
+    static char imageFilename[] = "/tmp/blackbox_bench_XXXXXX";
+
+    *tempImage = false;
+
+    if (!options.emulatorPath) {
+        char argv0Copy[4096];
+
+        snprintf(argv0Copy, sizeof(argv0Copy), "%s", argv0);
+        snprintf(emulatorPath, sizeof(emulatorPath), "%s/" DEFAULT_EMULATOR_NAME, dirname(argv0Copy));
+
+        options.emulatorPath = emulatorPath;
+    }
+
+    if (!options.imageFilename) {
+        // The emulator formats the image when it finds the file empty
+        int fd = mkstemp(imageFilename);
+
+        if (fd == -1) {
+            fprintf(stderr, "Couldn't create a temporary card image\n");
+            return false;
+        }
+
+        close(fd);
+
+        options.imageFilename = imageFilename;
+        *tempImage = true;
+    }
+
+    return true;
+}
+
 int main(int argc, char **argv)
 {
+    bool tempImage = false;
+
     options = defaultOptions;
 
     parseCommandlineOptions(argc, argv);
@@ -479,6 +959,10 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    if (options.loopback && !prepareLoopback(argv[0], &tempImage)) {
+        return EXIT_FAILURE;
+    }
+
     if (options.analyzeFilename) {
         FILE *input = fopen(options.analyzeFilename, "rb");
 
@@ -488,6 +972,26 @@ int main(int argc, char **argv)
             fprintf(stderr, "Couldn't open log file '%s'\n", options.analyzeFilename);
             return EXIT_FAILURE;
         }
+    } else if ((options.outputDevice || options.loopback) && options.search) {
+        bool success = runSearch(options.outputDevice);
+
+        if (tempImage) {
+            unlink(options.imageFilename);
+        }
+
+        if (!success) {
+            return EXIT_FAILURE;
+        }
+    } else if (options.loopback) {
+        bool success = runBenchmark(options.outputDevice) && analyzeLoopbackLog();
+
+        if (tempImage) {
+            unlink(options.imageFilename);
+        }
+
+        if (!success) {
+            return EXIT_FAILURE;
+        }
     } else if (options.outputDevice) {
         if (runBenchmark(options.outputDevice)) {
             fprintf(stderr, "\nBenchmark done! Now run with --analyze <filename> with the log file from the SD card.\n");
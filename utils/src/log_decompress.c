@@ -0,0 +1,483 @@
+/*
+ * Decoder for the OpenLog's compressed logs (config.txt "compress" setting), with an encoder that produces the same
+ * output as the firmware so the compression ratio of existing logs can be checked, and a throughput benchmark.
+ *
+ * A compressed log starts with the magic "BBZ1", then the data with runs of 4 or more of the same byte replaced by
+ * escape tokens, which never span a 512 byte block of the file:
+ *
+ *   ESC, 0            an ESC byte in the data
+ *   ESC, 1-254, byte  the byte repeats (count + 3) times
+ *   ESC, 255          nothing more in this block (as is an ESC that ends a block)
+ *   anything else     itself
+ *
+ * So any block can be decoded without the ones before it, which lets readers seek around a compressed log.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <getopt.h>
+
+#ifdef __MACH__
+#include <mach/clock.h>
+#include <mach/mach.h>
+#endif
+
+#define COMPRESS_MAGIC "BBZ1"
+#define COMPRESS_MAGIC_LENGTH 4
+#define COMPRESS_BLOCK_SIZE 512
+#define COMPRESS_ESCAPE 0x1B
+#define COMPRESS_MIN_REPEAT 4
+#define COMPRESS_MAX_REPEAT (254 + COMPRESS_MIN_REPEAT - 1)
+#define COMPRESS_END_OF_BLOCK 0xFF
+
+// The firmware is handed the data a localBuffer at a time
+#define FIRMWARE_CHUNK_SIZE 128
+
+// The most a single block can decode to (every token a maximum length repeat)
+#define MAX_DECODED_BLOCK_SIZE ((COMPRESS_BLOCK_SIZE / 3 + 1) * COMPRESS_MAX_REPEAT)
+
+#define BENCHMARK_MIN_DURATION_USEC 1000000
+
+typedef struct decompressOptions_t {
+    int help;
+    int compress;
+    int benchmark;
+    const char *inputFilename;
+    const char *outputFilename;
+} decompressOptions_t;
+
+decompressOptions_t defaultOptions = {
+    .help = 0,
+    .compress = 0,
+    .benchmark = 0,
+    .inputFilename = NULL,
+    .outputFilename = NULL,
+};
+
+decompressOptions_t options;
+
+typedef struct buffer_t {
+    uint8_t *data;
+    size_t length, capacity;
+} buffer_t;
+
+static uint64_t microsecondsNow()
+{
+#ifdef __MACH__
+    clock_serv_t cclock;
+    mach_timespec_t now;
+
+    host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+    clock_get_time(cclock, &now);
+    mach_port_deallocate(mach_task_self(), cclock);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static bool bufferReserve(buffer_t *buffer, size_t extra)
+{
+    if (buffer->length + extra > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 65536;
+
+        while (capacity < buffer->length + extra) {
+            capacity *= 2;
+        }
+
+        uint8_t *data = realloc(buffer->data, capacity);
+
+        if (!data)
+            return false;
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    return true;
+}
+
+static bool bufferAppend(buffer_t *buffer, const uint8_t *data, size_t length)
+{
+    if (!bufferReserve(buffer, length))
+        return false;
+
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+
+    return true;
+}
+
+static bool readFile(const char *filename, buffer_t *buffer)
+{
+    FILE *file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+    size_t bytesRead;
+
+    if (!file)
+        return false;
+
+    do {
+        if (!bufferReserve(buffer, 65536))
+            return false;
+
+        bytesRead = fread(buffer->data + buffer->length, 1, 65536, file);
+        buffer->length += bytesRead;
+    } while (bytesRead > 0);
+
+    if (file != stdin)
+        fclose(file);
+
+    return true;
+}
+
+/**
+ * Decode one block of a compressed log (the first block should be passed without the magic). Returns the number of
+ * bytes decoded into output, or -1 if the block is corrupt.
+ */
+int decodeBlock(const uint8_t *block, int length, uint8_t *output)
+{
+    const uint8_t *end = block + length;
+    uint8_t *out = output;
+
+    while (block < end) {
+        uint8_t value = *block++;
+
+        if (value != COMPRESS_ESCAPE) {
+            *out++ = value;
+        } else if (block == end || *block == COMPRESS_END_OF_BLOCK) {
+            break;
+        } else if (*block == 0) {
+            *out++ = COMPRESS_ESCAPE;
+            block++;
+        } else {
+            int count = *block++ + COMPRESS_MIN_REPEAT - 1;
+
+            if (block == end)
+                return -1;
+
+            memset(out, *block++, count);
+            out += count;
+        }
+    }
+
+    return out - output;
+}
+
+static bool decompress(const buffer_t *input, buffer_t *output)
+{
+    size_t blockStart = 0;
+    int blockIndex = 0;
+
+    if (input->length < COMPRESS_MAGIC_LENGTH || memcmp(input->data, COMPRESS_MAGIC, COMPRESS_MAGIC_LENGTH) != 0) {
+        fprintf(stderr, "This isn't a compressed log\n");
+        return false;
+    }
+
+    while (blockStart < input->length) {
+        size_t blockEnd = blockStart + COMPRESS_BLOCK_SIZE;
+        size_t dataStart = blockIndex == 0 ? COMPRESS_MAGIC_LENGTH : blockStart;
+        int decoded;
+
+        if (blockEnd > input->length)
+            blockEnd = input->length;
+
+        if (!bufferReserve(output, MAX_DECODED_BLOCK_SIZE))
+            return false;
+
+        decoded = decodeBlock(input->data + dataStart, blockEnd - dataStart, output->data + output->length);
+
+        if (decoded == -1) {
+            // Later blocks don't depend on this one, so we can carry on after it
+            fprintf(stderr, "Block %d (file offset %lu) is corrupt, skipping it\n", blockIndex, (unsigned long) blockStart);
+        } else {
+            output->length += decoded;
+        }
+
+        blockStart = blockEnd;
+        blockIndex++;
+    }
+
+    return true;
+}
+
+// Encoder, as the firmware's write_compressed()
+
+typedef struct encoder_t {
+    buffer_t *output;
+    uint8_t runByte;
+    int runLength;
+} encoder_t;
+
+static void encodeToken(encoder_t *encoder, const uint8_t *token, int length)
+{
+    size_t room = COMPRESS_BLOCK_SIZE - encoder->output->length % COMPRESS_BLOCK_SIZE;
+
+    if (room < (size_t) length) {
+        uint8_t end[2] = {COMPRESS_ESCAPE, COMPRESS_END_OF_BLOCK};
+
+        bufferAppend(encoder->output, end, room);
+    }
+
+    bufferAppend(encoder->output, token, length);
+}
+
+static void encodeLiterals(encoder_t *encoder, const uint8_t *data, int length)
+{
+    int start = 0;
+
+    for (int i = 0; i < length; i++) {
+        if (data[i] == COMPRESS_ESCAPE) {
+            uint8_t token[2] = {COMPRESS_ESCAPE, 0};
+
+            bufferAppend(encoder->output, data + start, i - start);
+            encodeToken(encoder, token, sizeof(token));
+
+            start = i + 1;
+        }
+    }
+
+    bufferAppend(encoder->output, data + start, length - start);
+}
+
+static void encodeRun(encoder_t *encoder, uint8_t value, int length)
+{
+    uint8_t token[3] = {COMPRESS_ESCAPE, length - COMPRESS_MIN_REPEAT + 1, value};
+
+    encodeToken(encoder, token, sizeof(token));
+}
+
+static void encodeFlush(encoder_t *encoder)
+{
+    if (encoder->runLength >= COMPRESS_MIN_REPEAT) {
+        encodeRun(encoder, encoder->runByte, encoder->runLength);
+    } else {
+        uint8_t literals[COMPRESS_MIN_REPEAT - 1];
+
+        memset(literals, encoder->runByte, encoder->runLength);
+        encodeLiterals(encoder, literals, encoder->runLength);
+    }
+
+    encoder->runLength = 0;
+}
+
+static void encodeChunk(encoder_t *encoder, const uint8_t *data, int length)
+{
+    int literalStart, i = 0;
+
+    while (encoder->runLength > 0 && i < length && data[i] == encoder->runByte && encoder->runLength < COMPRESS_MAX_REPEAT) {
+        encoder->runLength++;
+        i++;
+    }
+
+    if (i == length && encoder->runLength < COMPRESS_MAX_REPEAT)
+        return;
+
+    encodeFlush(encoder);
+
+    literalStart = i;
+
+    while (i < length) {
+        int run = 1;
+
+        while (i + run < length && data[i + run] == data[i] && run < COMPRESS_MAX_REPEAT)
+            run++;
+
+        if (i + run == length) {
+            encodeLiterals(encoder, data + literalStart, i - literalStart);
+
+            encoder->runByte = data[i];
+            encoder->runLength = run;
+            return;
+        }
+
+        if (run >= COMPRESS_MIN_REPEAT) {
+            encodeLiterals(encoder, data + literalStart, i - literalStart);
+            encodeRun(encoder, data[i], run);
+
+            literalStart = i + run;
+        }
+
+        i += run;
+    }
+}
+
+static bool compress(const buffer_t *input, buffer_t *output)
+{
+    if (!bufferReserve(output, input->length + input->length / 64 + COMPRESS_MAGIC_LENGTH + 1024))
+        return false;
+
+    encoder_t encoder = {.output = output, .runLength = 0};
+
+    bufferAppend(output, (const uint8_t*) COMPRESS_MAGIC, COMPRESS_MAGIC_LENGTH);
+
+    for (size_t i = 0; i < input->length; i += FIRMWARE_CHUNK_SIZE) {
+        size_t length = input->length - i;
+
+        if (length > FIRMWARE_CHUNK_SIZE)
+            length = FIRMWARE_CHUNK_SIZE;
+
+        encodeChunk(&encoder, input->data + i, length);
+    }
+
+    encodeFlush(&encoder);
+
+    return true;
+}
+
+/**
+ * Run the compressor or decompressor over the input repeatedly for at least a second and report its throughput in
+ * terms of uncompressed bytes.
+ */
+static bool benchmark(const buffer_t *input)
+{
+    buffer_t output = {0};
+    uint64_t start, elapsed;
+    size_t uncompressedLength, compressedLength;
+    int iterations = 0;
+
+    start = microsecondsNow();
+
+    do {
+        output.length = 0;
+
+        if (!(options.compress ? compress(input, &output) : decompress(input, &output)))
+            return false;
+
+        iterations++;
+        elapsed = microsecondsNow() - start;
+    } while (elapsed < BENCHMARK_MIN_DURATION_USEC);
+
+    uncompressedLength = options.compress ? input->length : output.length;
+    compressedLength = options.compress ? output.length : input->length;
+
+    printf("%s %lu bytes to %lu bytes (%.1f%% of the original size)\n", options.compress ? "Compressed" : "Decompressed",
+        (unsigned long) input->length, (unsigned long) output.length,
+        uncompressedLength ? (100.0 * compressedLength) / uncompressedLength : 0);
+    printf("%d iterations in %.2f seconds, %.1f MB/s of uncompressed data\n", iterations, elapsed / 1000000.0,
+        ((double) uncompressedLength * iterations) / elapsed);
+
+    free(output.data);
+
+    return true;
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "OpenLog compressed log decoder\n\n"
+        "Usage:\n"
+        "     %s [options] <input file>\n\n"
+        "The input can be '-' for stdin.\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --output <filename>    Write the result here instead of stdout\n"
+        "   --compress             Compress the input the same way as the OpenLog does\n"
+        "   --benchmark            Report throughput and compression ratio instead of\n"
+        "                          writing any output\n"
+        "\n", argv0
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    enum {
+        SETTING_OUTPUT = 1,
+    };
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"compress", no_argument, &options.compress, 1},
+            {"benchmark", no_argument, &options.benchmark, 1},
+            {"output", required_argument, 0, SETTING_OUTPUT},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case SETTING_OUTPUT:
+                options.outputFilename = optarg;
+            break;
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            default:
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+        }
+    }
+
+    if (optind < argc)
+        options.inputFilename = argv[optind];
+}
+
+int main(int argc, char **argv)
+{
+    buffer_t input = {0}, output = {0};
+    FILE *outputFile;
+    bool success;
+
+    options = defaultOptions;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help || !options.inputFilename) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!readFile(options.inputFilename, &input)) {
+        fprintf(stderr, "Couldn't read '%s'\n", options.inputFilename);
+        return EXIT_FAILURE;
+    }
+
+    if (options.benchmark)
+        return benchmark(&input) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    success = options.compress ? compress(&input, &output) : decompress(&input, &output);
+
+    if (!success)
+        return EXIT_FAILURE;
+
+    outputFile = options.outputFilename ? fopen(options.outputFilename, "wb") : stdout;
+
+    if (!outputFile || fwrite(output.data, 1, output.length, outputFile) != output.length) {
+        fprintf(stderr, "Couldn't write the output\n");
+        return EXIT_FAILURE;
+    }
+
+    if (outputFile != stdout)
+        fclose(outputFile);
+
+    free(input.data);
+    free(output.data);
+
+    return EXIT_SUCCESS;
+}
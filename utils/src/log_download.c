@@ -0,0 +1,516 @@
+/*
+ * Downloads logs from the OpenLog over its serial port, so the card doesn't have to come out of the craft.
+ *
+ * The OpenLog has to be powered up (or reset) after this starts: it only listens for the command mode escape, three
+ * ctrl-Z characters, for a moment after it prints "12" at boot. It then answers with a '>' prompt instead of starting a
+ * log, and takes one command per line:
+ *
+ *   ls                    a "name size" line for each file
+ *   read <name> [start]   "OK <bytes>", then the file's bytes from start on, then the CRC-16/CCITT (reflected, initial
+ *                         value 0xFFFF) of those bytes (little-endian). Errors are "ERR <reason>" instead
+ *   exit                  start logging
+ *
+ * Each reply ends with a new '>' prompt.
+ *
+ * With auto-baud on, the OpenLog measures the rate from an 'H' before it opens the command window, so --auto-baud sends
+ * one ahead of the escape.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include <getopt.h>
+
+#ifdef __MACH__
+#include <mach/clock.h>
+#include <mach/mach.h>
+#endif
+
+#include "serial.h"
+
+#define COMMAND_ESCAPE 0x1A
+#define COMMAND_ESCAPE_COUNT 3
+
+// Long enough for the OpenLog to be powered up by hand after we start
+#define BOOT_TIMEOUT_MSEC 30000
+// Long enough for the OpenLog to open a file and find its clusters
+#define REPLY_TIMEOUT_MSEC 5000
+
+#define MAX_FILES 256
+
+typedef struct downloadOptions_t {
+    int help;
+    int list;
+    int last;
+    int autoBaud;
+    int baudRate;
+    const char *device;
+    const char *outputFilename;
+} downloadOptions_t;
+
+downloadOptions_t defaultOptions = {
+    .help = 0,
+    .list = 0,
+    .last = 0,
+    .autoBaud = 0,
+    .baudRate = 115200,
+    .device = NULL,
+    .outputFilename = NULL,
+};
+
+downloadOptions_t options;
+
+typedef struct cardFile_t {
+    char name[13];
+    uint32_t size;
+} cardFile_t;
+
+static uint64_t microsecondsNow()
+{
+#ifdef __MACH__
+    clock_serv_t cclock;
+    mach_timespec_t now;
+
+    host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+    clock_get_time(cclock, &now);
+    mach_port_deallocate(mach_task_self(), cclock);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint16_t crcUpdate(uint16_t crc, const uint8_t *data, size_t length)
+{
+    while (length--) {
+        crc ^= *data++;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * Read up to count bytes, waiting no more than timeoutMsec for each to arrive. Returns the number read.
+ */
+static size_t readTimeout(int fd, uint8_t *buf, size_t count, int timeoutMsec)
+{
+    size_t total = 0;
+
+    while (total < count) {
+        struct timeval tv = {.tv_sec = timeoutMsec / 1000, .tv_usec = (timeoutMsec % 1000) * 1000};
+        fd_set readSet;
+        ssize_t bytesRead;
+
+        FD_ZERO(&readSet);
+        FD_SET(fd, &readSet);
+
+        if (select(fd + 1, &readSet, NULL, NULL, &tv) <= 0 || (bytesRead = read(fd, buf + total, count - total)) <= 0)
+            break;
+
+        total += bytesRead;
+    }
+
+    return total;
+}
+
+static bool writeAll(int fd, const void *buf, size_t count)
+{
+    const uint8_t *p = buf;
+
+    while (count > 0) {
+        ssize_t bytesWritten = write(fd, p, count);
+
+        if (bytesWritten < 0)
+            return false;
+
+        p += bytesWritten;
+        count -= bytesWritten;
+    }
+
+    return true;
+}
+
+/**
+ * Read a line from the OpenLog, without its line ending. A '>' prompt at the start of the line is returned on its own,
+ * since no line ending follows it.
+ */
+static bool readLine(int fd, char *line, size_t size)
+{
+    size_t length = 0;
+    uint8_t c;
+
+    while (readTimeout(fd, &c, 1, REPLY_TIMEOUT_MSEC) == 1) {
+        if (c == '\r')
+            continue;
+        if (c == '\n' || (c == '>' && length == 0)) {
+            if (c == '>')
+                line[length++] = '>';
+
+            line[length] = '\0';
+            return true;
+        }
+        if (length < size - 1)
+            line[length++] = c;
+    }
+
+    return false;
+}
+
+static bool sendCommand(int fd, const char *command)
+{
+    return writeAll(fd, command, strlen(command)) && writeAll(fd, "\r", 1);
+}
+
+/**
+ * Wait for the OpenLog to boot and ask for its command mode.
+ */
+static bool enterCommandMode(int fd)
+{
+    uint8_t c = 0, previous = 0;
+    const uint8_t escapes[COMMAND_ESCAPE_COUNT] = {COMMAND_ESCAPE, COMMAND_ESCAPE, COMMAND_ESCAPE};
+
+    fprintf(stderr, "Waiting for the OpenLog to boot, power it up or reset it now...\n");
+
+    do {
+        previous = c;
+
+        if (readTimeout(fd, &c, 1, BOOT_TIMEOUT_MSEC) != 1) {
+            fprintf(stderr, "The OpenLog didn't boot\n");
+            return false;
+        }
+    } while (previous != '1' || c != '2');
+
+    if (options.autoBaud && !writeAll(fd, "H", 1))
+        return false;
+
+    if (!writeAll(fd, escapes, sizeof(escapes)))
+        return false;
+
+    // Skip the free RAM report that debug builds print after the "12"
+    while (readTimeout(fd, &c, 1, REPLY_TIMEOUT_MSEC) == 1) {
+        if (c == '>')
+            return true;
+        if (c == '<') {
+            fprintf(stderr, "The OpenLog started logging instead, we must have missed its command window\n");
+            return false;
+        }
+    }
+
+    fprintf(stderr, "No prompt from the OpenLog\n");
+
+    return false;
+}
+
+/**
+ * Fetch the directory listing, leaving the OpenLog at its prompt. Returns the number of files, or -1 on failure.
+ */
+static int listFiles(int fd, cardFile_t *files, int maxFiles)
+{
+    char line[64];
+    int count = 0;
+
+    if (!sendCommand(fd, "ls"))
+        return -1;
+
+    while (readLine(fd, line, sizeof(line))) {
+        unsigned long size;
+
+        if (strcmp(line, ">") == 0)
+            return count;
+
+        if (count < maxFiles && sscanf(line, "%12s %lu", files[count].name, &size) == 2) {
+            files[count].size = size;
+            count++;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Like openlog_host's --extract-last: the highest numbered log that has something in it.
+ */
+static const char *findLastLog(const cardFile_t *files, int count)
+{
+    const char *best = NULL;
+    long bestNumber = -1;
+
+    for (int i = 0; i < count; i++) {
+        const char *name = files[i].name;
+        long number = 0;
+        int digits;
+
+        if (files[i].size == 0 || strncmp(name, "LOG", 3) != 0)
+            continue;
+
+        for (digits = 3; name[digits] >= '0' && name[digits] <= '9'; digits++) {
+            number = number * 10 + (name[digits] - '0');
+        }
+
+        if (digits > 3 && strcmp(name + digits, ".TXT") == 0 && number > bestNumber) {
+            bestNumber = number;
+            best = name;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Download one file into output, leaving the OpenLog at its prompt.
+ */
+static bool downloadFile(int fd, const char *name, FILE *output)
+{
+    char line[64];
+    uint8_t buffer[4096], trailer[4];
+    unsigned long size, remaining;
+    uint16_t crc = 0xFFFF;
+    uint64_t startTime, elapsed;
+
+    snprintf(line, sizeof(line), "read %s", name);
+
+    if (!sendCommand(fd, line) || !readLine(fd, line, sizeof(line))) {
+        fprintf(stderr, "No reply from the OpenLog\n");
+        return false;
+    }
+
+    if (sscanf(line, "OK %lu", &size) != 1) {
+        fprintf(stderr, "Couldn't read %s: %s\n", name, line);
+
+        // Wait for the prompt so the next command isn't ignored
+        readLine(fd, line, sizeof(line));
+        return false;
+    }
+
+    fprintf(stderr, "Downloading %s (%lu bytes)...\n", name, size);
+
+    startTime = microsecondsNow();
+
+    for (remaining = size; remaining > 0; ) {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        size_t got = readTimeout(fd, buffer, chunk, REPLY_TIMEOUT_MSEC);
+
+        if (got == 0) {
+            fprintf(stderr, "The OpenLog stopped sending with %lu bytes to go\n", remaining);
+            return false;
+        }
+
+        crc = crcUpdate(crc, buffer, got);
+
+        if (fwrite(buffer, 1, got, output) != got) {
+            fprintf(stderr, "Couldn't write the output\n");
+            return false;
+        }
+
+        remaining -= got;
+    }
+
+    elapsed = microsecondsNow() - startTime;
+
+    // The CRC, its line ending and the next prompt
+    if (readTimeout(fd, trailer, sizeof(trailer), REPLY_TIMEOUT_MSEC) != sizeof(trailer)
+            || !readLine(fd, line, sizeof(line)) || strcmp(line, ">") != 0) {
+        fprintf(stderr, "The OpenLog didn't finish sending %s\n", name);
+        return false;
+    }
+
+    if ((trailer[0] | (trailer[1] << 8)) != crc) {
+        fprintf(stderr, "%s arrived damaged (CRC mismatch), the card may have failed to read\n", name);
+        return false;
+    }
+
+    fprintf(stderr, "%lu bytes in %.1f s (%.0f bytes/s)\n", size, elapsed / 1000000.0,
+        elapsed ? size * 1000000.0 / elapsed : 0);
+
+    return true;
+}
+
+/**
+ * Download a file into output, or into a file of the same name if output is NULL.
+ */
+static bool saveFile(int fd, const char *name, FILE *output)
+{
+    FILE *fileOutput = output ? output : fopen(name, "wb");
+    bool success;
+
+    if (!fileOutput) {
+        fprintf(stderr, "Couldn't create '%s'\n", name);
+        return false;
+    }
+
+    success = downloadFile(fd, name, fileOutput);
+
+    if (fileOutput != output)
+        fclose(fileOutput);
+
+    return success;
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "OpenLog serial log downloader\n\n"
+        "Usage:\n"
+        "     %s [options] <serial port> [<file>...]\n\n"
+        "Each file is saved under its own name in the current directory unless --output is given.\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --baud <num>           The OpenLog's baud rate (default %d)\n"
+        "   --auto-baud            The OpenLog has auto-baud on, send the 'H' it measures the rate from\n"
+        "   --list                 List the files on the card\n"
+        "   --last                 Download the most recent log\n"
+        "   --output <filename>    Write the download here ('-' for stdout), all files end up in it\n"
+        "\n", argv0, defaultOptions.baudRate
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    enum {
+        SETTING_BAUD = 1,
+        SETTING_OUTPUT,
+    };
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"list", no_argument, &options.list, 1},
+            {"last", no_argument, &options.last, 1},
+            {"auto-baud", no_argument, &options.autoBaud, 1},
+            {"baud", required_argument, 0, SETTING_BAUD},
+            {"output", required_argument, 0, SETTING_OUTPUT},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case SETTING_BAUD:
+                options.baudRate = atoi(optarg);
+            break;
+            case SETTING_OUTPUT:
+                options.outputFilename = optarg;
+            break;
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            default:
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+        }
+    }
+
+    if (optind < argc)
+        options.device = argv[optind++];
+}
+
+int main(int argc, char **argv)
+{
+    static cardFile_t files[MAX_FILES];
+    int fd, actualRate, fileCount = 0;
+    FILE *output = NULL;
+    bool success = true;
+
+    options = defaultOptions;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help || !options.device || (!options.list && !options.last && optind == argc)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fd = serial_open(options.device, options.baudRate, 1, &actualRate);
+
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open serial port, maybe try a different baud rate?\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!enterCommandMode(fd)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    if (options.list || options.last) {
+        fileCount = listFiles(fd, files, MAX_FILES);
+
+        if (fileCount < 0) {
+            fprintf(stderr, "Couldn't list the files on the card\n");
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.list) {
+        for (int i = 0; i < fileCount; i++) {
+            printf("%-12s %10lu\n", files[i].name, (unsigned long) files[i].size);
+        }
+    }
+
+    if (options.outputFilename) {
+        output = strcmp(options.outputFilename, "-") == 0 ? stdout : fopen(options.outputFilename, "wb");
+
+        if (!output) {
+            fprintf(stderr, "Couldn't create '%s'\n", options.outputFilename);
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.last) {
+        const char *name = findLastLog(files, fileCount);
+
+        if (name) {
+            success = saveFile(fd, name, output);
+        } else {
+            fprintf(stderr, "No logs found on the card\n");
+            success = false;
+        }
+    }
+
+    for (int i = optind; success && i < argc; i++) {
+        success = saveFile(fd, argv[i], output);
+    }
+
+    // Leave the OpenLog logging again
+    sendCommand(fd, "exit");
+
+    if (output && output != stdout)
+        fclose(output);
+
+    close(fd);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
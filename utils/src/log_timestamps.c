@@ -0,0 +1,361 @@
+/*
+ * Strips the receive timestamps from a log recorded with the OpenLog's config.txt "stamp" setting, and profiles them to
+ * show when data arrived and whether the gaps in it were the flight controller going quiet or the logger falling
+ * behind. Compressed or framed logs should go through log_decompress or log_unframe first.
+ *
+ * Each timestamp record is:
+ *
+ *   ESC, 'T', 'W' or 'R' ('W' is the first read after the logger woke from sleep, micros() doesn't count the time
+ *               asleep, 'R' is written after the logger recovered from a failed card write, data before it was lost)
+ *   uint32_t    micros() just after the logger read a buffer of data (little-endian)
+ *   uint8_t     number of bytes it read
+ *   uint16_t    bytes still waiting in its RX buffer (little-endian)
+ *
+ * ESC bytes in the data itself are recorded as ESC, 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <getopt.h>
+
+#define TIMESTAMP_ESCAPE 0x10
+#define TIMESTAMP_RECORD_SIZE 9
+
+// The firmware's RX buffer, a backlog this close to full means the logger was the one holding things up
+#define FIRMWARE_RX_BUFFER_SIZE 800
+#define LOGGER_STALL_BACKLOG (FIRMWARE_RX_BUFFER_SIZE / 4)
+
+#define DEFAULT_GAP_COUNT 10
+
+typedef struct timestampOptions_t {
+    int help;
+    int gapCount;
+    const char *inputFilename;
+    const char *outputFilename;
+} timestampOptions_t;
+
+timestampOptions_t defaultOptions = {
+    .help = 0,
+    .gapCount = DEFAULT_GAP_COUNT,
+    .inputFilename = NULL,
+    .outputFilename = NULL,
+};
+
+timestampOptions_t options;
+
+typedef struct timestamp_t {
+    char type;
+    uint32_t micros;
+    uint8_t readSize;
+    uint16_t backlog;
+    uint64_t dataOffset;    // Offset in the stripped data
+} timestamp_t;
+
+typedef struct gap_t {
+    uint32_t durationUs;
+    uint64_t dataOffset;
+    uint32_t bytes;
+    uint16_t backlog;
+    bool recovery;          // Ends in the logger recovering from a card write error
+} gap_t;
+
+typedef struct timestampLog_t {
+    timestamp_t *timestamps;
+    size_t count, capacity;
+    uint64_t dataBytes;
+    uint32_t escapes, wakes, recoveries, badRecords;
+} timestampLog_t;
+
+static bool addTimestamp(timestampLog_t *log, const timestamp_t *timestamp)
+{
+    if (log->count == log->capacity) {
+        size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+        timestamp_t *timestamps = realloc(log->timestamps, capacity * sizeof(*timestamps));
+
+        if (!timestamps)
+            return false;
+
+        log->timestamps = timestamps;
+        log->capacity = capacity;
+    }
+
+    log->timestamps[log->count++] = *timestamp;
+
+    return true;
+}
+
+/**
+ * Separate the timestamps from the data, writing the data to output (if not NULL).
+ */
+static bool stripTimestamps(FILE *input, FILE *output, timestampLog_t *log)
+{
+    uint8_t record[TIMESTAMP_RECORD_SIZE];
+    int c;
+
+    while ((c = fgetc(input)) != EOF) {
+        if (c != TIMESTAMP_ESCAPE) {
+            if (output && fputc(c, output) == EOF)
+                return false;
+
+            log->dataBytes++;
+            continue;
+        }
+
+        if ((c = fgetc(input)) == EOF)
+            break;
+
+        if (c == 0) {
+            if (output && fputc(TIMESTAMP_ESCAPE, output) == EOF)
+                return false;
+
+            log->dataBytes++;
+            log->escapes++;
+        } else if (c == 'T' || c == 'W' || c == 'R') {
+            timestamp_t timestamp;
+
+            if (fread(record + 2, 1, TIMESTAMP_RECORD_SIZE - 2, input) != TIMESTAMP_RECORD_SIZE - 2)
+                break;
+
+            timestamp.type = c;
+            timestamp.micros = record[2] | (record[3] << 8) | (record[4] << 16) | ((uint32_t) record[5] << 24);
+            timestamp.readSize = record[6];
+            timestamp.backlog = record[7] | (record[8] << 8);
+            timestamp.dataOffset = log->dataBytes;
+
+            if (c == 'W')
+                log->wakes++;
+            else if (c == 'R')
+                log->recoveries++;
+
+            if (!addTimestamp(log, &timestamp))
+                return false;
+        } else {
+            // Not something the logger writes, keep it as data so nothing is lost
+            if (output && (fputc(TIMESTAMP_ESCAPE, output) == EOF || fputc(c, output) == EOF))
+                return false;
+
+            log->dataBytes += 2;
+            log->badRecords++;
+        }
+    }
+
+    return true;
+}
+
+static int compareU32(const void *a, const void *b)
+{
+    uint32_t la = *(const uint32_t*) a, lb = *(const uint32_t*) b;
+
+    return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static int compareGapDuration(const void *a, const void *b)
+{
+    const gap_t *ga = (const gap_t*) a, *gb = (const gap_t*) b;
+
+    return ga->durationUs > gb->durationUs ? -1 : ga->durationUs < gb->durationUs ? 1 : 0;
+}
+
+static void printDistribution(const char *name, uint32_t *values, size_t count, const char *units)
+{
+    if (count == 0)
+        return;
+
+    qsort(values, count, sizeof(*values), compareU32);
+
+    printf("%s: median %u %s, 99th percentile %u %s, 99.9th %u %s, max %u %s\n", name,
+        values[count / 2], units, values[(size_t) (count * 0.99)], units, values[(size_t) (count * 0.999)], units,
+        values[count - 1], units);
+}
+
+static void profile(const timestampLog_t *log)
+{
+    uint32_t *intervals = malloc(log->count * sizeof(*intervals));
+    uint32_t *backlogs = malloc(log->count * sizeof(*backlogs));
+    gap_t *gaps = malloc(log->count * sizeof(*gaps));
+    size_t intervalCount = 0;
+    uint64_t awakeUs = 0, awakeBytes = 0;
+    double bytesPerUs;
+
+    printf("%lu bytes of data, %lu timestamps (%u after waking from sleep), %u escaped data bytes",
+        (unsigned long) log->dataBytes, (unsigned long) log->count, log->wakes, log->escapes);
+    if (log->recoveries)
+        printf(", %u recoveries from card write errors", log->recoveries);
+    if (log->badRecords)
+        printf(", %u unrecognised escapes", log->badRecords);
+    printf("\n");
+
+    if (log->count < 2 || !intervals || !backlogs || !gaps) {
+        free(intervals);
+        free(backlogs);
+        free(gaps);
+        return;
+    }
+
+    for (size_t i = 0; i < log->count; i++) {
+        backlogs[i] = log->timestamps[i].backlog;
+
+        // Time asleep isn't counted by micros(), so intervals ending in a wake-up tell us nothing
+        if (i > 0 && log->timestamps[i].type != 'W') {
+            const timestamp_t *previous = &log->timestamps[i - 1];
+            gap_t *gap = &gaps[intervalCount];
+
+            gap->durationUs = log->timestamps[i].micros - previous->micros;
+            gap->dataOffset = previous->dataOffset;
+            gap->bytes = log->timestamps[i].dataOffset - previous->dataOffset;
+            gap->backlog = log->timestamps[i].backlog;
+            gap->recovery = log->timestamps[i].type == 'R';
+
+            awakeUs += gap->durationUs;
+            awakeBytes += gap->bytes;
+
+            intervals[intervalCount++] = gap->durationUs;
+        }
+    }
+
+    bytesPerUs = awakeUs ? (double) awakeBytes / awakeUs : 0;
+
+    printf("Data rate while awake: %.0f bytes/s\n", bytesPerUs * 1000000);
+    printDistribution("Time between timestamps", intervals, intervalCount, "us");
+    printDistribution("RX buffer backlog at each timestamp", backlogs, log->count, "bytes");
+
+    qsort(gaps, intervalCount, sizeof(*gaps), compareGapDuration);
+
+    printf("\nLongest gaps between timestamps:\n");
+    printf("%12s %10s %10s %10s %10s  %s\n", "data offset", "duration", "expected", "bytes", "backlog", "cause");
+
+    for (size_t i = 0; i < intervalCount && i < (size_t) options.gapCount; i++) {
+        // How long those bytes would have taken at the average rate
+        uint32_t expectedUs = bytesPerUs > 0 ? (uint32_t) (gaps[i].bytes / bytesPerUs) : 0;
+
+        printf("%12llu %8u us %8u us %10u %10u  %s\n", (unsigned long long) gaps[i].dataOffset, gaps[i].durationUs,
+            expectedUs, gaps[i].bytes, gaps[i].backlog,
+            gaps[i].recovery ? "card write failed, the logger reinitialised the card"
+                : gaps[i].backlog >= LOGGER_STALL_BACKLOG ? "logger stalled, data piled up in its RX buffer"
+                : gaps[i].durationUs > 2 * expectedUs ? "link quiet, nothing was waiting when the logger got back"
+                : "normal");
+    }
+
+    free(intervals);
+    free(backlogs);
+    free(gaps);
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "OpenLog receive timestamp profiler\n\n"
+        "Usage:\n"
+        "     %s [options] <input file>\n\n"
+        "The input can be '-' for stdin.\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --output <filename>    Write the data without its timestamps here\n"
+        "   --gaps <num>           Number of longest gaps to list (default %d)\n"
+        "\n", argv0, defaultOptions.gapCount
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    enum {
+        SETTING_OUTPUT = 1,
+        SETTING_GAPS,
+    };
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"output", required_argument, 0, SETTING_OUTPUT},
+            {"gaps", required_argument, 0, SETTING_GAPS},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case SETTING_OUTPUT:
+                options.outputFilename = optarg;
+            break;
+            case SETTING_GAPS:
+                options.gapCount = atoi(optarg);
+            break;
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            default:
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+        }
+    }
+
+    if (optind < argc)
+        options.inputFilename = argv[optind];
+}
+
+int main(int argc, char **argv)
+{
+    timestampLog_t log;
+    FILE *input, *output = NULL;
+
+    options = defaultOptions;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help || !options.inputFilename) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    input = strcmp(options.inputFilename, "-") == 0 ? stdin : fopen(options.inputFilename, "rb");
+
+    if (!input) {
+        fprintf(stderr, "Couldn't open '%s'\n", options.inputFilename);
+        return EXIT_FAILURE;
+    }
+
+    if (options.outputFilename && !(output = fopen(options.outputFilename, "wb"))) {
+        fprintf(stderr, "Couldn't create '%s'\n", options.outputFilename);
+        return EXIT_FAILURE;
+    }
+
+    memset(&log, 0, sizeof(log));
+
+    if (!stripTimestamps(input, output, &log)) {
+        fprintf(stderr, "Couldn't write the output\n");
+        return EXIT_FAILURE;
+    }
+
+    profile(&log);
+
+    if (output)
+        fclose(output);
+    if (input != stdin)
+        fclose(input);
+
+    free(log.timestamps);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,373 @@
+/*
+ * Strips the framing from the OpenLog's framed logs (config.txt "frame" setting) to get back the raw Blackbox stream,
+ * checking each block's CRC and sequence number on the way.
+ *
+ * A framed log is a series of 512 byte blocks, each holding up to 498 bytes of data followed by zero padding and a
+ * 14 byte trailer (all little-endian):
+ *
+ *   'B', 'F'    magic
+ *   uint16_t    number of bytes of data in this block
+ *   uint32_t    block sequence number, from zero at the start of each file
+ *   uint32_t    millis() when the block was finished
+ *   uint16_t    CRC-16/CCITT (reflected, initial value 0xFFFF) of the data then the trailer up to here
+ *
+ * The last block may have no trailer if the logger lost power while writing it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <getopt.h>
+
+#ifdef __MACH__
+#include <mach/clock.h>
+#include <mach/mach.h>
+#endif
+
+#define FRAME_BLOCK_SIZE 512
+#define FRAME_TRAILER_SIZE 14
+#define FRAME_PAYLOAD_SIZE (FRAME_BLOCK_SIZE - FRAME_TRAILER_SIZE)
+#define FRAME_MAGIC_0 'B'
+#define FRAME_MAGIC_1 'F'
+
+// Blocks read from the input at a time
+#define READ_BLOCKS 2048
+
+typedef struct unframeOptions_t {
+    int help;
+    int stats;
+    int keepBad;
+    const char *inputFilename;
+    const char *outputFilename;
+} unframeOptions_t;
+
+unframeOptions_t defaultOptions = {
+    .help = 0,
+    .stats = 0,
+    .keepBad = 0,
+    .inputFilename = NULL,
+    .outputFilename = NULL,
+};
+
+unframeOptions_t options;
+
+typedef struct unframeStats_t {
+    uint32_t blocks, goodBlocks, badMagic, badCRC, badLength, sequenceBreaks;
+    uint32_t firstMillis, lastMillis;
+    uint64_t bytesIn, bytesOut, unframedTail;
+} unframeStats_t;
+
+// Slicing-by-8 tables for the reflected CCITT polynomial, so the CRC goes at memory speed
+static uint16_t crcTable[8][256];
+
+static void crcInit()
+{
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+
+        crcTable[0][i] = crc;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 8; slice++) {
+            uint16_t previous = crcTable[slice - 1][i];
+
+            crcTable[slice][i] = (previous >> 8) ^ crcTable[0][previous & 0xFF];
+        }
+    }
+}
+
+static uint16_t crcUpdate(uint16_t crc, const uint8_t *data, size_t length)
+{
+    while (length >= 8) {
+        crc = crcTable[7][(data[0] ^ crc) & 0xFF] ^ crcTable[6][(data[1] ^ (crc >> 8)) & 0xFF]
+            ^ crcTable[5][data[2]] ^ crcTable[4][data[3]] ^ crcTable[3][data[4]] ^ crcTable[2][data[5]]
+            ^ crcTable[1][data[6]] ^ crcTable[0][data[7]];
+
+        data += 8;
+        length -= 8;
+    }
+
+    while (length--) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *data++) & 0xFF];
+    }
+
+    return crc;
+}
+
+static uint64_t microsecondsNow()
+{
+#ifdef __MACH__
+    clock_serv_t cclock;
+    mach_timespec_t now;
+
+    host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+    clock_get_time(cclock, &now);
+    mach_port_deallocate(mach_task_self(), cclock);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint16_t readU16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readU32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Check one block and write its data to the output. Returns false if the output couldn't be written.
+ */
+static bool unframeBlock(const uint8_t *block, FILE *output, unframeStats_t *stats, uint32_t *expectedSequence)
+{
+    const uint8_t *trailer = block + FRAME_PAYLOAD_SIZE;
+    uint16_t length = readU16(trailer + 2);
+    uint32_t sequence = readU32(trailer + 4);
+    uint32_t millis = readU32(trailer + 8);
+    bool good = false;
+
+    stats->blocks++;
+
+    if (trailer[0] != FRAME_MAGIC_0 || trailer[1] != FRAME_MAGIC_1) {
+        stats->badMagic++;
+    } else if (length > FRAME_PAYLOAD_SIZE) {
+        stats->badLength++;
+    } else {
+        uint16_t crc = crcUpdate(0xFFFF, block, length);
+
+        crc = crcUpdate(crc, trailer, FRAME_TRAILER_SIZE - 2);
+
+        if (crc != readU16(trailer + FRAME_TRAILER_SIZE - 2)) {
+            stats->badCRC++;
+        } else {
+            good = true;
+        }
+    }
+
+    if (good) {
+        if (sequence != *expectedSequence) {
+            fprintf(stderr, "Block %u has sequence number %u, expected %u\n", stats->blocks - 1, sequence,
+                *expectedSequence);
+            stats->sequenceBreaks++;
+        }
+
+        *expectedSequence = sequence + 1;
+
+        if (stats->goodBlocks == 0) {
+            stats->firstMillis = millis;
+        }
+        stats->lastMillis = millis;
+        stats->goodBlocks++;
+    } else {
+        fprintf(stderr, "Block %u (file offset %lu) is damaged%s\n", stats->blocks - 1,
+            (unsigned long) (stats->blocks - 1) * FRAME_BLOCK_SIZE, options.keepBad ? "" : ", skipping it");
+
+        (*expectedSequence)++;
+
+        if (!options.keepBad)
+            return true;
+
+        // Without a trustworthy length, keep the whole data area
+        if (length > FRAME_PAYLOAD_SIZE || trailer[0] != FRAME_MAGIC_0 || trailer[1] != FRAME_MAGIC_1)
+            length = FRAME_PAYLOAD_SIZE;
+    }
+
+    stats->bytesOut += length;
+
+    return fwrite(block, 1, length, output) == length;
+}
+
+static bool unframe(FILE *input, FILE *output, unframeStats_t *stats)
+{
+    uint8_t *buffer = malloc(READ_BLOCKS * FRAME_BLOCK_SIZE);
+    uint32_t expectedSequence = 0;
+    size_t bytesRead;
+
+    if (!buffer)
+        return false;
+
+    while ((bytesRead = fread(buffer, 1, READ_BLOCKS * FRAME_BLOCK_SIZE, input)) > 0) {
+        size_t blocks = bytesRead / FRAME_BLOCK_SIZE;
+
+        stats->bytesIn += bytesRead;
+
+        for (size_t i = 0; i < blocks; i++) {
+            if (!unframeBlock(buffer + i * FRAME_BLOCK_SIZE, output, stats, &expectedSequence)) {
+                free(buffer);
+                return false;
+            }
+        }
+
+        if (bytesRead % FRAME_BLOCK_SIZE) {
+            // Only the end of the file can be short: a block that was still being written, without its trailer yet
+            size_t tail = bytesRead % FRAME_BLOCK_SIZE;
+
+            fprintf(stderr, "The log ends with %lu bytes that were never framed, %s\n", (unsigned long) tail,
+                options.keepBad ? "keeping them" : "skipping them");
+
+            stats->unframedTail = tail;
+
+            if (options.keepBad) {
+                stats->bytesOut += tail;
+
+                if (fwrite(buffer + blocks * FRAME_BLOCK_SIZE, 1, tail, output) != tail) {
+                    free(buffer);
+                    return false;
+                }
+            }
+        }
+    }
+
+    free(buffer);
+
+    return true;
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "OpenLog framed log unpacker\n\n"
+        "Usage:\n"
+        "     %s [options] <input file>\n\n"
+        "The input can be '-' for stdin.\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --output <filename>    Write the Blackbox data here instead of stdout\n"
+        "   --keep-bad             Keep the data from damaged or unfinished blocks\n"
+        "   --stats                Print a summary and the throughput to stderr\n"
+        "\n", argv0
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    enum {
+        SETTING_OUTPUT = 1,
+    };
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"keep-bad", no_argument, &options.keepBad, 1},
+            {"stats", no_argument, &options.stats, 1},
+            {"output", required_argument, 0, SETTING_OUTPUT},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case SETTING_OUTPUT:
+                options.outputFilename = optarg;
+            break;
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            default:
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+        }
+    }
+
+    if (optind < argc)
+        options.inputFilename = argv[optind];
+}
+
+int main(int argc, char **argv)
+{
+    unframeStats_t stats;
+    FILE *input, *output;
+    uint64_t startTime, elapsed;
+    bool success;
+
+    options = defaultOptions;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help || !options.inputFilename) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    input = strcmp(options.inputFilename, "-") == 0 ? stdin : fopen(options.inputFilename, "rb");
+
+    if (!input) {
+        fprintf(stderr, "Couldn't open '%s'\n", options.inputFilename);
+        return EXIT_FAILURE;
+    }
+
+    output = options.outputFilename ? fopen(options.outputFilename, "wb") : stdout;
+
+    if (!output) {
+        fprintf(stderr, "Couldn't create '%s'\n", options.outputFilename);
+        return EXIT_FAILURE;
+    }
+
+    crcInit();
+    memset(&stats, 0, sizeof(stats));
+
+    startTime = microsecondsNow();
+    success = unframe(input, output, &stats);
+    elapsed = microsecondsNow() - startTime;
+
+    if (!success) {
+        fprintf(stderr, "Couldn't write the output\n");
+        return EXIT_FAILURE;
+    }
+
+    if (options.stats) {
+        fprintf(stderr, "%u blocks, %u good, %u bad magic, %u bad length, %u bad CRC, %u sequence breaks\n",
+            stats.blocks, stats.goodBlocks, stats.badMagic, stats.badLength, stats.badCRC, stats.sequenceBreaks);
+        fprintf(stderr, "%llu bytes in, %llu bytes of data out", (unsigned long long) stats.bytesIn,
+            (unsigned long long) stats.bytesOut);
+
+        if (stats.goodBlocks > 0) {
+            fprintf(stderr, ", covering %u ms of logging", stats.lastMillis - stats.firstMillis);
+        }
+        if (elapsed > 0) {
+            fprintf(stderr, " (%.1f MB/s)", (double) stats.bytesIn / elapsed);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (output != stdout)
+        fclose(output);
+    if (input != stdin)
+        fclose(input);
+
+    return stats.badMagic + stats.badLength + stats.badCRC > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
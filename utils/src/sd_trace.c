@@ -0,0 +1,375 @@
+/*
+ * Decodes the binary trace of card commands and block cache traffic that SdFat writes with sdTraceDump() when it is
+ * built with SD_TRACE_SIZE nonzero (the OpenLog writes it to TRACE.BIN), and prints it as a timeline followed by a
+ * summary of the time spent in each kind of operation.
+ *
+ * The trace starts with a 7 byte header (all little-endian):
+ *
+ *   'S', 'D', 'T', 'R'   magic
+ *   uint8_t              format version, 1
+ *   uint16_t             number of entries
+ *
+ * followed by the entries, 13 bytes each, in the order the operations finished:
+ *
+ *   uint8_t     operation, see SdTrace.h
+ *   uint32_t    block number, 0 for the blocks of multi-block reads and writes
+ *   uint32_t    micros() when the operation started
+ *   uint32_t    micros() when it finished
+ *
+ * Operations nest, e.g. a FAT cache miss contains the CMD17 that filled the cache, so the timeline is printed in order
+ * of starting with nested operations indented under the one that contains them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <getopt.h>
+
+#define TRACE_HEADER_SIZE 7
+#define TRACE_ENTRY_SIZE 13
+#define TRACE_VERSION 1
+
+// Deepest nesting the timeline indents for
+#define MAX_DEPTH 8
+
+typedef enum {
+    TRACE_READ_BLOCK = 0x01,
+    TRACE_READ_START = 0x02,
+    TRACE_READ_DATA = 0x03,
+    TRACE_READ_STOP = 0x04,
+    TRACE_WRITE_BLOCK = 0x05,
+    TRACE_WRITE_START = 0x06,
+    TRACE_WRITE_DATA = 0x07,
+    TRACE_WRITE_STOP = 0x08,
+    TRACE_ERASE = 0x09,
+    TRACE_CACHE_READ_DATA = 0x10,
+    TRACE_CACHE_READ_FAT = 0x11,
+    TRACE_CACHE_WRITE_DATA = 0x12,
+    TRACE_CACHE_WRITE_FAT = 0x13,
+
+    TRACE_OP_COUNT
+} traceOp_e;
+
+static const char *const opNames[TRACE_OP_COUNT] = {
+    [TRACE_READ_BLOCK] = "CMD17 read",
+    [TRACE_READ_START] = "CMD18 read start",
+    [TRACE_READ_DATA] = "read data",
+    [TRACE_READ_STOP] = "CMD12 read stop",
+    [TRACE_WRITE_BLOCK] = "CMD24 write",
+    [TRACE_WRITE_START] = "CMD25 write start",
+    [TRACE_WRITE_DATA] = "write data",
+    [TRACE_WRITE_STOP] = "write stop",
+    [TRACE_ERASE] = "erase",
+    [TRACE_CACHE_READ_DATA] = "cache miss data",
+    [TRACE_CACHE_READ_FAT] = "cache miss FAT",
+    [TRACE_CACHE_WRITE_DATA] = "cache write back data",
+    [TRACE_CACHE_WRITE_FAT] = "cache write back FAT",
+};
+
+typedef struct traceOptions_t {
+    int help;
+    int summaryOnly;
+    const char *inputFilename;
+} traceOptions_t;
+
+traceOptions_t defaultOptions = {
+    .help = 0,
+    .summaryOnly = 0,
+    .inputFilename = NULL,
+};
+
+traceOptions_t options;
+
+typedef struct traceEntry_t {
+    uint8_t op;
+    uint32_t block;
+    // Times relative to the start of the first operation in the trace
+    uint32_t start, end;
+    // Position in the trace, i.e. order of finishing
+    uint32_t index;
+} traceEntry_t;
+
+typedef struct opStats_t {
+    uint32_t count;
+    uint64_t totalMicros;
+    uint32_t maxMicros;
+} opStats_t;
+
+static uint16_t readU16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readU32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static const char *opName(uint8_t op)
+{
+    if (op < TRACE_OP_COUNT && opNames[op])
+        return opNames[op];
+
+    return "unknown";
+}
+
+/**
+ * Read the trace into a newly allocated array of entries. Returns NULL if the file isn't a trace we understand.
+ */
+static traceEntry_t *readTrace(FILE *input, uint16_t *count)
+{
+    uint8_t header[TRACE_HEADER_SIZE], raw[TRACE_ENTRY_SIZE];
+    traceEntry_t *entries;
+    uint32_t base = 0;
+    uint32_t readBlock = 0, writeBlock = 0;
+
+    if (fread(header, 1, sizeof(header), input) != sizeof(header) || memcmp(header, "SDTR", 4) != 0) {
+        fprintf(stderr, "This isn't an SdFat trace\n");
+        return NULL;
+    }
+    if (header[4] != TRACE_VERSION) {
+        fprintf(stderr, "Unsupported trace version %d\n", header[4]);
+        return NULL;
+    }
+
+    *count = readU16(header + 5);
+    entries = calloc(*count ? *count : 1, sizeof(*entries));
+
+    if (!entries) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+
+    for (uint16_t i = 0; i < *count; i++) {
+        traceEntry_t *entry = &entries[i];
+        uint32_t start;
+
+        if (fread(raw, 1, sizeof(raw), input) != sizeof(raw)) {
+            fprintf(stderr, "The trace is truncated after %u of %u entries\n", i, *count);
+            *count = i;
+            break;
+        }
+
+        entry->op = raw[0];
+        entry->block = readU32(raw + 1);
+        start = readU32(raw + 5);
+        entry->end = readU32(raw + 9) - start;
+        entry->index = i;
+
+        // Entries are in order of finishing, so the earliest start is within the first one's duration of it
+        if (i == 0 || (int32_t) (start - base) < 0)
+            base = start;
+        entry->start = start;
+
+        // The blocks of multi-block transfers aren't recorded, they follow on from the CMD18 or CMD25
+        switch (entry->op) {
+            case TRACE_READ_START:
+                readBlock = entry->block;
+            break;
+            case TRACE_READ_DATA:
+                entry->block = readBlock++;
+            break;
+            case TRACE_WRITE_START:
+                writeBlock = entry->block;
+            break;
+            case TRACE_WRITE_DATA:
+                entry->block = writeBlock++;
+            break;
+        }
+    }
+
+    // Make the times relative, micros() may have wrapped during the trace
+    for (uint16_t i = 0; i < *count; i++) {
+        uint32_t duration = entries[i].end;
+
+        entries[i].start -= base;
+        entries[i].end = entries[i].start + duration;
+    }
+
+    return entries;
+}
+
+/**
+ * Order by start time, with an operation before the ones nested inside it. An enclosing operation finishes later, so
+ * of two that start together the one that comes later in the trace goes first.
+ */
+static int compareEntries(const void *a, const void *b)
+{
+    const traceEntry_t *ea = a, *eb = b;
+
+    if (ea->start != eb->start)
+        return ea->start < eb->start ? -1 : 1;
+    if (ea->end != eb->end)
+        return ea->end > eb->end ? -1 : 1;
+
+    return ea->index > eb->index ? -1 : 1;
+}
+
+static void printTimeline(const traceEntry_t *entries, uint16_t count)
+{
+    uint32_t stackEnd[MAX_DEPTH];
+    int depth = 0;
+
+    printf("%10s %8s  %s\n", "start us", "us", "operation");
+
+    for (uint16_t i = 0; i < count; i++) {
+        const traceEntry_t *entry = &entries[i];
+
+        // Leave the operations this one isn't inside
+        while (depth > 0 && entry->end > stackEnd[depth - 1])
+            depth--;
+
+        printf("%10u %8u  %*s%s", entry->start, entry->end - entry->start, 2 * depth, "", opName(entry->op));
+
+        if (entry->op != TRACE_READ_STOP && entry->op != TRACE_WRITE_STOP)
+            printf(" %u", entry->block);
+        printf("\n");
+
+        if (depth < MAX_DEPTH)
+            stackEnd[depth++] = entry->end;
+    }
+    printf("\n");
+}
+
+static void printSummary(const traceEntry_t *entries, uint16_t count)
+{
+    opStats_t stats[TRACE_OP_COUNT];
+    uint32_t unknown = 0, span = 0;
+
+    memset(stats, 0, sizeof(stats));
+
+    for (uint16_t i = 0; i < count; i++) {
+        const traceEntry_t *entry = &entries[i];
+        uint32_t duration = entry->end - entry->start;
+
+        if (entry->end > span)
+            span = entry->end;
+
+        if (entry->op >= TRACE_OP_COUNT || !opNames[entry->op]) {
+            unknown++;
+            continue;
+        }
+
+        stats[entry->op].count++;
+        stats[entry->op].totalMicros += duration;
+        if (duration > stats[entry->op].maxMicros)
+            stats[entry->op].maxMicros = duration;
+    }
+
+    printf("%u operations over %u us\n\n", count, span);
+    printf("%-22s %8s %10s %8s %8s\n", "operation", "count", "total us", "mean us", "max us");
+
+    for (int op = 0; op < TRACE_OP_COUNT; op++) {
+        if (stats[op].count == 0)
+            continue;
+
+        printf("%-22s %8u %10llu %8.1f %8u\n", opNames[op], stats[op].count,
+            (unsigned long long) stats[op].totalMicros, (double) stats[op].totalMicros / stats[op].count,
+            stats[op].maxMicros);
+    }
+
+    if (unknown > 0)
+        printf("%u entries with an unknown operation\n", unknown);
+}
+
+void printUsage(const char *argv0)
+{
+    fprintf(stderr,
+        "SdFat card trace decoder\n\n"
+        "Usage:\n"
+        "     %s [options] <input file>\n\n"
+        "The input is a trace from sdTraceDump() (TRACE.BIN on an OpenLog built with SD_TRACE_SIZE), or '-' for stdin.\n\n"
+        "Options:\n"
+        "   --help                 This page\n"
+        "   --summary              Only print the time spent in each operation, not the timeline\n"
+        "\n", argv0
+    );
+}
+
+static void parseCommandlineOptions(int argc, char **argv)
+{
+    int c;
+
+    while (1)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, &options.help, 1},
+            {"summary", no_argument, &options.summaryOnly, 1},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        opterr = 0;
+
+        c = getopt_long(argc, argv, ":", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case '\0':
+                //Longopt which has set a flag
+            break;
+            case ':':
+                fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], argv[optind - 1]);
+                exit(-1);
+            break;
+            default:
+                if (optopt == 0)
+                    fprintf(stderr, "%s: option '%s' is invalid\n", argv[0], argv[optind - 1]);
+                else
+                    fprintf(stderr, "%s: option '-%c' is invalid\n", argv[0], optopt);
+
+                exit(-1);
+            break;
+        }
+    }
+
+    if (optind < argc)
+        options.inputFilename = argv[optind];
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input;
+    traceEntry_t *entries;
+    uint16_t count;
+
+    options = defaultOptions;
+
+    parseCommandlineOptions(argc, argv);
+
+    if (options.help || !options.inputFilename) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    input = strcmp(options.inputFilename, "-") == 0 ? stdin : fopen(options.inputFilename, "rb");
+
+    if (!input) {
+        fprintf(stderr, "Couldn't open '%s'\n", options.inputFilename);
+        return EXIT_FAILURE;
+    }
+
+    entries = readTrace(input, &count);
+
+    if (input != stdin)
+        fclose(input);
+
+    if (!entries)
+        return EXIT_FAILURE;
+
+    qsort(entries, count, sizeof(*entries), compareEntries);
+
+    if (!options.summaryOnly)
+        printTimeline(entries, count);
+
+    printSummary(entries, count);
+
+    free(entries);
+
+    return EXIT_SUCCESS;
+}
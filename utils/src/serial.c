@@ -31,7 +31,7 @@ static int rate_to_constant(int baudrate) {
             return B500000;
 #endif
 #ifdef B576000
-        case 576000;
+        case 576000:
             return B576000;
 #endif
 #ifdef B921600
@@ -51,43 +51,24 @@ static int rate_to_constant(int baudrate) {
     }
 }
 
-// From https://jim.sh/ftx/files/linux-custom-baudrate.c:
+// Originally from https://jim.sh/ftx/files/linux-custom-baudrate.c:
 /* Open serial port in raw mode, with custom baudrate if necessary */
-int serial_open(const char *device, int rate, int stopbits)
+int serial_open(const char *device, int rate, int stopbits, int *actualRate)
 {
     struct termios options;
     int fd;
     int speed = 0;
 
-    if ((fd = open(device, O_RDWR | O_NOCTTY)) == -1)
-        return -1;
-
     speed = rate_to_constant(rate);
 
-    if (speed == 0) {
+#ifndef __linux__
+    // Without termios2 we have no way to ask for a rate that doesn't have a constant
+    if (speed == 0)
+        return -1;
+#endif
+
+    if ((fd = open(device, O_RDWR | O_NOCTTY)) == -1)
         return -1;
-        /* Custom divisor */
-        /* struct serial_struct serinfo;
-         *
-         *
-         * serinfo.reserved_char[0] = 0;
-        if (ioctl(fd, TIOCGSERIAL, &serinfo) < 0)
-            return -1;
-        serinfo.flags &= ~ASYNC_SPD_MASK;
-        serinfo.flags |= ASYNC_SPD_CUST;
-        serinfo.custom_divisor = (serinfo.baud_base + (rate / 2)) / rate;
-        if (serinfo.custom_divisor < 1)
-            serinfo.custom_divisor = 1;
-        if (ioctl(fd, TIOCSSERIAL, &serinfo) < 0)
-            return -1;
-        if (ioctl(fd, TIOCGSERIAL, &serinfo) < 0)
-            return -1;
-        if (serinfo.custom_divisor * rate != serinfo.baud_base) {
-            warnx("actual baudrate is %d / %d = %f",
-                  serinfo.baud_base, serinfo.custom_divisor,
-                  (float)serinfo.baud_base / serinfo.custom_divisor);
-        }*/
-    }
 
     fcntl(fd, F_SETFL, 0);
     tcgetattr(fd, &options);
@@ -107,7 +88,31 @@ int serial_open(const char *device, int rate, int stopbits)
     }
 
     if (tcsetattr(fd, TCSANOW, &options) != 0)
-        return -1;
+        goto fail;
+
+#ifdef __linux__
+    {
+        // Custom rates go through termios2/BOTHER, standard ones are just read back to find the achieved rate
+        int achieved = serial_linux_set_rate(fd, speed == 0 ? rate : 0);
+
+        if (achieved == -1) {
+            if (speed == 0)
+                goto fail;
+
+            achieved = rate;
+        }
+
+        if (actualRate)
+            *actualRate = achieved;
+    }
+#else
+    if (actualRate)
+        *actualRate = rate;
+#endif
 
     return fd;
+
+fail:
+    close(fd);
+    return -1;
 }
@@ -1,6 +1,31 @@
 #ifndef SERIAL_H_
 #define SERIAL_H_
 
-int serial_open(const char *device, int rate, int stopbits);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Open the serial port in raw mode at the given baud rate. Any rate can be requested on Linux, other operating systems
+ * are limited to the rates that they have Bxxx constants for.
+ *
+ * If actualRate is non-NULL, it receives the rate that the driver actually achieved, which can differ from the
+ * requested rate when the UART's clock divisor can't produce it exactly.
+ *
+ * Returns the fd, or -1 on failure.
+ */
+int serial_open(const char *device, int rate, int stopbits, int *actualRate);
+
+#ifdef __linux__
+/**
+ * Set an arbitrary baud rate on an already configured port using termios2/BOTHER, or just read back the current rate
+ * if rate is zero. Returns the rate the driver reports it achieved, or -1 on failure.
+ */
+int serial_linux_set_rate(int fd, int rate);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
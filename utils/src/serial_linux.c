@@ -0,0 +1,37 @@
+#ifdef __linux__
+
+/*
+ * termios2 lives in the kernel headers, which clash with glibc's <termios.h>, so it gets a file of its own.
+ */
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+#include "serial.h"
+
+int serial_linux_set_rate(int fd, int rate)
+{
+    struct termios2 options;
+
+    if (ioctl(fd, TCGETS2, &options) != 0)
+        return -1;
+
+    if (rate > 0) {
+        options.c_cflag &= ~CBAUD;
+        options.c_cflag |= BOTHER;
+        options.c_cflag &= ~(CBAUD << IBSHIFT);
+        options.c_cflag |= BOTHER << IBSHIFT;
+        options.c_ispeed = rate;
+        options.c_ospeed = rate;
+
+        if (ioctl(fd, TCSETS2, &options) != 0)
+            return -1;
+
+        // Read the settings back since the driver rounds the rate to whatever its divisor can achieve
+        if (ioctl(fd, TCGETS2, &options) != 0)
+            return -1;
+    }
+
+    return options.c_ospeed;
+}
+
+#endif